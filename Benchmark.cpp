@@ -0,0 +1,340 @@
+/*
+Benchmark suite. For each input graph and radius, the microbenchmarks process every vertex as a root with a single
+reused rootedGraph and measure
+  - ballBuild: the construction of rooted graphs, in the order of the input file and in each ordering of network::reorder,
+  - canonicalForm, H1Counts, H1Barcode, primitiveRings (possiblePrimitive and checkPrimitiveDirected), valenceProfile,
+    shellCount and colorRefinement: the ball construction followed by the computation (subtract ballBuild for the computation alone),
+  - probe: the construction of the key of a precomputed equivalence class and its lookup in the dictionary of an
+    empiricalDistribution that already contains it (for each selected type),
+  - loadCfg, saveDat, loadDat, saveBdat and loadBdat: reading the graph and writing and reading its distribution of
+    shell counts (the number of roots is the number of vertices or of stored equivalence classes).
+Each microbenchmark is repeated until at least --time seconds have elapsed. The end-to-end benchmarks compute the
+empirical distribution of each selected type and radius once for each number of threads, splitting the roots into
+one shard per thread (as with --roots in Swatches), each with its own copy of the graph, and merging the shards. Type 0
+only runs with one thread, since nauty and the arrays of rootedGraph::canonicalForm are shared by all threads.
+
+Results are printed to the screen, and saved in CSV and JSON formats with --csv and --json, with one record per
+measurement: benchmark, file, variant, type, radius, threads, roots, seconds, rootsPerSecond and meanBallSize (-1 when
+not applicable).
+
+Options:
+ --files: comma-separated graphs (default: voronoi_uniform_10K.cfg,voronoi_lattice_10K.cfg)
+ --types: comma-separated equivalence types (default: 0,1,2,3,4,5)
+ --radii: comma-separated radii (default: 1,2,3,4,5,6)
+ --threads: comma-separated numbers of threads for the end-to-end benchmarks (default: 1,2,4,... up to the number of
+            hardware threads)
+ --time: minimum number of seconds for each microbenchmark (default: 0.5)
+ --micro: only run the microbenchmarks
+ --end-to-end: only run the end-to-end benchmarks
+ --csv, --json: names of the output files
+
+To compile, use the following:
+
+ g++ Benchmark.cpp Classification.cpp RootedGraph.cpp nauty26r12/nauty.c nauty26r12/nautil.c nauty26r12/schreier.c nauty26r12/naurng.c nauty26r12/nausparse.c -Wno-write-strings -o swatches_bench -std=c++0x -O2 -pthread
+
+*/
+
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <stdio.h>
+#include <getopt.h>
+#include "Classification.h"
+
+
+
+using namespace std;
+
+
+
+struct benchResult{
+	string benchmark;
+	string file;
+	string variant;
+	int type;
+	int r;
+	int threads;
+	long roots;
+	double seconds;
+	double meanBallSize;
+
+	double rootsPerSecond(){return (seconds>0)?roots/seconds:0;}
+};
+
+vector<benchResult> results;
+
+void report(string benchmark, string file, string variant, int type, int r, int threads, long roots, double seconds, double meanBallSize=-1){
+	benchResult cur={benchmark,file,variant,type,r,threads,roots,seconds,meanBallSize};
+	results.push_back(cur);
+	cout<<benchmark<<"\t"<<file<<"\t"<<variant<<"\tt="<<type<<"\tr="<<r<<"\tthreads="<<threads<<"\t"<<cur.rootsPerSecond()<<" roots/second";
+	if (meanBallSize>=0){cout<<"\tball "<<meanBallSize;}
+	cout<<endl;
+}
+
+double elapsedSince(chrono::steady_clock::time_point start){
+	return chrono::duration<double>(chrono::steady_clock::now()-start).count();
+}
+
+//Runs pass once to warm up, then repeatedly until minTime seconds have elapsed. Returns the time per pass.
+double timePasses(function<void()> pass, double minTime){
+	pass();
+	int repetitions=0;
+	chrono::steady_clock::time_point start=chrono::steady_clock::now();
+	double elapsed=0;
+	while (elapsed<minTime){
+		pass();
+		repetitions++;
+		elapsed=elapsedSince(start);
+	}
+	return elapsed/repetitions;
+}
+
+//Runs f on the rooted graph of every vertex of curGraph.
+void forEachBall(network* curGraph, rootedGraph& rGraph, int r, function<void()> f){
+	for (int i=0;i<curGraph->vertices.size();i++){
+		rGraph.build(curGraph->vertices[i],r);
+		f();
+		rGraph.clear();
+	}
+}
+
+vector<int> parseInts(string toParse){
+	vector<int> toReturn;
+	stringstream ss(toParse);
+	string substring;
+	while (getline(ss,substring,',')){toReturn.push_back(atoi(substring.c_str()));}
+	return toReturn;
+}
+
+vector<string> parseStrings(string toParse){
+	vector<string> toReturn;
+	stringstream ss(toParse);
+	string substring;
+	while (getline(ss,substring,',')){toReturn.push_back(substring);}
+	return toReturn;
+}
+
+bool contains(vector<int>& v, int x){return find(v.begin(),v.end(),x)!=v.end();}
+
+void microbenchmarks(string filename, vector<int>& types, vector<int>& radii, double minTime){
+	vector<string> orderingNames={"input","breadthFirst","reverseCuthillMcKee","recursiveBisection"};
+	for (int ordering=-1;ordering<=2;ordering++){
+		network* curGraph=new network(filename);
+		if (ordering>=0){curGraph->reorder(ordering);}
+		int numVerts=curGraph->vertices.size();
+		rootedGraph rGraph;
+		for (int k=0;k<radii.size();k++){
+			int r=radii[k];
+			long ballSizes=0;
+			forEachBall(curGraph,rGraph,r,[&](){ballSizes+=rGraph.size();});
+			double seconds=timePasses([&](){forEachBall(curGraph,rGraph,r,[](){});},minTime);
+			report("ballBuild",filename,orderingNames[ordering+1],-1,r,1,numVerts,seconds,((double) ballSizes)/numVerts);
+		}
+		delete curGraph;
+	}
+
+	chrono::steady_clock::time_point start=chrono::steady_clock::now();
+	network* curGraph=new network(filename);
+	double loadSeconds=elapsedSince(start);
+	delete curGraph;
+	loadSeconds=min(loadSeconds,timePasses([&](){delete new network(filename);},minTime));
+	curGraph=new network(filename);
+	int numVerts=curGraph->vertices.size();
+	report("loadCfg",filename,"",-1,0,1,numVerts,loadSeconds);
+
+	vector<vector<int> > references=curGraph->computeReferences(curGraph->vertices[0]);
+	rootedGraph rGraph;
+	for (int k=0;k<radii.size();k++){
+		int r=radii[k];
+		if (contains(types,0)){
+			double seconds=timePasses([&](){forEachBall(curGraph,rGraph,r,[&](){delete rGraph.canonicalForm();});},minTime);
+			report("canonicalForm",filename,"",0,r,1,numVerts,seconds);
+		}
+		if (contains(types,1)){
+			vector<vector<vector<vector<int> > > > mobius=computeMobius(r);
+			double seconds=timePasses([&](){forEachBall(curGraph,rGraph,r,[&](){rGraph.computeH1Counts();});},minTime);
+			report("H1Counts",filename,"",1,r,1,numVerts,seconds);
+			seconds=timePasses([&](){forEachBall(curGraph,rGraph,r,[&](){delete rGraph.H1Barcode(mobius);});},minTime);
+			report("H1Barcode",filename,"",1,r,1,numVerts,seconds);
+		}
+		if (contains(types,2)){
+			double seconds=timePasses([&](){forEachBall(curGraph,rGraph,r,[&](){
+				vector<vector<vertex*> > candidateRings=rGraph.possiblePrimitive(r);
+				for (int j=0;j<candidateRings.size();j++){checkPrimitiveDirected(candidateRings[j],references);}
+			});},minTime);
+			report("primitiveRings",filename,"",2,r,1,numVerts,seconds);
+		}
+		if (contains(types,3)){
+			double seconds=timePasses([&](){forEachBall(curGraph,rGraph,r,[&](){delete rGraph.valenceProfile();});},minTime);
+			report("valenceProfile",filename,"",3,r,1,numVerts,seconds);
+		}
+		if (contains(types,4)){
+			double seconds=timePasses([&](){forEachBall(curGraph,rGraph,r,[&](){delete rGraph.shellCount();});},minTime);
+			report("shellCount",filename,"",4,r,1,numVerts,seconds);
+		}
+		if (contains(types,5)){
+			double seconds=timePasses([&](){forEachBall(curGraph,rGraph,r,[&](){delete rGraph.colorRefinement();});},minTime);
+			report("colorRefinement",filename,"",5,r,1,numVerts,seconds);
+		}
+
+		//dictionary probes, with the classes of every root precomputed
+		for (int t=0;t<types.size();t++){
+			int type=types[t];
+			if (type==2){continue;} //primitive rings are computed globally by computeDistribution
+			empiricalDistribution* cloth=new empiricalDistribution(type,r,-1);
+			cloth->numPreps=1;
+			cloth->maxExamples=0;
+			vector<vector<vector<int> > > classData;
+			for (int i=0;i<numVerts;i++){
+				rGraph.build(curGraph->vertices[i],r);
+				eClass* curClass=cloth->classify(rGraph);
+				rGraph.clear();
+				classData.push_back(curClass->data);
+				delete curClass;
+			}
+			double seconds=timePasses([&](){
+				for (int i=0;i<numVerts;i++){cloth->addRoot(new eClass(type,r,classData[i]),0,i);}
+			},minTime);
+			report("probe",filename,"",type,r,1,numVerts,seconds);
+			delete cloth;
+		}
+	}
+
+	//saving and loading distributions
+	int r=radii.back();
+	empiricalDistribution* cloth=new empiricalDistribution(4,r,-1);
+	cloth->computeDistribution(curGraph);
+	string tempName="swatches_bench_temp";
+	long numClasses=cloth->numClasses;
+	double seconds=timePasses([&](){cloth->saveData_toLoad(tempName);},minTime);
+	report("saveDat",filename,"",4,r,1,numClasses,seconds);
+	seconds=timePasses([&](){delete new empiricalDistribution(tempName+".dat");},minTime);
+	report("loadDat",filename,"",4,r,1,numClasses,seconds);
+	seconds=timePasses([&](){cloth->saveData_toBinary(tempName);},minTime);
+	report("saveBdat",filename,"",4,r,1,numClasses,seconds);
+	seconds=timePasses([&](){delete new empiricalDistribution(tempName+".bdat");},minTime);
+	report("loadBdat",filename,"",4,r,1,numClasses,seconds);
+	remove((tempName+".dat").c_str());
+	remove((tempName+".bdat").c_str());
+	delete cloth;
+	delete curGraph;
+}
+
+void endToEnd(string filename, vector<int>& types, vector<int>& radii, vector<int>& threadCounts){
+	for (int c=0;c<threadCounts.size();c++){
+		int numThreads=threadCounts[c];
+		//each thread marks the vertices of its own copy of the graph while building rooted graphs
+		vector<network*> graphs;
+		for (int t=0;t<numThreads;t++){graphs.push_back(new network(filename));}
+		int numVerts=graphs[0]->vertices.size();
+
+		for (int i=0;i<types.size();i++){for (int k=0;k<radii.size();k++){
+			if ((types[i]==0) and (numThreads>1)){continue;} //canonicalForm is not reentrant
+			vector<empiricalDistribution*> shards;
+			for (int t=0;t<numThreads;t++){
+				shards.push_back(new empiricalDistribution(types[i],radii[k],-1));
+				shards[t]->rootBegin=(((long) numVerts)*t)/numThreads;
+				shards[t]->rootEnd=(((long) numVerts)*(t+1))/numThreads;
+			}
+			chrono::steady_clock::time_point start=chrono::steady_clock::now();
+			parallelFor(numThreads,[&](int t){shards[t]->computeDistribution(graphs[t]);},numThreads);
+			for (int t=1;t<numThreads;t++){shards[0]->merge(shards[t]);}
+			double seconds=elapsedSince(start);
+			report("endToEnd",filename,"",types[i],radii[k],numThreads,numVerts,seconds);
+			for (int t=0;t<numThreads;t++){delete shards[t];}
+		}}
+		for (int t=0;t<numThreads;t++){delete graphs[t];}
+	}
+}
+
+void saveCSV(string filename){
+	ofstream fs(filename);
+	fs<<"benchmark,file,variant,type,radius,threads,roots,seconds,rootsPerSecond,meanBallSize"<<endl;
+	for (int i=0;i<results.size();i++){
+		benchResult& cur=results[i];
+		fs<<cur.benchmark<<","<<cur.file<<","<<cur.variant<<","<<cur.type<<","<<cur.r<<","<<cur.threads<<","<<cur.roots<<","<<cur.seconds<<","<<cur.rootsPerSecond()<<","<<cur.meanBallSize<<endl;
+	}
+	fs.close();
+}
+
+void saveJSON(string filename, double minTime){
+	ofstream fs(filename);
+	fs<<"{"<<endl;
+	fs<<"  \"hardwareThreads\": "<<thread::hardware_concurrency()<<","<<endl;
+	fs<<"  \"minimumSeconds\": "<<minTime<<","<<endl;
+	fs<<"  \"results\": ["<<endl;
+	for (int i=0;i<results.size();i++){
+		benchResult& cur=results[i];
+		fs<<"    {\"benchmark\": \""<<cur.benchmark<<"\", \"file\": \""<<cur.file<<"\", \"variant\": \""<<cur.variant<<"\", \"type\": "<<cur.type<<", \"radius\": "<<cur.r<<", \"threads\": "<<cur.threads<<", \"roots\": "<<cur.roots<<", \"seconds\": "<<cur.seconds<<", \"rootsPerSecond\": "<<cur.rootsPerSecond()<<", \"meanBallSize\": "<<cur.meanBallSize<<"}"<<((i<results.size()-1)?",":"")<<endl;
+	}
+	fs<<"  ]"<<endl<<"}"<<endl;
+	fs.close();
+}
+
+int main(int argc, char** argv) {
+
+	vector<string> dataFiles={"voronoi_uniform_10K.cfg","voronoi_lattice_10K.cfg"};
+	vector<int> types={0,1,2,3,4,5};
+	vector<int> radii={1,2,3,4,5,6};
+	vector<int> threadCounts={};
+	for (int t=1;t<=max(1,(int) thread::hardware_concurrency());t*=2){threadCounts.push_back(t);}
+	double minTime=0.5;
+	bool micro=true;
+	bool end=true;
+	string csvFile="";
+	string jsonFile="";
+
+	enum {FILES=256,TYPES,RADII,THREADS,TIME,MICRO,END_TO_END,CSV,JSON};
+	static struct option longOptions[]={
+		{"files",required_argument,0,FILES},
+		{"types",required_argument,0,TYPES},
+		{"radii",required_argument,0,RADII},
+		{"threads",required_argument,0,THREADS},
+		{"time",required_argument,0,TIME},
+		{"micro",no_argument,0,MICRO},
+		{"end-to-end",no_argument,0,END_TO_END},
+		{"csv",required_argument,0,CSV},
+		{"json",required_argument,0,JSON},
+		{0,0,0,0}
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc,argv,"",longOptions,NULL)) != EOF)
+	switch(opt)
+	{
+		case FILES: dataFiles=parseStrings(optarg); break;
+		case TYPES: types=parseInts(optarg); break;
+		case RADII: radii=parseInts(optarg); break;
+		case THREADS: threadCounts=parseInts(optarg); break;
+		case TIME: minTime=atof(optarg); break;
+		case MICRO: end=false; break;
+		case END_TO_END: micro=false; break;
+		case CSV: csvFile=optarg; break;
+		case JSON: jsonFile=optarg; break;
+		case '?': fprintf(stderr, "Usage is \n --files: for names of graphs \n --types: for the equivalence class types \n --radii: for the radii \n --threads: for the numbers of threads of the end-to-end benchmarks \n --time: for the minimum number of seconds of each microbenchmark \n --micro: to only run the microbenchmarks \n --end-to-end: to only run the end-to-end benchmarks \n --csv: for the name of a CSV file of results \n --json: for the name of a JSON file of results \n"); return 1;
+	}
+
+	if (radii.size()==0){radii={3};}
+
+	for (int f=0;f<dataFiles.size();f++){
+		if (micro){microbenchmarks(dataFiles[f],types,radii,minTime);}
+		if (end){endToEnd(dataFiles[f],types,radii,threadCounts);}
+	}
+
+	if (csvFile!=""){
+		saveCSV(csvFile);
+		cout<<"Results saved to "<<csvFile<<"."<<endl;
+	}
+	if (jsonFile!=""){
+		saveJSON(jsonFile,minTime);
+		cout<<"Results saved to "<<jsonFile<<"."<<endl;
+	}
+}
@@ -12,11 +12,23 @@
 #include <unordered_map>
 #include <utility> 
 #include <iomanip> 
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <boost/array.hpp>
  
 
 #include "RootedGraph.h"
 #include "Classification.h"
+#include "Stats.h"
+#include "InlineKeys.h"
 
 using namespace std;
 
@@ -35,13 +47,21 @@ void network::load(string filename)
 		cout<<"WARNING: "<<filename<<" CANNOT BE OPENED."<<endl;
 	}
 
+	load(file,filename);
+	file.close();
+}
+
+//loads one graph from a stream, leaving the stream at the line following it. Returns false if no graph is left.
+bool network::load(istream& file, string filename)
+{
+	STATS_START(load);
 	string line;
 	int startInd=vertices.size(); //check if there are already vertices in the graph
 
-	getline(file,line);
+	if (!getline(file,line)){return false;}
 	stringstream linestream(line);
 	int numVerts;
-	linestream>>numVerts;
+	if (!(linestream>>numVerts)){return false;}
 	linestream>>dataPrep;
 
 	if (numVerts!=numVerts){cout<<"WARNING: "<<filename<<" NOT IN CORRECT FORMAT."<<endl;}
@@ -56,9 +76,9 @@ void network::load(string filename)
 	for (int i=0;i<numVerts;i++){
 		getline(file,line);
 		stringstream linestream2(line);
-		linestream2>>vertices[i]->color;
+		linestream2>>vertices[i+startInd]->color;
 
-		if (vertices[i]->color!=vertices[i]->color){cout<<"WARNING: "<<filename<<" NOT IN CORRECT FORMAT."<<endl;}
+		if (vertices[i+startInd]->color!=vertices[i+startInd]->color){cout<<"WARNING: "<<filename<<" NOT IN CORRECT FORMAT."<<endl;}
 		
 		int neighborInd;
 		while (linestream2>>neighborInd){
@@ -66,9 +86,11 @@ void network::load(string filename)
 			vertices[i+startInd]->neighbors.push_back(vertices[neighborInd+startInd]);
 		}
 	}
-	file.close();
 	
+	STATS_STOP(load,STATS_LOAD);
+
 	//ensure that the network is symmetric
+	STATS_TIMER(STATS_SYMMETRIZE);
 	for (int i=startInd;i<vertices.size();i++){
 		vertex* curVert=vertices[i];
 		for (int j=0;j<curVert->neighbors.size();j++){
@@ -82,6 +104,7 @@ void network::load(string filename)
 			}
 		}
 	}
+	return true;
 }
 
 /*
@@ -133,6 +156,581 @@ void network::loadRodney(string filename)
 	file.close();
 }
 
+void network::load(int numVerts, const int64_t* offsets, const int32_t* adjacency, const int32_t* colors, int dataPrep1)
+{
+	STATS_TIMER(STATS_LOAD);
+	dataPrep=dataPrep1;
+	if (vertices.size()!=numVerts){
+		for (int i=0;i<vertices.size();i++){delete vertices[i];}
+		vertices.clear();
+		for (int i=0;i<numVerts;i++){vertices.push_back(new vertex(i));}
+	}
+	originalIndex.clear();
+	rootClasses.clear();
+	rootCandidates.clear();
+	changedVertices.clear();
+	for (int i=0;i<numVerts;i++){
+		vertex* curVert=vertices[i];
+		curVert->color=(colors!=NULL)?colors[i]:0;
+		curVert->neighbors.clear();
+		//reused vertices keep the local variables of the previous graph
+		curVert->in=false;
+		curVert->isIndex=false;
+		curVert->curIndex=-1;
+		curVert->distance=INT_MAX;
+		curVert->primitiveRingProfile.clear();
+		curVert->bridged=false;
+		for (int64_t k=offsets[i];k<offsets[i+1];k++){curVert->neighbors.push_back(vertices[adjacency[k]]);}
+	}
+}
+
+//The first frame of an XYZ or LAMMPS dump file. The cell vectors are the columns of cell, and periodic[d] is true if
+//the boundary is periodic along cell vector d. If the file has no cell, hasCell is false. If an atom cannot be read,
+//badLine is the number of its line in the file.
+struct coordinateFrame{
+	vector<string> atomSpecies;
+	vector<double> positions; //x, y, z of each atom
+	double cell[3][3];
+	double origin[3];
+	bool periodic[3];
+	bool hasCell;
+	int badLine;
+};
+
+//reads a number from a token, returning false if the token is not a number
+static bool readNumber(string token, double& x){
+	stringstream ss(token);
+	ss>>x;
+	return !ss.fail();
+}
+
+static bool readXYZ(istream& file, coordinateFrame& frame, string firstLine){
+	int numAtoms=atoi(firstLine.c_str());
+	if (numAtoms<=0){
+		frame.badLine=1;
+		return false;
+	}
+	string comment;
+	getline(file,comment);
+
+	//extended XYZ: Lattice="ax ay az bx by bz cx cy cz" pbc="T T T" Properties=species:S:1:pos:R:3
+	int speciesColumn=0;
+	int posColumn=1;
+	size_t found=comment.find("Lattice=\"");
+	if (found!=string::npos){
+		stringstream ss(comment.substr(found+9));
+		for (int d=0;d<3;d++){for (int e=0;e<3;e++){ss>>frame.cell[e][d];}}
+		frame.hasCell=true;
+		for (int d=0;d<3;d++){frame.origin[d]=0; frame.periodic[d]=true;}
+		found=comment.find("pbc=\"");
+		if (found!=string::npos){
+			stringstream ss2(comment.substr(found+5));
+			for (int d=0;d<3;d++){
+				string flag;
+				ss2>>flag;
+				frame.periodic[d]=(flag[0]=='T') or (flag[0]=='t');
+			}
+		}
+	}
+	found=comment.find("Properties=");
+	if (found!=string::npos){
+		stringstream ss(comment.substr(found+11));
+		string properties;
+		ss>>properties;
+		stringstream ps(properties);
+		string name, kind, count;
+		int column=0;
+		while (getline(ps,name,':') and getline(ps,kind,':') and getline(ps,count,':')){
+			if (name=="species"){speciesColumn=column;}
+			if (name=="pos"){posColumn=column;}
+			column+=atoi(count.c_str());
+		}
+	}
+
+	string line;
+	for (int i=0;i<numAtoms;i++){
+		frame.badLine=i+3;
+		if (!getline(file,line)){return false;}
+		stringstream ss(line);
+		string token;
+		double pos[3];
+		int numRead=0; //species and coordinates
+		for (int column=0;ss>>token;column++){
+			if (column==speciesColumn){
+				frame.atomSpecies.push_back(token);
+				numRead++;
+			}
+			else if ((column>=posColumn) and (column<posColumn+3)){
+				if (!readNumber(token,pos[column-posColumn])){return false;}
+				numRead++;
+			}
+		}
+		if (numRead<4){return false;}
+		for (int d=0;d<3;d++){frame.positions.push_back(pos[d]);}
+	}
+	frame.badLine=0;
+	return true;
+}
+
+static bool readDump(istream& file, coordinateFrame& frame){
+	string line;
+	int numAtoms=0;
+	double bounds[3][3]={{0,0,0},{0,0,0},{0,0,0}}; //lo, hi, tilt
+	bool triclinic=false;
+	int lineNumber=1; //of line, the first line having been read by the caller
+	while (getline(file,line)){
+		lineNumber++;
+		if (line.find("ITEM: NUMBER OF ATOMS")==0){
+			getline(file,line);
+			lineNumber++;
+			numAtoms=atoi(line.c_str());
+		}
+		else if (line.find("ITEM: BOX BOUNDS")==0){
+			stringstream ss(line.substr(16));
+			vector<string> flags;
+			string flag;
+			while (ss>>flag){flags.push_back(flag);}
+			triclinic=(flags.size()>=6);
+			for (int d=0;d<3;d++){frame.periodic[d]=(flags.size()>=3) and (flags[flags.size()-3+d]=="pp");}
+			for (int d=0;d<3;d++){
+				getline(file,line);
+				lineNumber++;
+				stringstream ss2(line);
+				ss2>>bounds[d][0]>>bounds[d][1];
+				if (triclinic){ss2>>bounds[d][2];}
+			}
+		}
+		else if (line.find("ITEM: ATOMS")==0){break;}
+	}
+	if (line.find("ITEM: ATOMS")!=0){return false;}
+
+	//the box: for triclinic boxes, the bounds are those of the bounding box
+	double xy=bounds[0][2], xz=bounds[1][2], yz=bounds[2][2];
+	double xlo=bounds[0][0]-min(min(0.0,xy),min(xz,xy+xz));
+	double xhi=bounds[0][1]-max(max(0.0,xy),max(xz,xy+xz));
+	double ylo=bounds[1][0]-min(0.0,yz);
+	double yhi=bounds[1][1]-max(0.0,yz);
+	double cell[3][3]={{xhi-xlo,xy,xz},{0,yhi-ylo,yz},{0,0,bounds[2][1]-bounds[2][0]}};
+	for (int d=0;d<3;d++){for (int e=0;e<3;e++){frame.cell[d][e]=cell[d][e];}}
+	frame.origin[0]=xlo;
+	frame.origin[1]=ylo;
+	frame.origin[2]=bounds[2][0];
+	frame.hasCell=true;
+
+	//columns
+	stringstream ss(line.substr(11));
+	vector<string> columns;
+	string column;
+	while (ss>>column){columns.push_back(column);}
+	int idColumn=-1, typeColumn=-1, elementColumn=-1, posColumn[3]={-1,-1,-1};
+	bool scaled=false;
+	string names[3]={"x","y","z"};
+	for (int c=0;c<columns.size();c++){
+		if (columns[c]=="id"){idColumn=c;}
+		else if (columns[c]=="type"){typeColumn=c;}
+		else if (columns[c]=="element"){elementColumn=c;}
+		for (int d=0;d<3;d++){
+			if ((columns[c]==names[d]) or (columns[c]==names[d]+"u")){posColumn[d]=c;}
+			if ((columns[c]==names[d]+"s") or (columns[c]==names[d]+"su")){posColumn[d]=c; scaled=true;}
+		}
+	}
+	if ((posColumn[0]<0) or (posColumn[1]<0) or (posColumn[2]<0)){return false;}
+	int speciesColumn=(elementColumn>=0)?elementColumn:typeColumn;
+
+	vector<pair<long,int> > ids;
+	vector<string> atomSpecies;
+	vector<double> positions;
+	for (int i=0;i<numAtoms;i++){
+		frame.badLine=lineNumber+i+1;
+		if (!getline(file,line)){return false;}
+		stringstream ls(line);
+		vector<string> tokens;
+		string token;
+		while (ls>>token){tokens.push_back(token);}
+		if (tokens.size()<columns.size()){return false;}
+		ids.push_back(make_pair((idColumn>=0)?atol(tokens[idColumn].c_str()):i,i));
+		atomSpecies.push_back((speciesColumn>=0)?tokens[speciesColumn]:"1");
+		double pos[3];
+		for (int d=0;d<3;d++){if (!readNumber(tokens[posColumn[d]],pos[d])){return false;}}
+		for (int d=0;d<3;d++){
+			if (scaled){
+				double x=frame.origin[d];
+				for (int e=0;e<3;e++){x+=frame.cell[d][e]*pos[e];}
+				positions.push_back(x);
+			}
+			else {positions.push_back(pos[d]);}
+		}
+	}
+
+	frame.badLine=0;
+
+	//order the atoms by id
+	sort(ids.begin(),ids.end());
+	for (int i=0;i<numAtoms;i++){
+		int j=ids[i].second;
+		frame.atomSpecies.push_back(atomSpecies[j]);
+		for (int d=0;d<3;d++){frame.positions.push_back(positions[3*j+d]);}
+	}
+	return true;
+}
+
+void network::loadCoordinates(string filename, vector<vector<double> > cutoffs, int dataPrep1, int numThreads)
+{
+	ifstream file(filename);
+	if (file.fail()){
+		cout<<"WARNING: "<<filename<<" CANNOT BE OPENED."<<endl;
+		return;
+	}
+	STATS_START(load);
+	coordinateFrame frame;
+	frame.hasCell=false;
+	frame.badLine=0;
+	for (int d=0;d<3;d++){frame.periodic[d]=false;}
+	string firstLine;
+	getline(file,firstLine);
+	bool read=(firstLine.find("ITEM:")==0)?readDump(file,frame):readXYZ(file,frame,firstLine);
+	file.close();
+	if (!read){
+		if (frame.badLine>0){cout<<"WARNING: LINE "<<frame.badLine<<" OF "<<filename<<" NOT IN CORRECT FORMAT."<<endl;}
+		else {cout<<"WARNING: "<<filename<<" NOT IN CORRECT FORMAT."<<endl;}
+		return;
+	}
+	dataPrep=dataPrep1;
+	int numAtoms=frame.atomSpecies.size();
+	int startInd=vertices.size();
+
+	//colors
+	vector<int> colors(numAtoms);
+	for (int i=0;i<numAtoms;i++){
+		vector<string>::iterator iter=find(species.begin(),species.end(),frame.atomSpecies[i]);
+		colors[i]=iter-species.begin();
+		if (iter==species.end()){species.push_back(frame.atomSpecies[i]);}
+	}
+	int numSpecies=species.size();
+	vector<double> cutoff2(numSpecies*numSpecies,0);
+	double maxCutoff=0;
+	for (int a=0;a<numSpecies;a++){for (int b=0;b<numSpecies;b++){
+		double cut=0;
+		if ((cutoffs.size()==1) and (cutoffs[0].size()==1)){cut=cutoffs[0][0];}
+		else if ((a<cutoffs.size()) and (b<cutoffs[a].size())){cut=cutoffs[a][b];}
+		cutoff2[a*numSpecies+b]=cut*cut;
+		maxCutoff=max(maxCutoff,cut);
+	}}
+	if (maxCutoff<=0){cout<<"WARNING: ALL CUTOFFS ARE ZERO, SO "<<filename<<" HAS NO BONDS."<<endl;}
+
+	//without a cell, the bounding box of the atoms is used
+	if (!frame.hasCell){
+		for (int d=0;d<3;d++){
+			double lo=0, hi=0;
+			for (int i=0;i<numAtoms;i++){
+				double x=frame.positions[3*i+d];
+				if ((i==0) or (x<lo)){lo=x;}
+				if ((i==0) or (x>hi)){hi=x;}
+			}
+			for (int e=0;e<3;e++){frame.cell[d][e]=0;}
+			frame.cell[d][d]=max(hi-lo,1e-9);
+			frame.origin[d]=lo;
+		}
+	}
+
+	//fractional coordinates, using the inverse of the cell matrix
+	double (&h)[3][3]=frame.cell;
+	double cofactor[3][3];
+	for (int d=0;d<3;d++){for (int e=0;e<3;e++){
+		int d1=(d+1)%3, d2=(d+2)%3, e1=(e+1)%3, e2=(e+2)%3;
+		cofactor[d][e]=h[d1][e1]*h[d2][e2]-h[d1][e2]*h[d2][e1];
+	}}
+	double volume=h[0][0]*cofactor[0][0]+h[0][1]*cofactor[0][1]+h[0][2]*cofactor[0][2];
+	vector<double> fractional(3*numAtoms);
+	for (int i=0;i<numAtoms;i++){for (int e=0;e<3;e++){
+		double s=0;
+		for (int d=0;d<3;d++){s+=cofactor[d][e]*(frame.positions[3*i+d]-frame.origin[d]);}
+		s/=volume;
+		if (frame.periodic[e]){s-=floor(s);}
+		fractional[3*i+e]=s;
+	}}
+
+	//cell list: the cells are at least as wide as the largest cutoff in every direction
+	int numCells[3];
+	long totalCells=1;
+	for (int e=0;e<3;e++){
+		double area=sqrt(cofactor[0][e]*cofactor[0][e]+cofactor[1][e]*cofactor[1][e]+cofactor[2][e]*cofactor[2][e]);
+		double width=fabs(volume)/area;
+		numCells[e]=(maxCutoff>0)?max(1,(int) min(floor(width/maxCutoff),1e6)):1;
+		if (frame.periodic[e] and (2*maxCutoff>width)){
+			cout<<"WARNING: A CUTOFF IS LARGER THAN HALF THE WIDTH OF THE PERIODIC CELL OF "<<filename<<". ONLY THE NEAREST IMAGE OF EACH ATOM IS CONSIDERED."<<endl;
+		}
+	}
+	while (((long) numCells[0])*numCells[1]*numCells[2]>2L*numAtoms+27){ //sparse systems do not need more cells than atoms
+		int e=max_element(numCells,numCells+3)-numCells;
+		numCells[e]=(numCells[e]+1)/2;
+	}
+	totalCells=((long) numCells[0])*numCells[1]*numCells[2];
+	vector<int> atomCell(numAtoms);
+	vector<int> cellStart(totalCells+1,0);
+	for (int i=0;i<numAtoms;i++){
+		int c[3];
+		for (int e=0;e<3;e++){c[e]=min(numCells[e]-1,max(0,(int) floor(fractional[3*i+e]*numCells[e])));}
+		atomCell[i]=(c[0]*numCells[1]+c[1])*numCells[2]+c[2];
+		cellStart[atomCell[i]+1]++;
+	}
+	for (long c=0;c<totalCells;c++){cellStart[c+1]+=cellStart[c];}
+	vector<int> cellAtoms(numAtoms);
+	vector<int> next(cellStart.begin(),cellStart.end()-1);
+	for (int i=0;i<numAtoms;i++){cellAtoms[next[atomCell[i]]++]=i;}
+	//the coordinates and colors of the atoms in the order of the cells, so that the atoms of a cell are contiguous
+	vector<double> cellFractional(3*numAtoms);
+	vector<int> cellColors(numAtoms);
+	for (int m=0;m<numAtoms;m++){
+		for (int e=0;e<3;e++){cellFractional[3*m+e]=fractional[3*cellAtoms[m]+e];}
+		cellColors[m]=colors[cellAtoms[m]];
+	}
+	STATS_STOP(load,STATS_LOAD);
+
+	//find the neighbors of each atom in parallel, in blocks of atoms taken in the order of the cells, so that the atoms 
+	//of nearby cells stay in the cache
+	vector<vector<int> > bonds(numAtoms);
+	int blockSize=1024;
+	int numBlocks=(numAtoms+blockSize-1)/blockSize;
+	bool periodic[3]={frame.periodic[0],frame.periodic[1],frame.periodic[2]};
+	double cellMatrix[9];
+	for (int d=0;d<3;d++){for (int e=0;e<3;e++){cellMatrix[3*d+e]=h[d][e];}}
+	parallelFor(numBlocks,[&](int block){
+		vector<int> nearby[3];
+		for (int m0=block*blockSize;m0<min(numAtoms,(block+1)*blockSize);m0++){
+			int i=cellAtoms[m0];
+			int c[3]={atomCell[i]/(numCells[1]*numCells[2]),(atomCell[i]/numCells[2])%numCells[1],atomCell[i]%numCells[2]};
+			//the neighboring cells in each direction, without repetitions
+			for (int e=0;e<3;e++){
+				nearby[e].clear();
+				if (periodic[e] and (numCells[e]<3)){for (int k=0;k<numCells[e];k++){nearby[e].push_back(k);}}
+				else {for (int k=c[e]-1;k<=c[e]+1;k++){
+					if (periodic[e]){nearby[e].push_back((k+numCells[e])%numCells[e]);}
+					else if ((k>=0) and (k<numCells[e])){nearby[e].push_back(k);}
+				}}
+			}
+			const double* s0=&cellFractional[3*m0];
+			const double* cutoffRow=&cutoff2[colors[i]*numSpecies];
+			vector<int>& curBonds=bonds[i];
+			for (int a=0;a<nearby[0].size();a++){for (int b=0;b<nearby[1].size();b++){for (int k=0;k<nearby[2].size();k++){
+				int curCell=(nearby[0][a]*numCells[1]+nearby[1][b])*numCells[2]+nearby[2][k];
+				for (int m=cellStart[curCell];m<cellStart[curCell+1];m++){
+					if (m==m0){continue;}
+					double ds[3];
+					for (int e=0;e<3;e++){
+						ds[e]=cellFractional[3*m+e]-s0[e];
+						if (periodic[e]){//minimum image, as both fractional coordinates are in [0,1)
+							if (ds[e]>=0.5){ds[e]-=1;}
+							else if (ds[e]<-0.5){ds[e]+=1;}
+						}
+					}
+					double dist2=0;
+					for (int d=0;d<3;d++){
+						double dx=cellMatrix[3*d]*ds[0]+cellMatrix[3*d+1]*ds[1]+cellMatrix[3*d+2]*ds[2];
+						dist2+=dx*dx;
+					}
+					if (dist2<=cutoffRow[cellColors[m]]){curBonds.push_back(cellAtoms[m]);}
+				}
+			}}}
+			sort(curBonds.begin(),curBonds.end());
+		}
+	},numThreads);
+
+	for (int i=0;i<numAtoms;i++){vertices.push_back(new vertex(i+startInd,colors[i]));}
+	for (int i=0;i<numAtoms;i++){
+		vertex* curVert=vertices[i+startInd];
+		for (int j=0;j<bonds[i].size();j++){curVert->neighbors.push_back(vertices[bonds[i][j]+startInd]);}
+	}
+}
+
+void network::addEdge(int i, int j)
+{
+	vertices[i]->neighbors.push_back(vertices[j]);
+	vertices[j]->neighbors.push_back(vertices[i]);
+	changedVertices.push_back(i);
+	changedVertices.push_back(j);
+}
+
+void network::removeEdge(int i, int j)
+{
+	vector<vertex*>& nI=vertices[i]->neighbors;
+	vector<vertex*>& nJ=vertices[j]->neighbors;
+	vector<vertex*>::iterator iterI=find(nI.begin(),nI.end(),vertices[j]);
+	vector<vertex*>::iterator iterJ=find(nJ.begin(),nJ.end(),vertices[i]);
+	if ((iterI==nI.end()) or (iterJ==nJ.end())){
+		cout<<"WARNING: EDGE "<<i<<" "<<j<<" CANNOT BE REMOVED, AS IT IS NOT IN THE NETWORK."<<endl;
+		return;
+	}
+	nI.erase(iterI);
+	nJ.erase(iterJ);
+	changedVertices.push_back(i);
+	changedVertices.push_back(j);
+}
+
+//Breadth-first search from source, restricted to the vertices v with part[v]==label that have not been visited 
+//(level[v]==-1). Appends the vertices to order in the order they are visited and sets their levels. If byDegree=true, 
+//the unvisited neighbors of each vertex are visited in order of increasing valence (Cuthill-McKee). Returns the number
+//of levels.
+static int restrictedBFS(vector<vertex*>& vertices, int source, vector<int>& part, int label, vector<int>& level, vector<int>& order, bool byDegree)
+{
+	int start=order.size();
+	level[source]=0;
+	order.push_back(source);
+	int numLevels=1;
+	for (int i=start;i<order.size();i++){
+		vertex* curV=vertices[order[i]];
+		int first=order.size();
+		for (int j=0;j<curV->neighbors.size();j++){
+			int k=curV->neighbors[j]->index;
+			if ((part[k]==label) and (level[k]==-1)){
+				level[k]=level[order[i]]+1;
+				order.push_back(k);
+				if (level[k]+1>numLevels){numLevels=level[k]+1;}
+			}
+		}
+		if (byDegree){
+			sort(order.begin()+first,order.end(),[&vertices](int a, int b){return vertices[a]->neighbors.size()<vertices[b]->neighbors.size();});
+		}
+	}
+	return numLevels;
+}
+
+//Finds a pseudo-peripheral vertex in the connected piece of start (George and Liu): repeatedly moves to a vertex of
+//minimal valence in the last level of a breadth-first search, until the number of levels stops increasing.
+static int peripheralVertex(vector<vertex*>& vertices, int start, vector<int>& part, int label, vector<int>& level, vector<int>& scratch)
+{
+	int v=start;
+	int numLevels=-1;
+	for (int iter=0;iter<8;iter++){
+		scratch.clear();
+		int curLevels=restrictedBFS(vertices,v,part,label,level,scratch,false);
+		int next=scratch.back();
+		for (int i=scratch.size()-1;(i>=0) and (level[scratch[i]]==curLevels-1);i--){
+			if (vertices[scratch[i]]->neighbors.size()<vertices[next]->neighbors.size()){next=scratch[i];}
+		}
+		for (int i=0;i<scratch.size();i++){level[scratch[i]]=-1;}
+		if (curLevels<=numLevels){break;}
+		numLevels=curLevels;
+		v=next;
+	}
+	return v;
+}
+
+//Orders the vertices of list with part[v]==label by breadth-first searches from pseudo-peripheral vertices of each 
+//of their connected pieces.
+static void orderSubset(vector<vertex*>& vertices, vector<int>& list, vector<int>& part, int label, vector<int>& level, vector<int>& order, vector<int>& scratch, bool byDegree)
+{
+	order.clear();
+	for (int i=0;i<list.size();i++){if (level[list[i]]==-1){
+		int source=peripheralVertex(vertices,list[i],part,label,level,scratch);
+		restrictedBFS(vertices,source,part,label,level,order,byDegree);
+	}}
+	for (int i=0;i<order.size();i++){level[order[i]]=-1;}
+}
+
+//Recursive bisection of the breadth-first level structure of the vertices in list.
+static void bisect(vector<vertex*>& vertices, vector<int> list, vector<int>& part, int label, int& nextLabel, vector<int>& level, vector<int>& newOrder, vector<int>& scratch, int blockSize)
+{
+	vector<int> order;
+	orderSubset(vertices,list,part,label,level,order,scratch,false);
+	if (order.size()<=blockSize){
+		newOrder.insert(newOrder.end(),order.begin(),order.end());
+		return;
+	}
+	int half=order.size()/2;
+	int label1=nextLabel++;
+	int label2=nextLabel++;
+	for (int i=0;i<order.size();i++){part[order[i]]=(i<half)?label1:label2;}
+	bisect(vertices,vector<int>(order.begin(),order.begin()+half),part,label1,nextLabel,level,newOrder,scratch,blockSize);
+	bisect(vertices,vector<int>(order.begin()+half,order.end()),part,label2,nextLabel,level,newOrder,scratch,blockSize);
+}
+
+void network::reorder(int method, int blockSize)
+{
+	int n=vertices.size();
+	vector<int> newOrder; //newOrder[k] is the current index of the vertex moved to position k
+	newOrder.reserve(n);
+	vector<int> part(n,0);
+	vector<int> level(n,-1);
+	vector<int> scratch;
+
+	for (int s=0;s<n;s++){if (part[s]==0){
+		//order the connected component of s
+		int start=newOrder.size();
+		if (method==2){
+			vector<int> component;
+			restrictedBFS(vertices,s,part,0,level,component,false);
+			for (int i=0;i<component.size();i++){level[component[i]]=-1;}
+			int nextLabel=1;
+			bisect(vertices,component,part,0,nextLabel,level,newOrder,scratch,blockSize);
+		}
+		else{
+			int source=peripheralVertex(vertices,s,part,0,level,scratch);
+			restrictedBFS(vertices,source,part,0,level,newOrder,method==1);
+			if (method==1){reverse(newOrder.begin()+start,newOrder.end());}
+		}
+		for (int i=start;i<newOrder.size();i++){
+			part[newOrder[i]]=-1; //done
+			level[newOrder[i]]=-1;
+		}
+	}}
+
+	//reallocate the vertices in the new order, so that they are also close in memory
+	vector<int> position(n);
+	for (int k=0;k<n;k++){position[newOrder[k]]=k;}
+	vector<vertex*> newVertices(n);
+	for (int k=0;k<n;k++){newVertices[k]=new vertex(k,vertices[newOrder[k]]->color);}
+	vector<int> newOriginalIndex(n);
+	for (int k=0;k<n;k++){
+		vertex* oldV=vertices[newOrder[k]];
+		for (int j=0;j<oldV->neighbors.size();j++){newVertices[k]->neighbors.push_back(newVertices[position[oldV->neighbors[j]->index]]);}
+		sort(newVertices[k]->neighbors.begin(),newVertices[k]->neighbors.end(),[](vertex* a, vertex* b){return a->index<b->index;});
+		newOriginalIndex[k]=fileIndex(newOrder[k]);
+	}
+	for (int i=0;i<n;i++){delete vertices[i];}
+	vertices=newVertices;
+	originalIndex=newOriginalIndex;
+}
+
+network* network::contract(int bridgeColor, vector<int>* position){
+	int n=vertices.size();
+	vector<bool> isBridge(n,false);
+	for (int i=0;i<n;i++){
+		vertex* curV=vertices[i];
+		if ((curV->color!=bridgeColor) or (curV->neighbors.size()!=2)){continue;}
+		vertex* a=curV->neighbors[0];
+		vertex* b=curV->neighbors[1];
+		isBridge[i]=(a!=b) and (a->color!=bridgeColor) and (b->color!=bridgeColor);
+	}
+
+	network* contracted=new network();
+	contracted->dataPrep=dataPrep;
+	contracted->species=species;
+	vector<int> newPosition(n,-1);
+	for (int i=0;i<n;i++){if (!isBridge[i]){
+		newPosition[i]=contracted->vertices.size();
+		contracted->vertices.push_back(new vertex(newPosition[i],vertices[i]->color));
+		contracted->originalIndex.push_back(fileIndex(i));
+	}}
+	for (int i=0;i<n;i++){if (!isBridge[i]){
+		vertex* newV=contracted->vertices[newPosition[i]];
+		newV->bridged=true;
+		for (int j=0;j<vertices[i]->neighbors.size();j++){
+			vertex* curNeighbor=vertices[i]->neighbors[j];
+			if (isBridge[curNeighbor->index]){//the neighbor across the bridge
+				vertex* other=(curNeighbor->neighbors[0]==vertices[i])?curNeighbor->neighbors[1]:curNeighbor->neighbors[0];
+				newV->neighbors.push_back(contracted->vertices[newPosition[other->index]]);
+			}
+			else {
+				newV->neighbors.push_back(contracted->vertices[newPosition[curNeighbor->index]]);
+				newV->bridged=false;
+			}
+		}
+	}}
+	if (position!=NULL){*position=newPosition;}
+	return contracted;
+}
+
 //Computes distances from three well-spaced vertices to the rest of the graph. Used in the primitive ring computation.
 vector<vector<int> > network::computeReferences(vertex* v1)
 {
@@ -162,16 +760,37 @@ vector<vector<int> > network::computeReferences(vertex* v1)
 	return refs;
 }
 
-void network::computePrimitiveRingsGlobal(int r, vector<int> indices, vector<vector<int> > refs){
-	for (int i1=0;i1<indices.size();i1++){vertices[i1]->isIndex=true;}
+void network::computePrimitiveRingsGlobal(int r, vector<int> indices, vector<vector<int> > refs, int maxBallSize, int maxCandidates, vector<pair<int,int> >* overBudget){
+	for (int i=0;i<vertices.size();i++){
+		vertices[i]->primitiveRingProfile.clear(); //the profiles accumulate
+		vertices[i]->isIndex=false;
+	}
+	for (int i1=0;i1<indices.size();i1++){vertices[indices[i1]]->isIndex=true;}
 
+	rootedGraph rGraph; //reused for every root
 	for (int i1=0;i1<indices.size();i1++){
 
 		int i=indices[i1];
-		rootedGraph* rGraph=new rootedGraph(vertices[i],r);
-		//eClass* curClass=rGraph->primitiveRingProfile(refs);
-		vector<vector<vertex*> > candidateRings=rGraph->possiblePrimitive(r,true);
+		rGraph.build(vertices[i],r);
+		//A ring is only checked from the root of smallest index it contains. The rings of a root over the budget are 
+		//instead checked from the other roots they contain, which have larger indices and have not been processed yet.
+		if ((maxBallSize>0) and (rGraph.size()>maxBallSize)){
+			if (overBudget!=NULL){overBudget->push_back(make_pair(i1,0));}
+			vertices[i]->isIndex=false;
+			rGraph.clear();
+			continue;
+		}
+		//eClass* curClass=rGraph.primitiveRingProfile(refs);
+		vector<vector<vertex*> > candidateRings=rGraph.possiblePrimitive(r,true);
+		STATS_COUNT(candidateRings,candidateRings.size());
+		if ((maxCandidates>0) and (candidateRings.size()>maxCandidates)){
+			if (overBudget!=NULL){overBudget->push_back(make_pair(i1,1));}
+			vertices[i]->isIndex=false;
+			rGraph.clear();
+			continue;
+		}
 		for (int j=0;j<candidateRings.size();j++){if (checkPrimitiveDirected(candidateRings[j],refs)){//check if a ring is primitive
+			STATS_COUNT(primitiveRings,1);
 			//add length of primitive ring to profiles of each vertex contained in it
 			for (int k=0;k<candidateRings[j].size();k++){
 				vertex* curV=candidateRings[j][k];
@@ -181,12 +800,38 @@ void network::computePrimitiveRingsGlobal(int r, vector<int> indices, vector<vec
 				curV->primitiveRingProfile[candidateRings[j].size()-1]++;
 			}
 		}}
+		rGraph.clear();
+	}
+
+}
+
+//The selection pattern on a contracted network equivalent to pattern on the original network, whose odd shells consist
+//of bridges of color bridgeColor with valence 2. Returns false if the pattern excludes such bridges.
+static bool contractPattern(const selectionPattern& pattern, int bridgeColor, selectionPattern& contracted){
+	contracted=selectionPattern(pattern.rootColor);
+	for (int j=0;j<pattern.valences.size();j++){
+		int oddValence=pattern.valences[(2*j+1)%pattern.valences.size()];
+		if ((oddValence>=0) and (oddValence!=2)){return false;}
+		contracted.valences.push_back(pattern.valences[(2*j)%pattern.valences.size()]);
+	}
+	for (int j=0;j<pattern.colors.size();j++){
+		int oddColor=pattern.colors[(2*j+1)%pattern.colors.size()];
+		if ((oddColor>=0) and (oddColor!=bridgeColor)){return false;}
+		contracted.colors.push_back(pattern.colors[(2*j)%pattern.colors.size()]);
 	}
+	return true;
+}
 
+selectionPattern defaultPattern(int selection){
+	if (selection>=0){return selectionPattern(selection);}
+	if (selection==-2){return selectionPattern(-1,{4,2});} //perfectly coordinated silica
+	return selectionPattern();
 }
 
 empiricalDistribution::~empiricalDistribution()
 {
+	finishCheckpoints();
+	delete checkpointBusy;
 	for (pair<int,vector<eClass*> > elt : distr){
 		for (int i=0;i<elt.second.size();i++){
 			delete elt.second[i];
@@ -194,211 +839,1670 @@ empiricalDistribution::~empiricalDistribution()
 		elt.second={};
 	}
 	distr={};
-
+	if (sketch!=NULL){delete sketch;}
+	if (fallback!=NULL){delete fallback;}
+	for (int i=0;i<runs.size();i++){remove(runs[i].c_str());}
 }	
 
-void empiricalDistribution::computeDistribution(network* curGraph, vector<int> indices){
-
-	int dataPrep=curGraph->dataPrep;
-
+void empiricalDistribution::addPreparation(int dataPrep){
 	//If the data type has not been seen previously, resizes data structures in each eClass
 	if (dataPrep>=numPreps){
 		numPreps=dataPrep+1;
 		while (numRoots.size()<dataPrep+1){numRoots.push_back(0);}
 
-		for (pair<int,vector<eClass*> > elt : distr){for (int i=0;i<elt.second.size();i++){
+		for (pair<const int,vector<eClass*> >& elt : distr){for (int i=0;i<elt.second.size();i++){
 			elt.second[i]->resize(numPreps);
 		}}
+		if (sketch!=NULL){sketch->resize(numPreps);}
 	}
+}
+
+void empiricalDistribution::updateFrequencies(int dataPrep){
+	for (pair<const int,vector<eClass*> >& elt : distr){for (int i=0;i<elt.second.size();i++){
+		eClass* curClass=elt.second[i];
+		curClass->freqs[dataPrep]=((double) curClass->counts[dataPrep])/((double) numRoots[dataPrep]);
+	}}
+}
+
+void empiricalDistribution::computeDistribution(network* curGraph, vector<int> indices){
+
+	int dataPrep=curGraph->dataPrep;
+	addPreparation(dataPrep);
 
 	
 
-	//Computes the indices of vertices used as root atoms, based on the selection parameter. See Classification.h.
+	//Computes the indices of candidate root vertices. Only the root color is checked here; constraints on the other
+	//shells of the selection pattern are checked while the rooted graph of each candidate is built, so that the ball
+	//of a root is only constructed once. See Classification.h.
 	if (selection!=-3){for (int i=0;i<curGraph->vertices.size();i++){
-		if (selection==-2){
-			rootedGraph* rGraph = new rootedGraph(curGraph->vertices[i],r);
-			if (rGraph->checkValences({4,2})){indices.push_back(i);}
-			delete rGraph;
-		}
-		else if (selection>=0){if (curGraph->vertices[i]->color==selection){indices.push_back(i);}}
-		else{indices.push_back(i);}
+		if ((curGraph->fileIndex(i)<rootBegin) or ((rootEnd>=0) and (curGraph->fileIndex(i)>=rootEnd))){continue;}
+		if ((pattern.rootColor<0) or (curGraph->vertices[i]->color==pattern.rootColor)){indices.push_back(i);}
 	}}
+	else if (curGraph->originalIndex.size()>0){//custom indices refer to the input file
+		vector<int> position(curGraph->vertices.size());
+		for (int i=0;i<position.size();i++){position[curGraph->originalIndex[i]]=i;}
+		for (int i1=0;i1<indices.size();i1++){indices[i1]=position[indices[i1]];}
+		sort(indices.begin(),indices.end());
+	}
 
-	numRoots[dataPrep]+=indices.size();
+	curGraph->rootCandidates.assign(curGraph->vertices.size(),false);
+	for (int i1=0;i1<indices.size();i1++){curGraph->rootCandidates[indices[i1]]=true;}
+
+	rootedGraph rGraph; //reused for every root, so that no memory is allocated once its arrays have grown to the size of the largest ball
+
+	//contracted mode (see contraction): roots are classified on the contracted network when possible
+	network* contracted=NULL;
+	vector<int> contractedPosition={};
+	rootedGraph contractedGraph;
+	selectionPattern contractedPattern;
+	if (contraction>=0){
+		if ((type==2) or (r%2==1)){cout<<"WARNING: THE CONTRACTED MODE REQUIRES AN EVEN RADIUS AND A TYPE OTHER THAN 2. USING THE ORIGINAL NETWORK."<<endl;}
+		else if (!contractPattern(pattern,contraction,contractedPattern)){cout<<"WARNING: THE SELECTION PATTERN EXCLUDES BRIDGES FROM THE ODD SHELLS. USING THE ORIGINAL NETWORK."<<endl;}
+		else {
+			contracted=curGraph->contract(contraction,&contractedPosition);
+			contractedGraph.bridgeColor=contraction;
+		}
+	}
 
-	if (indices.size()==0){cout<<"WARNING: NO ROOT VERTICES SELECTED"<<endl;}
+	//per-root budget (see maxBallSize)
+	bool budget=(maxBallSize>0) or ((maxCandidateRings>0) and (type==2)) or ((maxNautyTime>0) and (type==0));
+	budgetSummary curBudget={dataPrep,0,0,0,0,0,0,0,{}};
+	unordered_map<int,int> ringBudget={}; //type 2: reason for each root whose rings were not checked
+	vector<int> deferredRoots={};
+	if (type==0){
+		rGraph.nautyTimeLimit=maxNautyTime;
+		contractedGraph.nautyTimeLimit=maxNautyTime;
+	}
 
 	//Primitive ring profile: compute reference distance matrices
 	vector<vector<int> > references={};
+	bool filtered=false;
 	if (type==2){
+		//The global computation needs the final list of roots in advance.
+		if (pattern.needsBall()){
+			vector<int> selected={};
+			for (int i1=0;i1<indices.size();i1++){
+				if (rGraph.build(curGraph->vertices[indices[i1]],r,&pattern)){selected.push_back(indices[i1]);}
+				rGraph.clear();
+			}
+			indices=selected;
+			filtered=true;
+		}
+
 		references=curGraph->computeReferences(curGraph->vertices[0]);
 
 
 		//computes globally
 
-		curGraph->computePrimitiveRingsGlobal(r,indices,references);
+		STATS_TIMER(STATS_CLASSIFY_2);
+		vector<pair<int,int> > overRings={};
+		curGraph->computePrimitiveRingsGlobal(r,indices,references,maxBallSize,maxCandidateRings,&overRings);
+		vector<int> heavy={};
+		for (int k=0;k<overRings.size();k++){
+			ringBudget[indices[overRings[k].first]]=overRings[k].second;
+			heavy.push_back(indices[overRings[k].first]);
+		}
+		//deferred roots: the profiles of the roots over the budget are incomplete, so their own rings are checked now
+		if (budgetPolicy==2){for (int k=0;k<heavy.size();k++){
+			rGraph.build(curGraph->vertices[heavy[k]],r);
+			eClass* heavyClass=rGraph.primitiveRingProfile(references);
+			rGraph.clear();
+			curGraph->vertices[heavy[k]]->primitiveRingProfile=heavyClass->data[0];
+			delete heavyClass;
+		}}
 		
 	}
 
 
+	//sampling mode: random order of the candidates, and the state of the convergence check
+	bool sampling=(tolerance>0) and (batchSize>0);
+	samplingSummary summary;
+	vector<int> previousCounts={};
+	long previousRoots=0;
+	double previousEntropy=0;
+	if (sampling){
+		counterRNG rng(samplingSeed,samplingSummaries.size());
+		for (int i1=indices.size()-1;i1>0;i1--){swap(indices[i1],indices[rng.next()%(i1+1)]);}
+		summary.dataPrep=dataPrep;
+		summary.candidates=indices.size();
+		summary.batches=0;
+		summary.lastChange=-1;
+		summary.converged=false;
+	}
 
-	for (int i1=0;i1<indices.size();i1++){
-		int i=indices[i1];
+	bool checkpoints=(checkpointFile!="") and (sketch==NULL) and (memoryBudget<=0) and (!sampling);
+	if ((checkpointFile!="") and (!checkpoints)){cout<<"WARNING: CHECKPOINTS ARE NOT AVAILABLE IN THE APPROXIMATE, MEMORY BUDGET, OR SAMPLING MODES."<<endl;}
+	int start=resumeCursor;
+	resumeCursor=0;
+	bool deferring=(budgetPolicy==2) and (type!=2) and (!checkpoints) and (contracted==NULL); //otherwise, deferred roots are classified immediately
 
-		//compute the rooted graph
-		rootedGraph* rGraph=new rootedGraph(curGraph->vertices[i],r);
+	//For the types with small data, classes are looked up by inline keys before they are classified (see InlineKeys.h).
+	//Not used when stored classes may be evicted or spilled, or in the contracted mode.
+	inlineCache* cache=((sketch==NULL) and (memoryBudget<=0) and (contracted==NULL))?makeInlineDictionary(type,r):NULL;
 
+	int numSelected=0;
+	curGraph->rootClasses.assign(curGraph->vertices.size(),NULL);
+	curGraph->changedVertices={};
+	for (int i1=start;i1<indices.size();i1++){
+		int i=indices[i1];
+		if (checkpoints){checkpoint(i1,dataPrep,numSelected);}
+
+		//compute the rooted graph, skipping roots that do not satisfy the selection pattern
+		STATS_START(root);
+		STATS_START(ball);
+		rootedGraph* ball=&rGraph;
+		if ((contracted!=NULL) and (contractedPosition[i]>=0)){
+			bool selected=contractedGraph.build(contracted->vertices[contractedPosition[i]],r/2,&contractedPattern);
+			if (contractedGraph.bridgesOnly){//the contracted rooted graph stands for the original one
+				if (!selected){continue;}
+				ball=&contractedGraph;
+				contractedRoots++;
+			}
+		}
+		if ((ball==&rGraph) and (!rGraph.build(curGraph->vertices[i],r,filtered?NULL:&pattern))){continue;}
+		STATS_STOP(ball,STATS_BALL);
+		STATS_BALL(ball->size());
+		numSelected++;
+		curBudget.roots++;
+
+		int reason=-1; //over the budget: 0: ball size, 1: candidate rings, 2: nauty time
+		if (type==2){
+			unordered_map<int,int>::iterator it=ringBudget.find(i);
+			if (it!=ringBudget.end()){reason=it->second;}
+		}
+		else if ((maxBallSize>0) and (ball->size()>maxBallSize)){reason=0;}
 
 		//find the equivalence class of the rooted graph
-		eClass* curClass;
-		if (type==0){curClass=rGraph->canonicalForm();}
-		if (type==1){curClass=rGraph->H1Barcode(mobius);}
-		else if (type==2){curClass = new eClass(2,r,{curGraph->vertices[i]->primitiveRingProfile});}
-		//else if (type==2){curClass=rGraph->primitiveRingProfile(references);}
-		else if (type==3){curClass=rGraph->valenceProfile();}
-		else if (type==4){curClass=rGraph->shellCount();}
-
-		delete rGraph;
-
-		//determine whether the equivalence class has been previously detected
-		bool found=false;
-		if (distr.find(curClass->key)!=distr.end()){//key has been seen before
-			vector<eClass*> curCompare=distr[curClass->key];
-			for (int j=0;j<curCompare.size();j++){
-				if(*curCompare[j]==*curClass){//Equivalence class previosly detected. Update the count and the example list. 
-					found=true;
-					curCompare[j]->counts[dataPrep]++;
-					curCompare[j]->examples[dataPrep].push_back(i);
-					delete curClass;
-				}
-			}		
+		STATS_START(classify);
+		eClass* storedClass=((cache!=NULL) and (reason<0))?cache->find(*ball):NULL;
+		if (storedClass!=NULL){//previously detected: update the count and the example list as in addRoot
+			ball->clear();
+			STATS_STOP(classify,STATS_CLASSIFY_0+type);
+			storedClass->counts[dataPrep]++;
+			if ((maxExamples<0) or (storedClass->examples[dataPrep].size()<maxExamples)){storedClass->examples[dataPrep].push_back(curGraph->fileIndex(i));}
 		}
-		if (!found){//new equivalence class
-			curClass->resize(numPreps);
-			curClass->counts[dataPrep]=1;
-			curClass->examples[dataPrep]={i};
-
-			if (distr.find(curClass->key)!=distr.end()){//key has been seen before
-				distr[curClass->key].push_back(curClass);
+		else if (reason<0){
+			eClass* curClass=((cache!=NULL) and cache->hasKey)?cache->makeClass(mobius):classify(*ball);
+			if (curClass==NULL){reason=2;} //nauty was stopped
+			else {
+				ball->clear();
+				STATS_STOP(classify,STATS_CLASSIFY_0+type);
+
+				STATS_START(probe);
+				storedClass=addRoot(curClass,dataPrep,curGraph->fileIndex(i));
+				STATS_STOP(probe,STATS_PROBE);
+				if (cache!=NULL){cache->insert(storedClass);}
+			}
+		}
+		if (reason>=0){
+			storedClass=overBudget(*ball,curGraph,i,reason,curBudget,deferring?&deferredRoots:NULL);
+			ball->clear();
+			STATS_STOP(classify,STATS_CLASSIFY_0+type);
+			if (storedClass==NULL){
+				numSelected--;
+				continue;
 			}
-			else{distr[curClass->key]={curClass};} // new key
+		}
+		STATS_ROOT(root,curGraph->fileIndex(i));
+		if ((sketch==NULL) and (memoryBudget<=0)){curGraph->rootClasses[i]=storedClass;} //stored classes may be evicted or spilled
+		if ((memoryBudget>0) and (memoryUsed>memoryBudget)){spill();}
+
+		if (sampling and ((numSelected%batchSize==0) or (i1==indices.size()-1))){
+			//compare with the previous batch
+			long curRoots=numRoots[dataPrep]+numSelected;
+			double change=0;
+			double entropy=0;
+			for (pair<const int,vector<eClass*> >& elt : distr){for (int k=0;k<elt.second.size();k++){
+				eClass* curClass=elt.second[k];
+				int count=curClass->counts[dataPrep];
+				if (count>0){entropy-=((double) count)/curRoots*log(((double) count)/curRoots);}
+				if (curClass->id>=previousCounts.size()){previousCounts.resize(curClass->id+1,0);}
+				if (previousRoots>0){change+=fabs(((double) count)/curRoots-((double) previousCounts[curClass->id])/previousRoots);}
+				previousCounts[curClass->id]=count;
+			}}
+			if (convergenceMetric==1){change=fabs(entropy-previousEntropy);}
+			summary.batches++;
+			if ((previousRoots>0) and (curRoots>previousRoots)){
+				summary.lastChange=change;
+				if (change<tolerance){
+					summary.converged=true;
+					for (int i2=i1+1;i2<indices.size();i2++){curGraph->rootCandidates[indices[i2]]=false;} //not sampled
+					break;
+				}
+			}
+			previousRoots=curRoots;
+			previousEntropy=entropy;
 		}
 	}
 
-	//compute the frequencies
+	if (cache!=NULL){delete cache;}
+	if (contracted!=NULL){delete contracted;}
+	if (deferredRoots.size()>0){
+		classifyDeferred(curGraph,deferredRoots);
+		numSelected+=deferredRoots.size();
+	}
+	numRoots[dataPrep]+=numSelected;
+	if (numSelected==0){cout<<"WARNING: NO ROOT VERTICES SELECTED"<<endl;}
+	if (budget){
+		budgetSummaries.push_back(curBudget);
+		if (fallback!=NULL){fallback->updateFrequencies(dataPrep);}
+	}
 
-	for (pair<int,vector<eClass*> > elt : distr){for (int i=0;i<elt.second.size();i++){
-		eClass* curClass=elt.second[i];
-		curClass->freqs[dataPrep]=((double) curClass->counts[dataPrep])/((double) numRoots[dataPrep]);
-	}}
+	if (sampling){
+		//standard errors of the sampled distribution of the preparation
+		double N=numRoots[dataPrep];
+		double entropy=0;
+		double secondMoment=0;
+		summary.l1Error=0;
+		for (pair<const int,vector<eClass*> >& elt : distr){for (int k=0;k<elt.second.size();k++){
+			double p=elt.second[k]->counts[dataPrep]/N;
+			if (p==0){continue;}
+			entropy-=p*log(p);
+			secondMoment+=p*log(p)*log(p);
+			summary.l1Error+=sqrt(2*p*(1-p)/(M_PI*N)); //mean absolute deviation of a binomial proportion
+		}}
+		summary.rootsUsed=numSelected;
+		summary.entropy=entropy;
+		summary.entropyStandardError=(N>0)?sqrt(max(0.0,secondMoment-entropy*entropy)/N):0;
+		samplingSummaries.push_back(summary);
+	}
+
+	//compute the frequencies
+	updateFrequencies(dataPrep);
 	
 }
 
-	
-//converts a dictionary to a vector 
-vector<eClass*> empiricalDistribution::convertToVector(){
-	vector<eClass*> eVect={};
-	for(unordered_map<int,vector<eClass*> >::iterator iter=distr.begin();iter!=distr.end();iter++){
-		for (int j=0;j<(*iter).second.size();j++){
-			eVect.push_back((*iter).second[j]);
+eClass* empiricalDistribution::overBudget(rootedGraph& rGraph, network* curGraph, int i, int reason, budgetSummary& budget, vector<int>* deferredRoots){
+	int dataPrep=curGraph->dataPrep;
+	if (reason==0){budget.overBallSize++;}
+	else if (reason==1){budget.overCandidateRings++;}
+	else {budget.overNautyTime++;}
+	budget.affected.push_back(make_pair(curGraph->fileIndex(i),reason));
+	if (budgetPolicy!=2){curGraph->rootCandidates[i]=false;} //not in this distribution
+
+	if (budgetPolicy==1){
+		if (fallback==NULL){
+			if ((fallbackType!=1) and (fallbackType!=3) and (fallbackType!=4) and (fallbackType!=5)){
+				cout<<"WARNING: THE FALLBACK TYPE MUST BE 1, 3, 4 OR 5. USING SHELL COUNTS (4)."<<endl;
+				fallbackType=4;
+			}
+			fallback=new empiricalDistribution(fallbackType,r,selection);
+			fallback->pattern=pattern;
+			fallback->maxExamples=maxExamples;
+			fallback->refinementRounds=refinementRounds;
 		}
+		fallback->addPreparation(dataPrep);
+		fallback->addRoot(fallback->classify(rGraph),dataPrep,curGraph->fileIndex(i));
+		fallback->numRoots[dataPrep]++;
+		budget.fellBack++;
+		return NULL;
 	}
-	return eVect;
+	if (budgetPolicy==2){
+		budget.deferred++;
+		if (deferredRoots!=NULL){
+			deferredRoots->push_back(i);
+			return NULL;
+		}
+		double limit=rGraph.nautyTimeLimit;
+		rGraph.nautyTimeLimit=0;
+		eClass* curClass=classify(rGraph);
+		rGraph.nautyTimeLimit=limit;
+		return addRoot(curClass,dataPrep,curGraph->fileIndex(i));
+	}
+	budget.skipped++;
+	return NULL;
 }
 
-
-void saveData_toView_fromVect(vector<eClass*> eVect, string filename, int n, bool defaultSort)
-{
-	if (eVect.size()==0){return;}
-	filename=filename+".txt";
-	int numPreps=eVect[0]->freqs.size();
-	ofstream fs(filename);
-	fs << fixed << showpoint;
-	fs << setprecision(4);
-
-	fs<<"Type = "<<eVect[0]->type<<"  Radius="<<eVect[0]->r<<"  Number of Data Preparations="<<eVect[0]->freqs.size()<<endl; 
-	fs<<endl<<"----------------------------------------------------------------------"<<endl<<endl;
-	if (!defaultSort){for (int i=0;i<min(n,(int) eVect.size());i++){
-		fs<<"Equivalence Class "<<i<<endl;
-		eVect[i]->printWithStats(fs,10);
-		fs<<endl<<endl;
-	}}
-	else{
-		for (int j=0;j<numPreps;j++){
-			fs<<"SORTED BY FREQUENCY IN PREPARATION "<<j<<endl<<endl;
-			sort(eVect.begin(),eVect.end(),rankCompare(j));
-			for (int i=0;i<min(n,(int) eVect.size());i++){
-				fs<<"Equivalence Class "<<i<<endl;
-				eVect[i]->printWithStats(fs,10);
-				fs<<endl<<endl;
-			}
-			fs<<"----------------------------------------------------------------------";
-			fs<<endl;
-			fs<<endl;
+void empiricalDistribution::classifyDeferred(network* curGraph, vector<int>& deferredRoots){
+	int dataPrep=curGraph->dataPrep;
+	int numThreads=max(1,(int) thread::hardware_concurrency());
+	mutex nautyLock; //nauty and the arrays of canonicalForm are shared by all threads
+	rootedGraph rGraph;
+	for (int start=0;start<deferredRoots.size();start+=numThreads){
+		int end=min((int) deferredRoots.size(),start+numThreads);
+
+		//the balls are copied one at a time, since building a rooted graph sets local data in the vertices of the network
+		vector<vector<vertex*> > balls(end-start);
+		for (int k=start;k<end;k++){
+			rGraph.build(curGraph->vertices[deferredRoots[k]],r);
+			balls[k-start]=rGraph.copyBall();
+			rGraph.clear();
 		}
 
-		for (int j=0;j<numPreps;j++){for (int k=0;k<numPreps;k++){if (k!=j){
-			fs<<"SORTED BY FREQUENCY IN PREPARATION "<<j<<" MINUS FREQUENCY IN PREPARATION "<<k<<endl;
-			sort(eVect.begin(),eVect.end(),differenceCompare(j,k));
-			for (int i=0;i<min(n,(int) eVect.size());i++){
-				fs<<"Equivalence Class "<<i<<endl;
-				eVect[i]->printWithStats(fs,10);
-				fs<<endl<<endl;
+		vector<eClass*> classes(end-start,NULL);
+		parallelFor(end-start,[&](int k){
+			{
+				rootedGraph ballGraph(balls[k][0],r);
+				if (type==0){
+					lock_guard<mutex> lock(nautyLock);
+					classes[k]=classify(ballGraph);
+				}
+				else {classes[k]=classify(ballGraph);}
 			}
-			fs<<"----------------------------------------------------------------------";
-			fs<<endl;
-			fs<<endl;
-		}}}
+			for (int j=0;j<balls[k].size();j++){delete balls[k][j];}
+		},numThreads);
+
+		//added in the original order, so that the ids of new classes do not depend on the threads
+		for (int k=start;k<end;k++){
+			eClass* storedClass=addRoot(classes[k-start],dataPrep,curGraph->fileIndex(deferredRoots[k]));
+			if ((sketch==NULL) and (memoryBudget<=0)){curGraph->rootClasses[deferredRoots[k]]=storedClass;}
+			if ((memoryBudget>0) and (memoryUsed>memoryBudget)){spill();}
+		}
 	}
+}
 
+void empiricalDistribution::saveBudgetReport(string filename){
+	ofstream fs(filename+"_budget.txt");
+	fs<<"Per-root budget: ball size "<<maxBallSize<<", candidate rings "<<maxCandidateRings<<", nauty time "<<maxNautyTime<<" s (0: no limit). Roots over the budget are ";
+	fs<<((budgetPolicy==1)?"classified with type "+to_string(fallbackType):((budgetPolicy==2)?"deferred":"skipped"))<<"."<<endl;
+	fs<<"preparation roots overBallSize overCandidateRings overNautyTime skipped fellBack deferred"<<endl;
+	for (int i=0;i<budgetSummaries.size();i++){
+		budgetSummary& cur=budgetSummaries[i];
+		fs<<cur.dataPrep<<" "<<cur.roots<<" "<<cur.overBallSize<<" "<<cur.overCandidateRings<<" "<<cur.overNautyTime<<" "<<cur.skipped<<" "<<cur.fellBack<<" "<<cur.deferred<<endl;
+	}
+	fs<<"Roots over the budget (preparation index reason; reason 0: ball size, 1: candidate rings, 2: nauty time)"<<endl;
+	for (int i=0;i<budgetSummaries.size();i++){
+		budgetSummary& cur=budgetSummaries[i];
+		for (int k=0;k<cur.affected.size();k++){fs<<cur.dataPrep<<" "<<cur.affected[k].first<<" "<<cur.affected[k].second<<endl;}
+	}
 	fs.close();
 }
 
-void empiricalDistribution::saveData_toView(std::string filename){
-	saveData_toView_fromVect(this->convertToVector(),filename,10,true);
-}
-void empiricalDistribution::saveData_toLoad(std::string filename)
-{
 
-	filename=filename+".dat";
-	ofstream fs(filename);
-	fs<<type<<" "<<r<<" "<<selection<<" "<<numPreps<<endl;
-	for (int j=0;j<numRoots.size();j++){fs<<numRoots[j]<<" ";}
-	fs<<endl<<endl<<endl;
+double empiricalDistribution::currentTime(){
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-	vector<eClass*> eVect=this->convertToVector();
-	if (eVect.size()==0){return;}
-	for (int i=0;i<eVect.size();i++){
-		fs<<eVect[i]->data.size()<<endl;
-		for (int j=0;j<eVect[i]->data.size();j++){
-			for (int k=0;k<eVect[i]->data[j].size();k++){fs<<eVect[i]->data[j][k]<<" ";}
-			fs<<endl;
-		}
-		fs<<"-"<<endl;
-		for (int j=0;j<eVect[i]->counts.size();j++){fs<<eVect[i]->counts[j]<<" ";}
-		fs<<endl<<"-"<<endl;
-		for (int j=0;j<eVect[i]->examples.size();j++){
-			for (int k=0;k<eVect[i]->examples[j].size();k++){
-				fs<<eVect[i]->examples[j][k]<<" ";
-			}
-			fs<<endl;
-		}
-		fs<<"--"<<endl;
-		
+void empiricalDistribution::checkpoint(int rootCursor, int dataPrep, long pendingRoots, bool force){
+	if (checkpointFile==""){return;}
+	if ((!force) and (currentTime()-lastCheckpoint<checkpointInterval)){return;}
+	if (checkpointWriter!=NULL){
+		if ((!force) and checkpointBusy->load()){return;} //the previous checkpoint is still being written
+		checkpointWriter->join();
+		delete checkpointWriter;
+		checkpointWriter=NULL;
 	}
-	fs.close();
+	lastCheckpoint=currentTime();
+
+	//copy the state to memory
+	if (dataPrep>=0){numRoots[dataPrep]+=pendingRoots;}
+	ostringstream fs(ios::binary);
+	saveData_toBinary(fs);
+	int64_t cursors[2]={fileCursor,rootCursor};
+	fs.write((const char*) cursors,sizeof(cursors));
+	if (dataPrep>=0){numRoots[dataPrep]-=pendingRoots;}
+	string* buffer=new string(fs.str());
+
+	//write it in the background, replacing the previous checkpoint only once the new one is complete
+	checkpointBusy->store(true);
+	string name=checkpointFile;
+	atomic<bool>* busy=checkpointBusy;
+	checkpointWriter=new thread([buffer,name,busy](){
+		ofstream file(name+".tmp",ios::binary);
+		file.write(buffer->data(),buffer->size());
+		file.close();
+		if (!file.fail()){rename((name+".tmp").c_str(),name.c_str());}
+		else {cout<<"WARNING: COULD NOT WRITE THE CHECKPOINT "<<name<<"."<<endl;}
+		delete buffer;
+		busy->store(false);
+	});
 }
 
+void empiricalDistribution::finishCheckpoints(){
+	if (checkpointWriter==NULL){return;}
+	checkpointWriter->join();
+	delete checkpointWriter;
+	checkpointWriter=NULL;
+}
 
-empiricalDistribution::empiricalDistribution(std::string filename)
+bool empiricalDistribution::resume(string filename){
+	distributionFile file;
+	if (!file.open(filename)){return false;}
+	if (file.size()<file.header->fileSize+2*sizeof(int64_t)){return false;}
+	if ((file.header->type!=type) or (file.header->r!=r) or (file.header->selection!=selection)){
+		cout<<"WARNING: THE CHECKPOINT WAS SAVED WITH A DIFFERENT TYPE, RADIUS OR SELECTION. USING THOSE OF THE CHECKPOINT."<<endl;
+	}
+	selectionPattern curPattern=pattern;
+	loadBinary(file);
+	pattern=curPattern;
+	const int64_t* cursors=(const int64_t*) (((const char*) file.header)+file.header->fileSize);
+	fileCursor=cursors[0];
+	resumeCursor=cursors[1];
+	return true;
+}
+
+void empiricalDistribution::saveSamplingReport(string filename){
+	ofstream fs(filename+"_sampling.txt");
+	fs<<"Sampling with batches of "<<batchSize<<" roots and tolerance "<<tolerance<<" for the change in "<<((convergenceMetric==1)?"entropy":"l1 distance")<<" between batches"<<endl;
+	fs<<"preparation candidates rootsUsed batches lastChange converged entropy entropyStandardError l1Error"<<endl;
+	for (int i=0;i<samplingSummaries.size();i++){
+		samplingSummary& cur=samplingSummaries[i];
+		fs<<cur.dataPrep<<" "<<cur.candidates<<" "<<cur.rootsUsed<<" "<<cur.batches<<" "<<cur.lastChange<<" "<<cur.converged<<" "<<cur.entropy<<" "<<cur.entropyStandardError<<" "<<cur.l1Error<<endl;
+	}
+	fs.close();
+}
+
+void empiricalDistribution::verifyRefinement(network* curGraph, int sampleSize, unsigned long seed){
+	vector<int> candidates={};
+	for (int i=0;i<curGraph->vertices.size();i++){
+		if ((curGraph->fileIndex(i)<rootBegin) or ((rootEnd>=0) and (curGraph->fileIndex(i)>=rootEnd))){continue;}
+		if ((pattern.rootColor<0) or (curGraph->vertices[i]->color==pattern.rootColor)){candidates.push_back(i);}
+	}
+
+	//a uniformly random sample of the roots, by a partial Fisher-Yates shuffle of the candidates
+	counterRNG rng(seed,verifiedRoots);
+	rootedGraph rGraph;
+	int sampled=0;
+	for (int i1=0;(i1<candidates.size()) and (sampled<sampleSize);i1++){
+		swap(candidates[i1],candidates[i1+rng.next()%(candidates.size()-i1)]);
+		if (!rGraph.build(curGraph->vertices[candidates[i1]],r,&pattern)){continue;}
+		eClass* refinedClass=rGraph.colorRefinement(refinementRounds);
+		eClass* isomorphismClass=rGraph.canonicalForm();
+		rGraph.clear();
+		verification[refinedClass->fingerprint][isomorphismClass->fingerprint]++;
+		delete refinedClass;
+		delete isomorphismClass;
+		sampled++;
+	}
+	verifiedRoots+=sampled;
+}
+
+void empiricalDistribution::saveVerificationReport(string filename){
+	long isomorphismClasses=0;
+	long mergingClasses=0;
+	long mergedRoots=0;
+	vector<pair<uint64_t,long> > merging={};
+	for (pair<const uint64_t,unordered_map<uint64_t,long> >& elt : verification){
+		isomorphismClasses+=elt.second.size();
+		if (elt.second.size()<2){continue;}
+		long roots=0;
+		for (pair<const uint64_t,long>& elt1 : elt.second){roots+=elt1.second;}
+		mergingClasses++;
+		mergedRoots+=roots;
+		merging.push_back(make_pair(elt.first,roots));
+	}
+	sort(merging.begin(),merging.end(),[](const pair<uint64_t,long>& a, const pair<uint64_t,long>& b){return a.second>b.second;});
+
+	ofstream fs(filename+"_verify.txt");
+	fs<<"Color refinement ("<<((refinementRounds<0)?string("until stable"):to_string(refinementRounds)+" rounds")<<") compared with graph isomorphism at radius "<<r<<endl;
+	fs<<"Sampled roots: "<<verifiedRoots<<endl;
+	fs<<"Color refinement classes: "<<verification.size()<<endl;
+	fs<<"Graph isomorphism classes: "<<isomorphismClasses<<endl;
+	fs<<"Color refinement classes containing several graph isomorphism classes: "<<mergingClasses<<endl;
+	fs<<"Sampled roots in those classes: "<<mergedRoots<<" ("<<((verifiedRoots>0)?((double) mergedRoots)/verifiedRoots:0)<<")"<<endl;
+	fs<<"fingerprint roots isomorphismClasses"<<endl;
+	for (int i=0;i<merging.size();i++){fs<<merging[i].first<<" "<<merging[i].second<<" "<<verification[merging[i].first].size()<<endl;}
+	fs.close();
+}
+
+eClass* empiricalDistribution::classify(rootedGraph& rGraph){
+	if (type==0){return rGraph.canonicalForm();}
+	else if (type==1){return rGraph.H1Barcode(mobius);}
+	else if (type==2){return new eClass(2,r,{rGraph.vertices[0]->primitiveRingProfile});} //computed globally by computePrimitiveRingsGlobal
+	else if (type==3){return rGraph.valenceProfile();}
+	else if (type==5){return rGraph.colorRefinement(refinementRounds);}
+	return rGraph.shellCount();
+}
+
+//approximate number of bytes used by an equivalence class in the dictionary
+static long classMemory(eClass* curClass){
+	long bytes=sizeof(eClass)+sizeof(eClass*)+4*sizeof(void*); //the class and its entry in the hash table
+	for (int i=0;i<curClass->data.size();i++){bytes+=sizeof(vector<int>)+sizeof(int)*curClass->data[i].size();}
+	bytes+=curClass->counts.size()*(sizeof(int)+sizeof(double)+sizeof(vector<int>));
+	for (int j=0;j<curClass->examples.size();j++){bytes+=sizeof(int)*curClass->examples[j].size();}
+	return bytes;
+}
+
+eClass* empiricalDistribution::addRoot(eClass* curClass, int dataPrep, int example){
+	if (sketch!=NULL){sketch->observe(curClass->fingerprint,dataPrep);}
+
+	//determine whether the equivalence class has been previously detected
+	vector<eClass*>& curCompare=distr[curClass->key];
+	eClass* storedClass=NULL;
+	STATS_COUNT(probes,1);
+	for (int j=0;j<curCompare.size();j++){
+		if(*curCompare[j]==*curClass){//Equivalence class previosly detected.
+			storedClass=curCompare[j];
+			delete curClass;
+			break;
+		}
+		STATS_COUNT(collisions,1);
+	}
+	if ((storedClass==NULL) and (sketch!=NULL)){//new equivalence class, stored in the Space-Saving summary
+		long total=0;
+		if (sketch->full()){//replace the class with the smallest total
+			eClass* victim=sketch->evict();
+			total=sketch->totals[victim->id];
+			vector<eClass*>& victimCompare=distr[victim->key];
+			victimCompare.erase(find(victimCompare.begin(),victimCompare.end(),victim));
+			if (victimCompare.size()==0){distr.erase(victim->key);}
+			delete victim;
+		}
+		curClass->resize(numPreps);
+		if (catalog!=NULL){curClass->globalId=catalog->insert(curClass);}
+		distr[curClass->key].push_back(curClass);
+		sketch->insert(curClass,total,total);
+		numClasses=sketch->slots.size();
+		storedClass=curClass;
+	}
+	else if (storedClass==NULL){//new equivalence class
+		curClass->resize(numPreps);
+		curClass->id=numClasses++;
+		if (catalog!=NULL){curClass->globalId=catalog->insert(curClass);}
+		curCompare.push_back(curClass);
+		storedClass=curClass;
+		if (memoryBudget>0){memoryUsed+=classMemory(curClass);}
+	}
+	if (sketch!=NULL){sketch->increment(storedClass);}
+
+	//Update the count and the example list. 
+	storedClass->counts[dataPrep]++;
+	if ((maxExamples<0) or (storedClass->examples[dataPrep].size()<maxExamples)){
+		storedClass->examples[dataPrep].push_back(example);
+		memoryUsed+=sizeof(int);
+	}
+	return storedClass;
+}
+
+void empiricalDistribution::removeRoot(eClass* storedClass, int dataPrep, int example){
+	storedClass->counts[dataPrep]--;
+	vector<int>& curExamples=storedClass->examples[dataPrep];
+	vector<int>::iterator iter=find(curExamples.begin(),curExamples.end(),example);
+	if (iter!=curExamples.end()){curExamples.erase(iter);}
+}
+
+void empiricalDistribution::updateDistribution(network* curGraph){
+	if (contraction>=0){
+		cout<<"WARNING: UPDATING THE DISTRIBUTION IS NOT AVAILABLE IN THE CONTRACTED MODE."<<endl;
+		return;
+	}
+	if (memoryBudget>0){
+		cout<<"WARNING: UPDATING THE DISTRIBUTION IS NOT AVAILABLE WITH A MEMORY BUDGET."<<endl;
+		return;
+	}
+	if (sketch!=NULL){
+		cout<<"WARNING: UPDATING THE DISTRIBUTION IS NOT AVAILABLE IN THE APPROXIMATE MODE."<<endl;
+		return;
+	}
+	int dataPrep=curGraph->dataPrep;
+	if (curGraph->rootClasses.size()!=curGraph->vertices.size()){
+		cout<<"WARNING: THE DISTRIBUTION OF THIS NETWORK HAS NOT BEEN COMPUTED. CALL computeDistribution FIRST."<<endl;
+		return;
+	}
+
+	//find the vertices within distance r of a changed vertex, by a breadth-first search from all of them at once.
+	//Primitive rings through a root may be certified by paths that leave its rooted graph, so a larger radius is used.
+	int radius=(type==2)?2*r:r;
+	vector<vertex*> touched={};
+	for (int i=0;i<curGraph->changedVertices.size();i++){
+		vertex* curV=curGraph->vertices[curGraph->changedVertices[i]];
+		if (!curV->in){
+			curV->in=true;
+			curV->distance=0;
+			touched.push_back(curV);
+		}
+	}
+	for (int i=0;i<touched.size();i++){if (touched[i]->distance<radius){
+		for (int j=0;j<touched[i]->neighbors.size();j++){
+			vertex* nextV=touched[i]->neighbors[j];
+			if (!nextV->in){
+				nextV->in=true;
+				nextV->distance=touched[i]->distance+1;
+				touched.push_back(nextV);
+			}
+		}
+	}}
+	for (int i=0;i<touched.size();i++){
+		touched[i]->in=false;
+		touched[i]->distance=INT_MAX;
+	}
+	curGraph->changedVertices={};
+
+	//reclassify the affected roots
+	int oldNumRoots=numRoots[dataPrep];
+	vector<eClass*> changedClasses={};
+	rootedGraph rGraph;
+	for (int i1=0;i1<touched.size();i1++){
+		int i=touched[i1]->index;
+		eClass* oldClass=curGraph->rootClasses[i];
+		if (!curGraph->rootCandidates[i]){continue;}
+
+		eClass* curClass=NULL;
+		if (rGraph.build(touched[i1],r,&pattern)){
+			if (type==2){curClass=rGraph.primitiveRingProfile();} //the global computation is not repeated
+			else{curClass=classify(rGraph);}
+			rGraph.clear();
+		}
+		if ((oldClass!=NULL) and (curClass!=NULL) and (*curClass==*oldClass)){//unchanged
+			delete curClass;
+			continue;
+		}
+
+		if (oldClass!=NULL){
+			removeRoot(oldClass,dataPrep,curGraph->fileIndex(i));
+			numRoots[dataPrep]--;
+			changedClasses.push_back(oldClass);
+			curGraph->rootClasses[i]=NULL;
+		}
+		if (curClass!=NULL){
+			curGraph->rootClasses[i]=addRoot(curClass,dataPrep,curGraph->fileIndex(i));
+			numRoots[dataPrep]++;
+			changedClasses.push_back(curGraph->rootClasses[i]);
+		}
+	}
+
+	//update the frequencies
+	if (numRoots[dataPrep]!=oldNumRoots){
+		for (pair<const int,vector<eClass*> >& elt : distr){for (int i=0;i<elt.second.size();i++){
+			elt.second[i]->freqs[dataPrep]=((double) elt.second[i]->counts[dataPrep])/((double) numRoots[dataPrep]);
+		}}
+	}
+	else{
+		for (int i=0;i<changedClasses.size();i++){
+			changedClasses[i]->freqs[dataPrep]=((double) changedClasses[i]->counts[dataPrep])/((double) numRoots[dataPrep]);
+		}
+	}
+}
+
+void empiricalDistribution::removeNetwork(network* curGraph){
+	int dataPrep=curGraph->dataPrep;
+	for (int i=0;i<curGraph->rootClasses.size();i++){if (curGraph->rootClasses[i]!=NULL){
+		removeRoot(curGraph->rootClasses[i],dataPrep,curGraph->fileIndex(i));
+		numRoots[dataPrep]--;
+		curGraph->rootClasses[i]=NULL;
+	}}
+	for (pair<const int,vector<eClass*> >& elt : distr){for (int i=0;i<elt.second.size();i++){
+		eClass* curClass=elt.second[i];
+		curClass->freqs[dataPrep]=(numRoots[dataPrep]>0)?((double) curClass->counts[dataPrep])/((double) numRoots[dataPrep]):0;
+	}}
+}
+
+void empiricalDistribution::computeTrajectory(string filename, string outname){
+	if (sketch!=NULL){
+		cout<<"WARNING: TRAJECTORIES ARE NOT AVAILABLE IN THE APPROXIMATE MODE."<<endl;
+		return;
+	}
+	ifstream file(filename);
+	if (file.fail()){
+		cout<<"WARNING: "<<filename<<" CANNOT BE OPENED."<<endl;
+		return;
+	}
+	maxExamples=0; //memory must not grow with the number of frames
+
+	ofstream trajectoryFile(outname+"_trajectory.txt");
+	ofstream transitionFile(outname+"_transitions.txt");
+	transitionFile<<"Number of roots changing equivalence class between consecutive frames (frame numChanged):"<<endl;
+
+	network* curGraph=NULL;
+	vector<int> histogram={}; //number of roots in each class in the current frame, indexed by eClass::id
+	vector<int> seenIDs={};
+	vector<long> totals={}; //number of roots in each class over all frames
+	vector<int> previousIDs={}; //class of each vertex in the previous frame (-1 if not a root)
+	vector<int> currentIDs={};
+	unordered_map<long long,long> transitions; //key: (previous class)*2^32+(current class)
+
+	int frame=0;
+	streampos framePosition=file.tellg();
+	string line;
+	while (getline(file,line)){
+		stringstream linestream(line);
+		string first;
+		if (!(linestream>>first)){continue;} //blank line
+
+		if (first=="d"){//list of changes to the previous frame
+			int numChanges;
+			linestream>>numChanges;
+			if (curGraph==NULL){
+				cout<<"WARNING: THE FIRST FRAME OF "<<filename<<" MUST BE A COMPLETE GRAPH."<<endl;
+				return;
+			}
+			vector<int> position={}; //changes refer to the indices in the input file
+			if (curGraph->originalIndex.size()>0){
+				position.resize(curGraph->vertices.size());
+				for (int i=0;i<position.size();i++){position[curGraph->originalIndex[i]]=i;}
+			}
+			for (int k=0;k<numChanges;k++){
+				getline(file,line);
+				stringstream changeStream(line);
+				string sign;
+				int i,j;
+				changeStream>>sign>>i>>j;
+				if (position.size()>0){
+					i=position[i];
+					j=position[j];
+				}
+				if (sign=="+"){curGraph->addEdge(i,j);}
+				else{curGraph->removeEdge(i,j);}
+			}
+			updateDistribution(curGraph);
+		}
+		else{//a complete graph: replaces the previous frame
+			file.seekg(framePosition);
+			if (curGraph!=NULL){
+				removeNetwork(curGraph);
+				delete curGraph;
+			}
+			curGraph=new network();
+			curGraph->load(file,filename);
+			computeDistribution(curGraph);
+		}
+
+		//per-frame histogram, ordered by class index
+		int dataPrep=curGraph->dataPrep;
+		currentIDs.assign(curGraph->vertices.size(),-1);
+		if (histogram.size()<numClasses){
+			histogram.resize(numClasses,0);
+			totals.resize(numClasses,0);
+		}
+		seenIDs.clear();
+		for (int i=0;i<curGraph->rootClasses.size();i++){if (curGraph->rootClasses[i]!=NULL){
+			int id=curGraph->rootClasses[i]->id;
+			if (histogram[id]==0){seenIDs.push_back(id);}
+			histogram[id]++;
+			currentIDs[curGraph->fileIndex(i)]=id;
+		}}
+		sort(seenIDs.begin(),seenIDs.end());
+		trajectoryFile<<frame<<" "<<numRoots[dataPrep];
+		for (int k=0;k<seenIDs.size();k++){
+			trajectoryFile<<" "<<seenIDs[k]<<":"<<histogram[seenIDs[k]];
+			totals[seenIDs[k]]+=histogram[seenIDs[k]];
+			histogram[seenIDs[k]]=0;
+		}
+		trajectoryFile<<endl;
+
+		//transitions from the previous frame
+		if ((frame>0) and (previousIDs.size()==currentIDs.size())){
+			int numChanged=0;
+			for (int i=0;i<currentIDs.size();i++){if ((previousIDs[i]!=currentIDs[i]) and (previousIDs[i]>=0) and (currentIDs[i]>=0)){
+				numChanged++;
+				transitions[(((long long) previousIDs[i])<<32)+currentIDs[i]]++;
+			}}
+			transitionFile<<frame<<" "<<numChanged<<endl;
+		}
+		previousIDs.swap(currentIDs);
+		frame++;
+		framePosition=file.tellg();
+	}
+	file.close();
+	trajectoryFile.close();
+
+	//total transitions, ordered by class indices
+	vector<pair<long long,long> > sortedTransitions(transitions.begin(),transitions.end());
+	sort(sortedTransitions.begin(),sortedTransitions.end());
+	transitionFile<<endl<<"Total number of roots changing from equivalence class i to j (i j count):"<<endl;
+	for (int k=0;k<sortedTransitions.size();k++){
+		transitionFile<<(sortedTransitions[k].first>>32)<<" "<<(sortedTransitions[k].first&0xffffffffLL)<<" "<<sortedTransitions[k].second<<endl;
+	}
+	transitionFile.close();
+
+	//dictionary of equivalence classes
+	vector<eClass*> eVect=this->convertToVector();
+	sort(eVect.begin(),eVect.end(),[](const eClass* e1, const eClass* e2){return e1->id<e2->id;});
+	ofstream classFile(outname+"_classes.txt");
+	classFile<<"Type = "<<type<<"  Radius="<<r<<"  Number of Frames="<<frame<<endl<<endl;
+	for (int i=0;i<eVect.size();i++){
+		classFile<<"Equivalence Class "<<eVect[i]->id<<endl;
+		eVect[i]->print(classFile);
+		classFile<<endl<<"Total number of roots over all frames: "<<((eVect[i]->id<totals.size())?totals[eVect[i]->id]:0)<<endl<<endl;
+	}
+	classFile.close();
+
+	if (curGraph!=NULL){delete curGraph;}
+}
+
+classSketch::classSketch(int capacity1, double epsilon1, double delta1, int precision1):capacity(capacity1),epsilon(epsilon1),delta(delta1),precision(precision1),freeSlot(-1){
+	width=max(1,(int) ceil(M_E/epsilon));
+	depth=max(1,(int) ceil(log(1/delta)));
+}
+
+void classSketch::resize(int numPreps){
+	while (countMin.size()<numPreps){countMin.push_back(vector<uint32_t>(((size_t) depth)*width,0));}
+	while (distinct.size()<numPreps){distinct.push_back(vector<uint8_t>(1<<precision,0));}
+	while (repeated.size()<numPreps){repeated.push_back(vector<uint8_t>(1<<precision,0));}
+}
+
+//adds a hash to the registers of a HyperLogLog sketch
+static void addToRegisters(vector<uint8_t>& registers, int precision, uint64_t hash){
+	uint64_t index=hash>>(64-precision);
+	uint64_t rest=hash<<precision;
+	uint8_t rank=(rest==0)?(64-precision+1):(__builtin_clzll(rest)+1);
+	if (rank>registers[index]){registers[index]=rank;}
+}
+
+void classSketch::observe(uint64_t fingerprint, int dataPrep){
+	resize(dataPrep+1);
+	vector<uint32_t>& table=countMin[dataPrep];
+	uint32_t previous=UINT_MAX;
+	for (int row=0;row<depth;row++){
+		uint32_t& counter=table[((size_t) row)*width+counterRNG::mix(fingerprint+(row+1)*0x9e3779b97f4a7c15ULL)%width];
+		previous=min(previous,counter);
+		counter++;
+	}
+	uint64_t hash=counterRNG::mix(fingerprint^0x5851f42d4c957f2dULL);
+	addToRegisters(distinct[dataPrep],precision,hash);
+	if (previous>=1){addToRegisters(repeated[dataPrep],precision,hash);}
+}
+
+long classSketch::countMinEstimate(uint64_t fingerprint, int dataPrep){
+	if (dataPrep>=countMin.size()){return 0;}
+	long estimate=LONG_MAX;
+	for (int row=0;row<depth;row++){
+		estimate=min(estimate,(long) countMin[dataPrep][((size_t) row)*width+counterRNG::mix(fingerprint+(row+1)*0x9e3779b97f4a7c15ULL)%width]);
+	}
+	return estimate;
+}
+
+double classSketch::cardinality(const vector<uint8_t>& registers){
+	double m=registers.size();
+	double sum=0;
+	int numZero=0;
+	for (int i=0;i<registers.size();i++){
+		sum+=ldexp(1.0,-registers[i]);
+		if (registers[i]==0){numZero++;}
+	}
+	double estimate=0.7213/(1+1.079/m)*m*m/sum;
+	if ((estimate<=2.5*m) and (numZero>0)){estimate=m*log(m/numZero);} //linear counting
+	return estimate;
+}
+
+void classSketch::swapHeap(int i, int k){
+	swap(heap[i],heap[k]);
+	heapPos[heap[i]]=i;
+	heapPos[heap[k]]=k;
+}
+
+void classSketch::siftUp(int i){
+	while ((i>0) and (totals[heap[i]]<totals[heap[(i-1)/2]])){
+		swapHeap(i,(i-1)/2);
+		i=(i-1)/2;
+	}
+}
+
+void classSketch::siftDown(int i){
+	while (true){
+		int smallest=i;
+		for (int child=2*i+1;child<=2*i+2;child++){
+			if ((child<heap.size()) and (totals[heap[child]]<totals[heap[smallest]])){smallest=child;}
+		}
+		if (smallest==i){return;}
+		swapHeap(i,smallest);
+		i=smallest;
+	}
+}
+
+void classSketch::insert(eClass* curClass, long total, long error){
+	int slot=freeSlot;
+	if (slot<0){
+		slot=slots.size();
+		slots.push_back(NULL);
+		totals.push_back(0);
+		errors.push_back(0);
+		heapPos.push_back(0);
+	}
+	freeSlot=-1;
+	slots[slot]=curClass;
+	totals[slot]=total;
+	errors[slot]=error;
+	curClass->id=slot;
+	heap.push_back(slot);
+	heapPos[slot]=heap.size()-1;
+	siftUp(heap.size()-1);
+}
+
+eClass* classSketch::evict(){
+	int slot=heap[0];
+	swapHeap(0,heap.size()-1);
+	heap.pop_back();
+	if (heap.size()>0){siftDown(0);}
+	freeSlot=slot;
+	return slots[slot];
+}
+
+void classSketch::increment(eClass* storedClass){
+	totals[storedClass->id]++;
+	siftDown(heapPos[storedClass->id]);
+}
+
+classCatalog::classCatalog(string filename1, int type1, int r1):filename(filename1),type(type1),r(r1),valid(false),payloads({}),fingerprints({}),index({}),file(NULL){
+	const char magic[8]={'S','W','C','A','T','L','O','G'};
+	int32_t header[4]={1,0x01020304,type,r}; //version, byte order, type, radius
+
+	struct stat fileStat;
+	bool exists=(stat(filename.c_str(),&fileStat)==0) and (fileStat.st_size>0);
+	if (exists){
+		ifstream in(filename,ios::binary);
+		char fileMagic[8];
+		int32_t fileHeader[4];
+		in.read(fileMagic,8);
+		in.read((char*) fileHeader,sizeof(fileHeader));
+		if ((!in) or (memcmp(fileMagic,magic,8)!=0) or (fileHeader[0]!=header[0]) or (fileHeader[1]!=header[1])){
+			cout<<"WARNING: "<<filename<<" IS NOT A VALID CLASS CATALOG."<<endl;
+			return;
+		}
+		if ((fileHeader[2]!=type) or (fileHeader[3]!=r)){
+			cout<<"WARNING: THE CLASS CATALOG "<<filename<<" IS FOR TYPE "<<fileHeader[2]<<" AND RADIUS "<<fileHeader[3]<<"."<<endl;
+			return;
+		}
+		long validLength=in.tellg();
+		while (true){
+			uint64_t fingerprint;
+			int32_t numRows;
+			if (!in.read((char*) &fingerprint,sizeof(fingerprint))){break;}
+			if ((!in.read((char*) &numRows,sizeof(numRows))) or (numRows<0)){break;}
+			vector<vector<int> > data(numRows);
+			bool complete=true;
+			for (int i=0;(i<numRows) and complete;i++){
+				int32_t length;
+				complete=(in.read((char*) &length,sizeof(length))) and (length>=0);
+				if (complete){
+					data[i].resize(length);
+					complete=(length==0) or in.read((char*) data[i].data(),sizeof(int32_t)*length);
+				}
+			}
+			if (!complete){break;}
+			index[fingerprint].push_back(payloads.size());
+			fingerprints.push_back(fingerprint);
+			payloads.push_back(data);
+			validLength=in.tellg();
+		}
+		in.close();
+		if (validLength<fileStat.st_size){
+			cout<<"WARNING: REMOVING AN INCOMPLETE RECORD AT THE END OF THE CLASS CATALOG "<<filename<<"."<<endl;
+			if (truncate(filename.c_str(),validLength)!=0){
+				cout<<"WARNING: COULD NOT REPAIR "<<filename<<"."<<endl;
+				return;
+			}
+		}
+		file=new ofstream(filename,ios::binary|ios::app);
+	}
+	else {
+		file=new ofstream(filename,ios::binary|ios::trunc);
+		file->write(magic,8);
+		file->write((const char*) header,sizeof(header));
+	}
+	if (file->fail()){
+		cout<<"WARNING: THE CLASS CATALOG "<<filename<<" CANNOT BE OPENED."<<endl;
+		return;
+	}
+	valid=true;
+}
+
+classCatalog::~classCatalog(){
+	if (file!=NULL){
+		file->close();
+		delete file;
+	}
+}
+
+int classCatalog::lookup(eClass* curClass){
+	unordered_map<uint64_t,vector<int> >::iterator iter=index.find(curClass->fingerprint);
+	if (iter==index.end()){return -1;}
+	for (int i=0;i<iter->second.size();i++){
+		if (payloads[iter->second[i]]==curClass->data){return iter->second[i];}
+	}
+	return -1;
+}
+
+int classCatalog::insert(eClass* curClass){
+	if (!valid){return -1;}
+	int id=lookup(curClass);
+	if (id>=0){return id;}
+	id=payloads.size();
+	index[curClass->fingerprint].push_back(id);
+	fingerprints.push_back(curClass->fingerprint);
+	payloads.push_back(curClass->data);
+
+	int32_t numRows=curClass->data.size();
+	file->write((const char*) &curClass->fingerprint,sizeof(uint64_t));
+	file->write((const char*) &numRows,sizeof(numRows));
+	for (int i=0;i<numRows;i++){
+		int32_t length=curClass->data[i].size();
+		file->write((const char*) &length,sizeof(length));
+		file->write((const char*) curClass->data[i].data(),sizeof(int32_t)*length);
+	}
+	return id;
+}
+
+eClass* classCatalog::getClass(int id){
+	eClass* curClass=new eClass(type,r,payloads[id]);
+	curClass->globalId=id;
+	return curClass;
+}
+
+void classCatalog::flush(){
+	if (file!=NULL){file->flush();}
+}
+
+void empiricalDistribution::saveData_toIds(string filename){
+	STATS_TIMER(STATS_OUTPUT);
+	if ((catalog==NULL) or (!catalog->valid)){
+		cout<<"WARNING: A VALID CLASS CATALOG IS NEEDED TO SAVE CLASS IDS."<<endl;
+		return;
+	}
+	if (runs.size()>0){
+		cout<<"WARNING: CLASS IDS CANNOT BE SAVED AFTER THE MEMORY BUDGET WAS EXCEEDED. USE THE SAVED .dat FILE INSTEAD."<<endl;
+		return;
+	}
+	vector<eClass*> eVect=convertToVector();
+	sort(eVect.begin(),eVect.end(),[](const eClass* e1, const eClass* e2){return e1->id<e2->id;});
+	for (int i=0;i<eVect.size();i++){if (eVect[i]->globalId<0){eVect[i]->globalId=catalog->insert(eVect[i]);}}
+	catalog->flush(); //the ids in the file must be in the catalog on disk
+
+	ofstream fs(filename+".ids");
+	fs<<type<<" "<<r<<" "<<selection<<" "<<numPreps<<endl;
+	for (int j=0;j<numRoots.size();j++){fs<<numRoots[j]<<" ";}
+	fs<<endl;
+	for (int i=0;i<eVect.size();i++){
+		fs<<eVect[i]->globalId;
+		for (int j=0;j<numPreps;j++){fs<<" "<<eVect[i]->counts[j];}
+		fs<<endl;
+	}
+	fs.close();
+}
+
+empiricalDistribution::empiricalDistribution(string filename, classCatalog* catalog1):empiricalDistribution(0,0,0)
+{
+	catalog=catalog1;
+	ifstream file(filename);
+	string line;
+	getline(file,line);
+	stringstream linestream(line);
+	linestream>>type>>r>>selection>>numPreps;
+	pattern=defaultPattern(selection);
+	if (type==1){mobius=computeMobius(r);}
+	if ((catalog==NULL) or (!catalog->valid) or (catalog->type!=type) or (catalog->r!=r)){
+		cout<<"WARNING: "<<filename<<" CANNOT BE LOADED WITHOUT THE CLASS CATALOG OF TYPE "<<type<<" AND RADIUS "<<r<<"."<<endl;
+		numPreps=0;
+		return;
+	}
+
+	getline(file,line);
+	linestream.clear();
+	linestream.str(line);
+	long x;
+	numRoots={};
+	while (linestream>>x){numRoots.push_back(x);}
+
+	while (getline(file,line)){
+		linestream.clear();
+		linestream.str(line);
+		int id;
+		if (!(linestream>>id)){continue;}
+		if ((id<0) or (id>=catalog->size())){
+			cout<<"WARNING: CLASS "<<id<<" OF "<<filename<<" IS NOT IN THE CATALOG."<<endl;
+			continue;
+		}
+		eClass* curClass=catalog->getClass(id);
+		curClass->resize(numPreps);
+		for (int j=0;j<numPreps;j++){
+			linestream>>x;
+			curClass->counts[j]=x;
+			curClass->freqs[j]=(numRoots[j]>0)?((double) x)/numRoots[j]:0;
+		}
+		curClass->id=numClasses++;
+		distr[curClass->key].push_back(curClass);
+	}
+	file.close();
+}
+
+void empiricalDistribution::setApproximate(int capacity, double epsilon, double delta){
+	if (numClasses>0){
+		cout<<"WARNING: THE APPROXIMATE MODE MUST BE SET BEFORE THE DISTRIBUTION IS COMPUTED."<<endl;
+		return;
+	}
+	if (sketch!=NULL){delete sketch;}
+	sketch=new classSketch(capacity,epsilon,delta);
+	sketch->resize(numPreps);
+	if (maxExamples<0){maxExamples=10;}
+}
+
+void empiricalDistribution::saveSketchReport(string filename){
+	if (sketch==NULL){return;}
+	ofstream fs(filename+"_sketch.txt");
+	long totalRoots=0;
+	for (int j=0;j<numPreps;j++){totalRoots+=numRoots[j];}
+	fs<<"Approximate distribution: at most "<<sketch->capacity<<" equivalence classes stored, Count-Min sketches of "<<sketch->depth<<"x"<<sketch->width<<" counters, HyperLogLog sketches with "<<(1<<sketch->precision)<<" registers"<<endl;
+	fs<<"Every equivalence class with more than "<<totalRoots/((double) sketch->capacity)<<" roots in total is stored."<<endl;
+	fs<<"Relative standard error of the distinct class estimates: "<<1.04/sqrt((double) (1<<sketch->precision))<<endl<<endl;
+
+	vector<eClass*> eVect=convertToVector();
+	sort(eVect.begin(),eVect.end(),[](const eClass* e1, const eClass* e2){return e1->id<e2->id;});
+	for (int j=0;j<numPreps;j++){
+		double distinctClasses=sketch->cardinality(sketch->distinct[j]);
+		double singletons=max(0.0,distinctClasses-sketch->cardinality(sketch->repeated[j]));
+
+		//entropy of the stored classes, with the remaining roots spread evenly over the remaining classes
+		double entropy=0;
+		double storedMass=0;
+		int numStored=0;
+		for (int i=0;i<eVect.size();i++){
+			if (eVect[i]->counts[j]==0){continue;}
+			double p=((double) eVect[i]->counts[j])/numRoots[j];
+			entropy-=p*log(p);
+			storedMass+=p;
+			numStored++;
+		}
+		double rest=1-storedMass;
+		if (rest>0){entropy-=rest*log(rest/max(1.0,distinctClasses-numStored));}
+
+		fs<<"Preparation "<<j<<endl;
+		fs<<"Number of roots: "<<numRoots[j]<<endl;
+		fs<<"Count-Min error bound: "<<sketch->epsilon*numRoots[j]<<" with probability "<<1-sketch->delta<<endl;
+		fs<<"Estimated number of distinct classes: "<<distinctClasses<<endl;
+		fs<<"Estimated number of singleton classes: "<<singletons<<endl;
+		fs<<"Estimated Shannon entropy (unrescaled): "<<entropy<<endl;
+		fs<<"Fraction of roots in stored classes: "<<storedMass<<endl<<endl;
+	}
+
+	fs<<"Stored classes: id, then for each preparation the count, and an upper bound on the true count"<<endl;
+	sort(eVect.begin(),eVect.end(),[this](const eClass* e1, const eClass* e2){return sketch->totals[e1->id]>sketch->totals[e2->id];});
+	for (int i=0;i<eVect.size();i++){
+		fs<<eVect[i]->id;
+		for (int j=0;j<numPreps;j++){
+			long upper=min(eVect[i]->counts[j]+sketch->errors[eVect[i]->id],sketch->countMinEstimate(eVect[i]->fingerprint,j));
+			fs<<" "<<eVect[i]->counts[j]<<" "<<upper;
+		}
+		fs<<endl;
+	}
+	fs.close();
+}
+
+void empiricalDistribution::merge(empiricalDistribution* other, bool samePreparations, bool takeClasses){
+	if ((sketch!=NULL) or (other->sketch!=NULL)){
+		cout<<"WARNING: MERGING IS NOT AVAILABLE IN THE APPROXIMATE MODE."<<endl;
+		return;
+	}
+	if ((other->type!=type) or (other->r!=r)){
+		cout<<"WARNING: CANNOT MERGE EMPIRICAL DISTRIBUTIONS OF DIFFERENT TYPES OR RADII."<<endl;
+		return;
+	}
+
+	//preparation j of other becomes preparation prepMap[j]
+	vector<int> prepMap(other->numPreps);
+	for (int j=0;j<other->numPreps;j++){prepMap[j]=samePreparations?j:numPreps+j;}
+	int newNumPreps=samePreparations?max(numPreps,other->numPreps):numPreps+other->numPreps;
+	if (newNumPreps>numPreps){
+		numPreps=newNumPreps;
+		numRoots.resize(numPreps,0);
+		for (pair<const int,vector<eClass*> >& elt : distr){for (int i=0;i<elt.second.size();i++){
+			elt.second[i]->resize(numPreps);
+		}}
+	}
+	for (int j=0;j<other->numPreps;j++){numRoots[prepMap[j]]+=other->numRoots[j];}
+
+	//hash join of the dictionaries
+	for (pair<const int,vector<eClass*> >& elt : other->distr){
+		vector<eClass*>& curCompare=distr[elt.first];
+		int numOld=curCompare.size(); //classes added from other are distinct from each other
+		for (int i=0;i<elt.second.size();i++){
+			eClass* otherClass=elt.second[i];
+			eClass* storedClass=NULL;
+			for (int k=0;k<numOld;k++){
+				if (*curCompare[k]==*otherClass){
+					storedClass=curCompare[k];
+					break;
+				}
+			}
+			if (storedClass!=NULL){
+				for (int j=0;j<other->numPreps;j++){
+					storedClass->counts[prepMap[j]]+=otherClass->counts[j];
+					vector<int>& curExamples=storedClass->examples[prepMap[j]];
+					int numExamples=otherClass->examples[j].size();
+					if (maxExamples>=0){numExamples=min(numExamples,max(0,maxExamples-(int) curExamples.size()));}
+					curExamples.insert(curExamples.end(),otherClass->examples[j].begin(),otherClass->examples[j].begin()+numExamples);
+				}
+				if (takeClasses){delete otherClass;}
+			}
+			else{//new equivalence class
+				eClass* newClass=takeClasses?otherClass:new eClass(type,r,otherClass->data);
+				newClass->globalId=otherClass->globalId;
+				vector<int> counts(numPreps,0);
+				vector<vector<int> > examples(numPreps);
+				for (int j=0;j<other->numPreps;j++){
+					counts[prepMap[j]]=otherClass->counts[j];
+					examples[prepMap[j]]=otherClass->examples[j];
+					if ((maxExamples>=0) and (examples[prepMap[j]].size()>maxExamples)){examples[prepMap[j]].resize(maxExamples);}
+				}
+				newClass->counts=counts;
+				newClass->examples=examples;
+				newClass->freqs.assign(numPreps,0);
+				newClass->id=numClasses++;
+				curCompare.push_back(newClass);
+			}
+		}
+	}
+	if (takeClasses){
+		other->distr={};
+		other->numClasses=0;
+	}
+
+	//compute the frequencies
+	for (pair<const int,vector<eClass*> >& elt : distr){for (int i=0;i<elt.second.size();i++){
+		eClass* curClass=elt.second[i];
+		for (int j=0;j<other->numPreps;j++){
+			int k=prepMap[j];
+			curClass->freqs[k]=(numRoots[k]>0)?((double) curClass->counts[k])/((double) numRoots[k]):0;
+		}
+	}}
+}
+
+void empiricalDistribution::merge(string filename, bool samePreparations){
+	empiricalDistribution* other=new empiricalDistribution(filename);
+	merge(other,samePreparations,true);
+	delete other;
+}
+
+	
+//converts a dictionary to a vector 
+vector<eClass*> empiricalDistribution::convertToVector(){
+	vector<eClass*> eVect={};
+	for(unordered_map<int,vector<eClass*> >::iterator iter=distr.begin();iter!=distr.end();iter++){
+		for (int j=0;j<(*iter).second.size();j++){
+			eVect.push_back((*iter).second[j]);
+		}
+	}
+	return eVect;
+}
+
+
+void parallelFor(int n, function<void(int)> f, int numThreads){
+	if (numThreads<=0){numThreads=max(1,(int) thread::hardware_concurrency());}
+	numThreads=min(numThreads,n);
+	if (numThreads<=1){
+		for (int i=0;i<n;i++){f(i);}
+		return;
+	}
+	atomic<int> next(0);
+	vector<thread> threads;
+	for (int t=0;t<numThreads;t++){
+		threads.push_back(thread([&next,n,&f](){
+			for (int i=next++;i<n;i=next++){f(i);}
+		}));
+	}
+	for (int t=0;t<numThreads;t++){threads[t].join();}
+}
+
+
+classRanking::classRanking(vector<eClass*> eVect):classes(eVect){
+	int numPreps=0;
+	for (int i=0;i<classes.size();i++){numPreps=max(numPreps,(int) classes[i]->counts.size());}
+	order.assign(numPreps,{});
+	for (int i=0;i<classes.size();i++){classes[i]->ranks.assign(numPreps,0);}
+
+	vector<int> numWithCount;
+	vector<int> next;
+	for (int j=0;j<numPreps;j++){
+		//counting sort by decreasing count
+		int maxCount=0;
+		int numPresent=0;
+		for (int i=0;i<classes.size();i++){
+			int count=(j<classes[i]->counts.size())?classes[i]->counts[j]:0;
+			if (count>0){numPresent++;}
+			maxCount=max(maxCount,count);
+		}
+		numWithCount.assign(maxCount+2,0);
+		for (int i=0;i<classes.size();i++){
+			int count=(j<classes[i]->counts.size())?classes[i]->counts[j]:0;
+			if (count>0){numWithCount[count]++;}
+		}
+		//numWithCount[c] becomes the number of classes with count greater than c
+		int numGreater=0;
+		for (int c=maxCount;c>=1;c--){
+			int cur=numWithCount[c];
+			numWithCount[c]=numGreater;
+			numGreater+=cur;
+		}
+		next=numWithCount; //next position in order[j] for each count
+		order[j].resize(numPresent);
+		for (int i=0;i<classes.size();i++){
+			int count=(j<classes[i]->counts.size())?classes[i]->counts[j]:0;
+			if (count>0){
+				classes[i]->ranks[j]=numWithCount[count];
+				order[j][next[count]++]=i;
+			}
+			else {classes[i]->ranks[j]=numPresent;}
+		}
+	}
+}
+
+vector<eClass*> classRanking::topK(int j, int k){
+	vector<eClass*> toReturn={};
+	for (int i=0;i<min(k,(int) order[j].size());i++){toReturn.push_back(classes[order[j][i]]);}
+	if (toReturn.size()<k){ //fill with classes absent from preparation j
+		for (int i=0;(i<classes.size()) and (toReturn.size()<k);i++){
+			if (classes[i]->ranks[j]==order[j].size()){toReturn.push_back(classes[i]);}
+		}
+	}
+	return toReturn;
+}
+
+vector<eClass*> classRanking::topKDifference(int j, int l, int k){
+	k=min(k,(int) classes.size());
+	if (k<=0){return {};}
+	//min-heap of the k largest differences found so far; ties are broken by position in classes
+	typedef pair<double,int> entry;
+	auto better=[](const entry& a, const entry& b){return (a.first>b.first) or ((a.first==b.first) and (a.second<b.second));};
+	vector<entry> heap;
+	for (int i=0;i<order[j].size();i++){
+		eClass* curClass=classes[order[j][i]];
+		double freq=curClass->freqs[j];
+		if ((heap.size()==k) and (freq<heap[0].first)){break;} //the difference of every remaining class is at most freq
+		entry cur(freq-((l<curClass->freqs.size())?curClass->freqs[l]:0),order[j][i]);
+		if (heap.size()<k){
+			heap.push_back(cur);
+			push_heap(heap.begin(),heap.end(),better);
+		}
+		else if (better(cur,heap[0])){
+			pop_heap(heap.begin(),heap.end(),better);
+			heap.back()=cur;
+			push_heap(heap.begin(),heap.end(),better);
+		}
+	}
+	if ((heap.size()<k) or (heap[0].first<=0)){
+		//classes absent from preparation j could be among the largest differences
+		return ::topK(classes,k,differenceCompare(j,l));
+	}
+	sort_heap(heap.begin(),heap.end(),better);
+	vector<eClass*> toReturn(heap.size());
+	for (int i=0;i<heap.size();i++){toReturn[i]=classes[heap[i].second];}
+	return toReturn;
+}
+
+void saveData_toView_fromVect(vector<eClass*> eVect, string filename, int n, bool defaultSort)
+{
+	STATS_TIMER(STATS_OUTPUT);
+	if (eVect.size()==0){return;}
+	filename=filename+".txt";
+	int numPreps=eVect[0]->freqs.size();
+	ofstream fs(filename);
+	fs << fixed << showpoint;
+	fs << setprecision(4);
+
+	fs<<"Type = "<<eVect[0]->type<<"  Radius="<<eVect[0]->r<<"  Number of Data Preparations="<<eVect[0]->freqs.size()<<endl; 
+	fs<<endl<<"----------------------------------------------------------------------"<<endl<<endl;
+	if (!defaultSort){for (int i=0;i<min(n,(int) eVect.size());i++){
+		fs<<"Equivalence Class "<<i<<endl;
+		eVect[i]->printWithStats(fs,10);
+		fs<<endl<<endl;
+	}}
+	else{
+		sort(eVect.begin(),eVect.end(),[](const eClass* e1, const eClass* e2){return e1->id<e2->id;});
+		classRanking ranking(eVect);
+		for (int j=0;j<numPreps;j++){
+			fs<<"SORTED BY FREQUENCY IN PREPARATION "<<j<<endl<<endl;
+			vector<eClass*> top=ranking.topK(j,n);
+			for (int i=0;i<top.size();i++){
+				fs<<"Equivalence Class "<<i<<endl;
+				top[i]->printWithStats(fs,10);
+				fs<<endl<<endl;
+			}
+			fs<<"----------------------------------------------------------------------";
+			fs<<endl;
+			fs<<endl;
+		}
+
+		for (int j=0;j<numPreps;j++){for (int k=0;k<numPreps;k++){if (k!=j){
+			fs<<"SORTED BY FREQUENCY IN PREPARATION "<<j<<" MINUS FREQUENCY IN PREPARATION "<<k<<endl;
+			vector<eClass*> top=ranking.topKDifference(j,k,n);
+			for (int i=0;i<top.size();i++){
+				fs<<"Equivalence Class "<<i<<endl;
+				top[i]->printWithStats(fs,10);
+				fs<<endl<<endl;
+			}
+			fs<<"----------------------------------------------------------------------";
+			fs<<endl;
+			fs<<endl;
+		}}}
+	}
+
+	fs.close();
+}
+
+void empiricalDistribution::saveData_toView(std::string filename){
+	saveData_toView_fromVect(this->convertToVector(),filename,10,true);
+}
+//writes the data, counts and examples of one equivalence class in the .dat format
+static void writeClass(ostream& fs, const vector<vector<int> >& data, const vector<int>& counts, const vector<vector<int> >& examples){
+	fs<<data.size()<<endl;
+	for (int j=0;j<data.size();j++){
+		for (int k=0;k<data[j].size();k++){fs<<data[j][k]<<" ";}
+		fs<<endl;
+	}
+	fs<<"-"<<endl;
+	for (int j=0;j<counts.size();j++){fs<<counts[j]<<" ";}
+	fs<<endl<<"-"<<endl;
+	for (int j=0;j<examples.size();j++){
+		for (int k=0;k<examples[j].size();k++){
+			fs<<examples[j][k]<<" ";
+		}
+		fs<<endl;
+	}
+	fs<<"--"<<endl;
+}
+
+//One equivalence class of a run file written by empiricalDistribution::spill. Each record is stored as the 
+//fingerprint, the id, the number of vectors of data, their lengths and entries, the number of preparations, the counts,
+//and for each preparation the number of examples followed by the examples.
+struct spillRecord{
+	uint64_t fingerprint;
+	int32_t id;
+	vector<vector<int> > data;
+	vector<int> counts;
+	vector<vector<int> > examples;
+
+	bool read(istream& fs){
+		int32_t size;
+		if (!fs.read((char*) &fingerprint,sizeof(fingerprint))){return false;}
+		fs.read((char*) &id,sizeof(id));
+		fs.read((char*) &size,sizeof(size));
+		data.assign(size,{});
+		vector<int32_t> lengths(size);
+		fs.read((char*) lengths.data(),sizeof(int32_t)*size);
+		for (int i=0;i<data.size();i++){
+			data[i].resize(lengths[i]);
+			fs.read((char*) data[i].data(),sizeof(int32_t)*lengths[i]);
+		}
+		fs.read((char*) &size,sizeof(size));
+		counts.resize(size);
+		fs.read((char*) counts.data(),sizeof(int32_t)*size);
+		examples.assign(size,{});
+		for (int j=0;j<examples.size();j++){
+			int32_t numExamples;
+			fs.read((char*) &numExamples,sizeof(numExamples));
+			examples[j].resize(numExamples);
+			fs.read((char*) examples[j].data(),sizeof(int32_t)*numExamples);
+		}
+		return bool(fs);
+	}
+
+	static void write(ostream& fs, eClass* curClass){
+		fs.write((const char*) &curClass->fingerprint,sizeof(uint64_t));
+		int32_t id=curClass->id;
+		fs.write((const char*) &id,sizeof(id));
+		int32_t size=curClass->data.size();
+		fs.write((const char*) &size,sizeof(size));
+		for (int i=0;i<curClass->data.size();i++){
+			int32_t length=curClass->data[i].size();
+			fs.write((const char*) &length,sizeof(length));
+		}
+		for (int i=0;i<curClass->data.size();i++){fs.write((const char*) curClass->data[i].data(),sizeof(int32_t)*curClass->data[i].size());}
+		size=curClass->counts.size();
+		fs.write((const char*) &size,sizeof(size));
+		fs.write((const char*) curClass->counts.data(),sizeof(int32_t)*size);
+		for (int j=0;j<curClass->counts.size();j++){
+			int32_t numExamples=(j<curClass->examples.size())?curClass->examples[j].size():0;
+			fs.write((const char*) &numExamples,sizeof(numExamples));
+			if (numExamples>0){fs.write((const char*) curClass->examples[j].data(),sizeof(int32_t)*numExamples);}
+		}
+	}
+};
+
+//order of the equivalence classes in run files
+static bool spillOrder(uint64_t fingerprint1, const vector<vector<int> >& data1, uint64_t fingerprint2, const vector<vector<int> >& data2){
+	if (fingerprint1!=fingerprint2){return fingerprint1<fingerprint2;}
+	return data1<data2;
+}
+
+void empiricalDistribution::spill(){
+	vector<eClass*> eVect=convertToVector();
+	if (eVect.size()==0){return;}
+	sort(eVect.begin(),eVect.end(),[](const eClass* e1, const eClass* e2){return spillOrder(e1->fingerprint,e1->data,e2->fingerprint,e2->data);});
+
+	string runName=spillDirectory+"/swatches_spill_"+to_string(getpid())+"_"+to_string((long) this)+"_"+to_string(runs.size())+".run";
+	ofstream fs(runName,ios::binary);
+	for (int i=0;i<eVect.size();i++){
+		spillRecord::write(fs,eVect[i]);
+		delete eVect[i];
+	}
+	fs.close();
+	if (fs.fail()){cout<<"WARNING: COULD NOT WRITE "<<runName<<"."<<endl;}
+	runs.push_back(runName);
+	distr={};
+	memoryUsed=0;
+}
+
+void empiricalDistribution::saveData_toLoad(std::string filename)
+{
+	STATS_TIMER(STATS_OUTPUT);
+
+	filename=filename+".dat";
+	ofstream fs(filename);
+	fs<<type<<" "<<r<<" "<<selection<<" "<<numPreps<<endl;
+	for (int j=0;j<numRoots.size();j++){fs<<numRoots[j]<<" ";}
+	fs<<endl<<endl<<endl;
+
+	if (runs.size()==0){
+		vector<eClass*> eVect=this->convertToVector();
+		sort(eVect.begin(),eVect.end(),[](const eClass* e1, const eClass* e2){return e1->id<e2->id;});
+		for (int i=0;i<eVect.size();i++){writeClass(fs,eVect[i]->data,eVect[i]->counts,eVect[i]->examples);}
+		fs.close();
+		return;
+	}
+
+	//k-way merge of the runs, in which equal classes are combined in the order the runs were written. The merged classes
+	//come out by fingerprint, so they are written to a temporary file and then copied in the order of their ids. The 
+	//first record of a class has the id it was given when it was first detected, so this is the order without a budget.
+	spill();
+	vector<ifstream*> files(runs.size());
+	vector<spillRecord> heads(runs.size());
+	vector<int> active={};
+	for (int i=0;i<runs.size();i++){
+		files[i]=new ifstream(runs[i],ios::binary);
+		if (heads[i].read(*files[i])){active.push_back(i);}
+	}
+	//min-heap of runs by their current record, with ties broken by the order of the runs
+	auto later=[&heads](int a, int b){
+		if (spillOrder(heads[a].fingerprint,heads[a].data,heads[b].fingerprint,heads[b].data)){return false;}
+		if (spillOrder(heads[b].fingerprint,heads[b].data,heads[a].fingerprint,heads[a].data)){return true;}
+		return a>b;
+	};
+	make_heap(active.begin(),active.end(),later);
+	string mergedName=spillDirectory+"/swatches_spill_"+to_string(getpid())+"_"+to_string((long) this)+"_merged.tmp";
+	fstream merged_fs(mergedName,ios::in|ios::out|ios::trunc|ios::binary);
+	vector<int> ids={};
+	vector<long> offsets={}; //of the merged classes in the temporary file
+	while (active.size()>0){
+		pop_heap(active.begin(),active.end(),later);
+		int first=active.back();
+		spillRecord merged=heads[first];
+		merged.counts.resize(numPreps,0);
+		merged.examples.resize(numPreps);
+		if (heads[first].read(*files[first])){push_heap(active.begin(),active.end(),later);}
+		else {active.pop_back();}
+
+		while (active.size()>0){
+			int next=active.front();
+			if ((heads[next].fingerprint!=merged.fingerprint) or (heads[next].data!=merged.data)){break;}
+			pop_heap(active.begin(),active.end(),later);
+			for (int j=0;j<heads[next].counts.size();j++){
+				merged.counts[j]+=heads[next].counts[j];
+				vector<int>& curExamples=merged.examples[j];
+				int numExamples=heads[next].examples[j].size();
+				if (maxExamples>=0){numExamples=min(numExamples,max(0,maxExamples-(int) curExamples.size()));}
+				curExamples.insert(curExamples.end(),heads[next].examples[j].begin(),heads[next].examples[j].begin()+numExamples);
+			}
+			merged.id=min(merged.id,heads[next].id);
+			if (heads[next].read(*files[next])){push_heap(active.begin(),active.end(),later);}
+			else {active.pop_back();}
+		}
+		ids.push_back(merged.id);
+		offsets.push_back(merged_fs.tellp());
+		writeClass(merged_fs,merged.data,merged.counts,merged.examples);
+	}
+	offsets.push_back(merged_fs.tellp());
+
+	vector<int> order(ids.size());
+	for (int i=0;i<order.size();i++){order[i]=i;}
+	sort(order.begin(),order.end(),[&ids](int a, int b){return ids[a]<ids[b];});
+	vector<char> buffer;
+	for (int i=0;i<order.size();i++){
+		buffer.resize(offsets[order[i]+1]-offsets[order[i]]);
+		merged_fs.seekg(offsets[order[i]]);
+		merged_fs.read(buffer.data(),buffer.size());
+		fs.write(buffer.data(),buffer.size());
+	}
+	if (merged_fs.fail()){cout<<"WARNING: COULD NOT WRITE "<<mergedName<<"."<<endl;}
+	merged_fs.close();
+	remove(mergedName.c_str());
+	fs.close();
+
+	for (int i=0;i<runs.size();i++){
+		delete files[i];
+		remove(runs[i].c_str());
+	}
+	runs={};
+}
+
+
+empiricalDistribution::empiricalDistribution(std::string filename)
 {
 	distr={};
+	numClasses=0;
+	maxExamples=-1;
+	sketch=NULL;
+	memoryBudget=0;
+	spillDirectory=".";
+	memoryUsed=0;
+	tolerance=0;
+	batchSize=1000;
+	convergenceMetric=0;
+	samplingSeed=0;
+	checkpointFile="";
+	checkpointInterval=600;
+	fileCursor=0;
+	resumeCursor=0;
+	checkpointWriter=NULL;
+	checkpointBusy=new atomic<bool>(false);
+	lastCheckpoint=currentTime();
+	catalog=NULL;
+	refinementRounds=-1;
+	verifiedRoots=0;
+	rootBegin=0;
+	rootEnd=-1;
+	maxBallSize=0;
+	maxCandidateRings=0;
+	maxNautyTime=0;
+	budgetPolicy=0;
+	fallbackType=5;
+	fallback=NULL;
+	contraction=-1;
+	contractedRoots=0;
+	if (distributionFile::isBinary(filename)){
+		distributionFile file;
+		if (file.open(filename)){loadBinary(file);}
+		else {
+			cout<<"WARNING: "<<filename<<" IS NOT A VALID BINARY DISTRIBUTION FILE."<<endl;
+			type=0; r=0; selection=0; numPreps=0;
+		}
+		return;
+	}
 	ifstream file(filename);
 	string line;
 
 	getline(file,line);
 	stringstream linestream(line);
 	linestream>>type>>r>>selection>>numPreps;
+	pattern=defaultPattern(selection);
 	if (type==1){mobius=computeMobius(r);}
 	
 	getline(file,line);
@@ -444,6 +2548,7 @@ empiricalDistribution::empiricalDistribution(std::string filename)
 		}
 		getline(file,line);
 
+		curClass->id=numClasses++;
 		if (distr.find(curClass->key)!=distr.end()){//key has been seen before
 			distr[curClass->key].push_back(curClass);
 		}
@@ -456,77 +2561,568 @@ empiricalDistribution::empiricalDistribution(std::string filename)
 
 	
 
-vector<vector<double> > empiricalDistribution::LNorm(int p, string filename){
-	if (numPreps==1){cout<<"ONLY ONE PREPARATION - CANNOT COMPUTE L NORM"<<endl;}
-	filename=filename+"_L"+to_string(p)+".txt";
+static int64_t alignSection(int64_t x){return (x+7)/8*8;}
+
+//writes zeros until position reaches target
+static void padTo(ostream& fs, int64_t& position, int64_t target){
+	for (;position<target;position++){fs.put(0);}
+}
+
+void empiricalDistribution::saveData_toBinary(string filename){
+	ofstream fs(filename+".bdat",ios::binary);
+	saveData_toBinary(fs);
+	fs.close();
+}
+
+void empiricalDistribution::saveData_toBinary(ostream& fs){
+	STATS_TIMER(STATS_OUTPUT);
 	vector<eClass*> eVect=this->convertToVector();
-	vector<vector<double> > dists(numPreps,vector<double>(numPreps,0.0));
-	for (int i =0;i<eVect.size();i++){
-		eClass* curClass=eVect[i];
-		for (int j=0;j<numPreps;j++){for (int k=j+1;k<numPreps;k++){	
-			double curDist=pow(fabs(curClass->freqs[j]-curClass->freqs[k]),p);
-			dists[j][k]+=curDist;
-		}}
+	sort(eVect.begin(),eVect.end(),[](const eClass* e1, const eClass* e2){return e1->id<e2->id;});
+	int64_t numC=eVect.size();
+
+	//compute the layout
+	vector<distributionFile::classRecord> classes(numC);
+	int64_t payloadSize=0;
+	vector<int64_t> exampleOffsets(numC*numPreps+1,0);
+	for (int64_t c=0;c<numC;c++){
+		classes[c].payload=payloadSize;
+		classes[c].key=eVect[c]->key;
+		classes[c].numVectors=eVect[c]->data.size();
+		payloadSize+=eVect[c]->data.size();
+		for (int i=0;i<eVect[c]->data.size();i++){payloadSize+=eVect[c]->data[i].size();}
+		for (int j=0;j<numPreps;j++){
+			int numExamples=(j<eVect[c]->examples.size())?eVect[c]->examples[j].size():0;
+			exampleOffsets[c*numPreps+j+1]=exampleOffsets[c*numPreps+j]+numExamples;
+		}
+	}
+
+	distributionHeader header;
+	memset(&header,0,sizeof(header));
+	memcpy(header.magic,"SWATCHES",8);
+	header.version=distributionFile::version;
+	header.byteOrder=0x01020304;
+	header.type=type;
+	header.r=r;
+	header.selection=selection;
+	header.numPreps=numPreps;
+	header.numClasses=numC;
+	header.numRootsOffset=alignSection(sizeof(header));
+	header.classesOffset=alignSection(header.numRootsOffset+sizeof(int64_t)*numPreps);
+	header.payloadOffset=alignSection(header.classesOffset+sizeof(distributionFile::classRecord)*numC);
+	header.countsOffset=alignSection(header.payloadOffset+sizeof(int32_t)*payloadSize);
+	header.exampleOffsetsOffset=alignSection(header.countsOffset+sizeof(int32_t)*numC*numPreps);
+	header.examplesOffset=alignSection(header.exampleOffsetsOffset+sizeof(int64_t)*exampleOffsets.size());
+	header.fileSize=alignSection(header.examplesOffset+sizeof(int32_t)*exampleOffsets.back());
+
+	int64_t position=0;
+	fs.write((const char*) &header,sizeof(header));
+	position+=sizeof(header);
+
+	padTo(fs,position,header.numRootsOffset);
+	vector<int64_t> roots(numRoots.begin(),numRoots.end());
+	roots.resize(numPreps,0);
+	fs.write((const char*) roots.data(),sizeof(int64_t)*numPreps);
+	position+=sizeof(int64_t)*numPreps;
+
+	padTo(fs,position,header.classesOffset);
+	fs.write((const char*) classes.data(),sizeof(distributionFile::classRecord)*numC);
+	position+=sizeof(distributionFile::classRecord)*numC;
+
+	padTo(fs,position,header.payloadOffset);
+	vector<int32_t> buffer;
+	for (int64_t c=0;c<numC;c++){
+		buffer.clear();
+		vector<vector<int> >& data=eVect[c]->data;
+		for (int i=0;i<data.size();i++){buffer.push_back(data[i].size());}
+		for (int i=0;i<data.size();i++){buffer.insert(buffer.end(),data[i].begin(),data[i].end());}
+		fs.write((const char*) buffer.data(),sizeof(int32_t)*buffer.size());
+		position+=sizeof(int32_t)*buffer.size();
+	}
+
+	padTo(fs,position,header.countsOffset);
+	buffer.resize(numC);
+	for (int j=0;j<numPreps;j++){
+		for (int64_t c=0;c<numC;c++){buffer[c]=(j<eVect[c]->counts.size())?eVect[c]->counts[j]:0;}
+		fs.write((const char*) buffer.data(),sizeof(int32_t)*numC);
+		position+=sizeof(int32_t)*numC;
 	}
-	for (int j=0;j<numPreps;j++){for (int k=j+1;k<numPreps;k++){
-		dists[j][k]=pow(dists[j][k],1.0/p);
-		dists[k][j]=dists[j][k];
+
+	padTo(fs,position,header.exampleOffsetsOffset);
+	fs.write((const char*) exampleOffsets.data(),sizeof(int64_t)*exampleOffsets.size());
+	position+=sizeof(int64_t)*exampleOffsets.size();
+
+	padTo(fs,position,header.examplesOffset);
+	for (int64_t c=0;c<numC;c++){for (int j=0;j<numPreps;j++){
+		if (j>=eVect[c]->examples.size()){continue;}
+		vector<int>& curExamples=eVect[c]->examples[j];
+		fs.write((const char*) curExamples.data(),sizeof(int32_t)*curExamples.size());
+		position+=sizeof(int32_t)*curExamples.size();
 	}}
-	if (filename!=""){
-		filename=filename+".txt";
-		ofstream fs(filename);
+	padTo(fs,position,header.fileSize);
+}
+
+void empiricalDistribution::loadBinary(distributionFile& file){
+	type=file.header->type;
+	r=file.header->r;
+	selection=file.header->selection;
+	numPreps=file.header->numPreps;
+	pattern=defaultPattern(selection);
+	if (type==1){mobius=computeMobius(r);}
+	numRoots.assign(file.numRoots,file.numRoots+numPreps);
+
+	for (int c=0;c<file.numClasses();c++){
+		eClass* curClass=new eClass(type,r,file.data(c));
+		curClass->resize(numPreps);
 		for (int j=0;j<numPreps;j++){
-			for (int k=0;k<numPreps;k++){
-				fs<<dists[j][k]<<" ";
+			curClass->counts[j]=file.count(c,j);
+			curClass->freqs[j]=(numRoots[j]>0)?((double) curClass->counts[j])/numRoots[j]:0;
+			curClass->examples[j].assign(file.examplesBegin(c,j),file.examplesBegin(c,j)+file.numExamples(c,j));
+		}
+		curClass->id=numClasses++;
+		distr[curClass->key].push_back(curClass);
+	}
+}
+
+
+bool distributionFile::isBinary(string filename){
+	ifstream file(filename,ios::binary);
+	char magic[8];
+	if (!file.read(magic,8)){return false;}
+	return memcmp(magic,"SWATCHES",8)==0;
+}
+
+bool distributionFile::open(string filename){
+	close();
+	int fd=::open(filename.c_str(),O_RDONLY);
+	if (fd<0){return false;}
+	struct stat info;
+	if ((fstat(fd,&info)!=0) or (info.st_size<sizeof(distributionHeader))){
+		::close(fd);
+		return false;
+	}
+	length=info.st_size;
+	base=mmap(NULL,length,PROT_READ,MAP_SHARED,fd,0);
+	::close(fd);
+	if (base==MAP_FAILED){
+		base=NULL;
+		length=0;
+		return false;
+	}
+
+	header=(const distributionHeader*) base;
+	if ((memcmp(header->magic,"SWATCHES",8)!=0) or (header->byteOrder!=0x01020304) or (header->version!=version) or (header->fileSize>length)){
+		close();
+		return false;
+	}
+	const char* start=(const char*) base;
+	numRoots=(const int64_t*) (start+header->numRootsOffset);
+	classes=(const classRecord*) (start+header->classesOffset);
+	payload=(const int32_t*) (start+header->payloadOffset);
+	counts=(const int32_t*) (start+header->countsOffset);
+	exampleOffsets=(const int64_t*) (start+header->exampleOffsetsOffset);
+	examples=(const int32_t*) (start+header->examplesOffset);
+	return true;
+}
+
+void distributionFile::close(){
+	if (base!=NULL){munmap(base,length);}
+	base=NULL;
+	length=0;
+	header=NULL;
+}
+
+vector<vector<int> > distributionFile::data(int c){
+	const int32_t* lengths=payload+classes[c].payload;
+	const int32_t* entries=lengths+classes[c].numVectors;
+	vector<vector<int> > toReturn(classes[c].numVectors);
+	for (int i=0;i<classes[c].numVectors;i++){
+		toReturn[i].assign(entries,entries+lengths[i]);
+		entries+=lengths[i];
+	}
+	return toReturn;
+}
+	
+
+frequencyMatrix::frequencyMatrix(empiricalDistribution* distribution){
+	vector<eClass*> eVect=distribution->convertToVector();
+	sort(eVect.begin(),eVect.end(),[](const eClass* e1, const eClass* e2){return e1->id<e2->id;});
+	numClasses=eVect.size();
+	numPreps=distribution->numPreps;
+	freqs.assign(((size_t) numPreps)*numClasses,0);
+	for (int j=0;j<numPreps;j++){
+		double* curRow=freqs.data()+((size_t) j)*numClasses;
+		int numRoots=distribution->numRoots[j];
+		if (numRoots==0){continue;}
+		for (int c=0;c<numClasses;c++){
+			if (j<eVect[c]->counts.size()){curRow[c]=((double) eVect[c]->counts[j])/numRoots;}
+		}
+	}
+}
+
+frequencyMatrix::frequencyMatrix(distributionFile& file){
+	numClasses=file.numClasses();
+	numPreps=file.numPreps();
+	freqs.assign(((size_t) numPreps)*numClasses,0);
+	for (int j=0;j<numPreps;j++){
+		double* curRow=freqs.data()+((size_t) j)*numClasses;
+		const int32_t* counts=file.countRow(j);
+		if (file.numRoots[j]==0){continue;}
+		double scale=1.0/file.numRoots[j];
+		for (int c=0;c<numClasses;c++){curRow[c]=counts[c]*scale;}
+	}
+}
+
+vector<double> frequencyMatrix::entropies(){
+	vector<double> ent(numPreps,0.0);
+	for (int j=0;j<numPreps;j++){
+		const double* x=row(j);
+		for (int c=0;c<numClasses;c++){
+			if (x[c]>0){ent[j]-=x[c]*log(x[c]);}
+		}
+	}
+	return ent;
+}
+
+//The pair kernels accumulate in independent lanes, which the compiler can map to vector registers without 
+//reordering the floating point operations within a lane.
+static const int kernelLanes=4;
+
+static double lpKernel(const double* x, const double* y, int n, int p){
+	double acc[kernelLanes]={0,0,0,0};
+	int c=0;
+	if (p==1){
+		for (;c+kernelLanes<=n;c+=kernelLanes){for (int l=0;l<kernelLanes;l++){acc[l]+=fabs(x[c+l]-y[c+l]);}}
+		for (;c<n;c++){acc[0]+=fabs(x[c]-y[c]);}
+	}
+	else if (p==2){
+		for (;c+kernelLanes<=n;c+=kernelLanes){for (int l=0;l<kernelLanes;l++){
+			double d=x[c+l]-y[c+l];
+			acc[l]+=d*d;
+		}}
+		for (;c<n;c++){acc[0]+=(x[c]-y[c])*(x[c]-y[c]);}
+	}
+	else {
+		for (;c<n;c++){acc[0]+=pow(fabs(x[c]-y[c]),p);}
+	}
+	return (acc[0]+acc[1])+(acc[2]+acc[3]);
+}
+
+//Computes both KL(x||y) and KL(y||x) from the logarithms of the frequencies, over the classes present in both.
+static void klKernel(const double* x, const double* y, const double* lx, const double* ly, int n, double& xy, double& yx){
+	double accXY[kernelLanes]={0,0,0,0};
+	double accYX[kernelLanes]={0,0,0,0};
+	int c=0;
+	for (;c+kernelLanes<=n;c+=kernelLanes){for (int l=0;l<kernelLanes;l++){
+		bool both=(x[c+l]>0) & (y[c+l]>0);
+		double diff=lx[c+l]-ly[c+l];
+		accXY[l]+=both?x[c+l]*diff:0.0;
+		accYX[l]-=both?y[c+l]*diff:0.0;
+	}}
+	for (;c<n;c++){
+		if ((x[c]>0) and (y[c]>0)){
+			accXY[0]+=x[c]*(lx[c]-ly[c]);
+			accYX[0]-=y[c]*(lx[c]-ly[c]);
+		}
+	}
+	xy+=(accXY[0]+accXY[1])+(accXY[2]+accXY[3]);
+	yx+=(accYX[0]+accYX[1])+(accYX[2]+accYX[3]);
+}
+
+//sum of m*log(m) for the mixture m=(x+y)/2
+static double mixtureKernel(const double* x, const double* y, int n){
+	double acc=0;
+	for (int c=0;c<n;c++){
+		double m=0.5*(x[c]+y[c]);
+		if (m>0){acc+=m*log(m);}
+	}
+	return acc;
+}
+
+static double dotKernel(const double* x, const double* y, int n){
+	double acc[kernelLanes]={0,0,0,0};
+	int c=0;
+	for (;c+kernelLanes<=n;c+=kernelLanes){for (int l=0;l<kernelLanes;l++){acc[l]+=x[c+l]*y[c+l];}}
+	for (;c<n;c++){acc[0]+=x[c]*y[c];}
+	return (acc[0]+acc[1])+(acc[2]+acc[3]);
+}
+
+vector<vector<vector<double> > > frequencyMatrix::distances(vector<int> metrics, int p, int numThreads){
+	bool want[4]={false,false,false,false};
+	for (int m : metrics){if ((m>=0) and (m<4)){want[m]=true;}}
+	size_t size=((size_t) numPreps)*numClasses;
+
+	//transformed copies of the matrix, so that no logarithms or square roots are computed in the pair loops
+	vector<double> logs;
+	if (want[1]){
+		logs.resize(size);
+		for (size_t i=0;i<size;i++){logs[i]=(freqs[i]>0)?log(freqs[i]):0;}
+	}
+	vector<double> roots;
+	if (want[3]){
+		roots.resize(size);
+		for (size_t i=0;i<size;i++){roots[i]=sqrt(freqs[i]);}
+	}
+	vector<double> ent;
+	if (want[2]){ent=entropies();}
+
+	//Tiles: blocks of prepBlock preparations by classBlock classes. Each task handles a pair of preparation blocks 
+	//over one stripe of the classes, and accumulates into its own copy of the matrices. Stripes are only used when 
+	//there are fewer pairs of blocks than threads.
+	const int prepBlock=16;
+	const int classBlock=2048;
+	int numBlocks=(numPreps+prepBlock-1)/prepBlock;
+	vector<pair<int,int> > blockPairs;
+	for (int a=0;a<numBlocks;a++){for (int b=a;b<numBlocks;b++){blockPairs.push_back(make_pair(a,b));}}
+	if (numThreads<=0){numThreads=max(1,(int) thread::hardware_concurrency());}
+	int numStripes=1;
+	if (blockPairs.size()<numThreads){numStripes=max(1,min((int) (numThreads/blockPairs.size()),numClasses/classBlock));}
+
+	size_t matrixSize=((size_t) numPreps)*numPreps;
+	vector<double> partial(numStripes*4*matrixSize,0.0);
+
+	parallelFor(blockPairs.size()*numStripes,[&](int t){
+		int a=blockPairs[t/numStripes].first;
+		int b=blockPairs[t/numStripes].second;
+		int stripe=t%numStripes;
+		int begin=((long) numClasses)*stripe/numStripes;
+		int end=((long) numClasses)*(stripe+1)/numStripes;
+		double* acc=partial.data()+stripe*4*matrixSize;
+		for (int c0=begin;c0<end;c0+=classBlock){
+			int n=min(classBlock,end-c0);
+			for (int j=a*prepBlock;j<min(numPreps,(a+1)*prepBlock);j++){
+				for (int k=max(j+1,b*prepBlock);k<min(numPreps,(b+1)*prepBlock);k++){
+					const double* x=row(j)+c0;
+					const double* y=row(k)+c0;
+					size_t jk=((size_t) j)*numPreps+k;
+					size_t kj=((size_t) k)*numPreps+j;
+					if (want[0]){acc[jk]+=lpKernel(x,y,n,p);}
+					if (want[1]){
+						const double* lx=logs.data()+((size_t) j)*numClasses+c0;
+						const double* ly=logs.data()+((size_t) k)*numClasses+c0;
+						klKernel(x,y,lx,ly,n,acc[matrixSize+jk],acc[matrixSize+kj]);
+					}
+					if (want[2]){acc[2*matrixSize+jk]+=mixtureKernel(x,y,n);}
+					if (want[3]){
+						const double* rx=roots.data()+((size_t) j)*numClasses+c0;
+						const double* ry=roots.data()+((size_t) k)*numClasses+c0;
+						acc[3*matrixSize+jk]+=dotKernel(rx,ry,n);
+					}
+				}
 			}
-			fs<<endl;
 		}
+	},numThreads);
+
+	for (int s=1;s<numStripes;s++){
+		for (size_t i=0;i<4*matrixSize;i++){partial[i]+=partial[s*4*matrixSize+i];}
+	}
+
+	vector<vector<vector<double> > > toReturn={};
+	for (int m : metrics){
+		vector<vector<double> > dists(numPreps,vector<double>(numPreps,0.0));
+		const double* acc=partial.data()+m*matrixSize;
+		for (int j=0;j<numPreps;j++){for (int k=j+1;k<numPreps;k++){
+			double value=acc[((size_t) j)*numPreps+k];
+			if (m==0){value=pow(value,1.0/p);}
+			else if (m==2){value=max(0.0,-value-0.5*(ent[j]+ent[k]));} //H(m)-(H(x)+H(y))/2, where value=-H(m)
+			else if (m==3){value=sqrt(max(0.0,1.0-value));}
+			dists[j][k]=value;
+			dists[k][j]=(m==1)?acc[((size_t) k)*numPreps+j]:value;
+		}}
+		toReturn.push_back(dists);
+	}
+	return toReturn;
+}
+
+void saveMatrix(vector<vector<double> >& matrix, string filename, bool binary){
+	if (binary){
+		ofstream fs(filename,ios::binary);
+		int64_t rows=matrix.size();
+		int64_t cols=(rows>0)?matrix[0].size():0;
+		fs.write((const char*) &rows,sizeof(rows));
+		fs.write((const char*) &cols,sizeof(cols));
+		for (int j=0;j<rows;j++){fs.write((const char*) matrix[j].data(),sizeof(double)*cols);}
 		fs.close();
+		return;
 	}
-	
-	return dists;
+	ofstream fs(filename);
+	for (int j=0;j<matrix.size();j++){
+		for (int k=0;k<matrix[j].size();k++){
+			fs<<matrix[j][k]<<" ";
+		}
+		fs<<endl;
+	}
+	fs.close();
 }
 
-vector<vector<double> > empiricalDistribution::KLDivergence(string filename){
-	if (numPreps==1){cout<<"ONLY ONE PREPARATION - CANNOT COMPUTE KL DIVERGENCES"<<endl;}
-	filename=filename+"_KL.txt";
+vector<vector<vector<double> > > empiricalDistribution::distances(vector<int> metrics, int p, string filename, bool binary){
+	STATS_TIMER(STATS_OUTPUT);
+	frequencyMatrix matrix(this);
+	vector<vector<vector<double> > > toReturn=matrix.distances(metrics,p);
+	if (filename!=""){
+		vector<string> suffixes={"_L"+to_string(p),"_KL","_JS","_hellinger"};
+		for (int i=0;i<metrics.size();i++){
+			saveMatrix(toReturn[i],filename+suffixes[metrics[i]]+(binary?".bin":".txt"),binary);
+		}
+	}
+	return toReturn;
+}
+
+int counterRNG::poisson(double lambda){
+	if (lambda<=0){return 0;}
+	if (lambda<10){
+		double u=uniform();
+		int k=0;
+		double prob=exp(-lambda);
+		double cdf=prob;
+		while ((u>cdf) and (k<1000)){
+			k++;
+			prob*=lambda/k;
+			cdf+=prob;
+		}
+		return k;
+	}
+	double slam=sqrt(lambda);
+	double loglam=log(lambda);
+	double b=0.931+2.53*slam;
+	double a=-0.059+0.02483*b;
+	double invalpha=1.1239+1.1328/(b-3.4);
+	double vr=0.9277-3.6224/(b-2);
+	while (true){
+		double U=uniform()-0.5;
+		double V=uniform();
+		double us=0.5-fabs(U);
+		long k=(long) floor((2*a/us+b)*U+lambda+0.43);
+		if ((us>=0.07) and (V<=vr)){return k;}
+		if ((k<0) or ((us<0.013) and (V>us))){continue;}
+		if (log(V)+log(invalpha)-log(a/(us*us)+b)<=-lambda+k*loglam-lgamma(k+1.0)){return k;}
+	}
+}
+
+//percentile interval and standard error from the values of a statistic over the replicates
+static confidenceInterval summarize(double estimate, vector<double>& values, double confidence){
+	confidenceInterval interval;
+	interval.estimate=estimate;
+	int n=values.size();
+	double mean=0;
+	for (int i=0;i<n;i++){mean+=values[i];}
+	mean/=n;
+	double var=0;
+	for (int i=0;i<n;i++){var+=(values[i]-mean)*(values[i]-mean);}
+	interval.standardError=(n>1)?sqrt(var/(n-1)):0;
+	sort(values.begin(),values.end());
+	double alpha=(1-confidence)/2;
+	interval.lower=values[min(n-1,max(0,(int) floor(alpha*n)))];
+	interval.upper=values[min(n-1,max(0,(int) ceil((1-alpha)*n)-1))];
+	return interval;
+}
+
+bootstrapIntervals empiricalDistribution::bootstrap(vector<int> metrics, int p, int replicates, double confidence, unsigned long seed, string filename, int numThreads){
+	bootstrapIntervals toReturn;
+	toReturn.metrics=metrics;
+	if (replicates<=0){return toReturn;}
+
 	vector<eClass*> eVect=this->convertToVector();
-	vector<vector<double> > div(numPreps,vector<double>(numPreps,0.0));
-	for (int i=0;i<eVect.size();i++){
-		eClass* curClass=eVect[i];
-		for (int j=0;j<numPreps;j++){for (int k=j+1;k<numPreps;k++){
-			double p=curClass->freqs[j];
-			double q=curClass->freqs[k];
-			if ((p!=0) and (q!=0)){//Ignore these cases to get reasonable data!
-				div[j][k]+=p*log(p/q);
-				div[k][j]+=q*log(q/p);
+	sort(eVect.begin(),eVect.end(),[](const eClass* e1, const eClass* e2){return e1->id<e2->id;});
+	int numC=eVect.size();
+	vector<int> counts(((size_t) numPreps)*numC,0); //one row per preparation, as in frequencyMatrix
+	for (int j=0;j<numPreps;j++){for (int c=0;c<numC;c++){
+		if (j<eVect[c]->counts.size()){counts[((size_t) j)*numC+c]=eVect[c]->counts[j];}
+	}}
 
+	frequencyMatrix original(this);
+	vector<vector<vector<double> > > estimates=original.distances(metrics,p,numThreads);
+	vector<double> entropies=original.entropies();
+
+	//values[b*numStats+i] is statistic i of replicate b, with the distances first and the entropies last
+	int matrixSize=numPreps*numPreps;
+	int numStats=metrics.size()*matrixSize+numPreps;
+	vector<double> values(((size_t) replicates)*numStats,0.0);
+
+	//Each task handles a contiguous group of replicates and reuses one matrix of frequencies.
+	if (numThreads<=0){numThreads=max(1,(int) thread::hardware_concurrency());}
+	int numTasks=min(replicates,4*numThreads);
+	parallelFor(numTasks,[&](int t){
+		frequencyMatrix sample(numC,numPreps);
+		for (int b=((long) replicates)*t/numTasks;b<((long) replicates)*(t+1)/numTasks;b++){
+			for (int j=0;j<numPreps;j++){
+				counterRNG rng(seed,((uint64_t) b)*numPreps+j);
+				const int* curCounts=counts.data()+((size_t) j)*numC;
+				double* curRow=sample.freqs.data()+((size_t) j)*numC;
+				double total=0;
+				for (int c=0;c<numC;c++){
+					curRow[c]=(curCounts[c]>0)?rng.poisson(curCounts[c]):0;
+					total+=curRow[c];
+				}
+				if (total>0){for (int c=0;c<numC;c++){curRow[c]/=total;}}
 			}
+			double* curValues=values.data()+((size_t) b)*numStats;
+			vector<vector<vector<double> > > dists=sample.distances(metrics,p,1);
+			for (int m=0;m<metrics.size();m++){for (int j=0;j<numPreps;j++){for (int k=0;k<numPreps;k++){
+				curValues[m*matrixSize+j*numPreps+k]=dists[m][j][k];
+			}}}
+			vector<double> ent=sample.entropies();
+			for (int j=0;j<numPreps;j++){curValues[metrics.size()*matrixSize+j]=ent[j];}
+		}
+	},numThreads);
+
+	vector<double> curValues(replicates);
+	for (int m=0;m<metrics.size();m++){
+		vector<vector<confidenceInterval> > intervals(numPreps,vector<confidenceInterval>(numPreps));
+		for (int j=0;j<numPreps;j++){for (int k=0;k<numPreps;k++){
+			for (int b=0;b<replicates;b++){curValues[b]=values[((size_t) b)*numStats+m*matrixSize+j*numPreps+k];}
+			intervals[j][k]=summarize(estimates[m][j][k],curValues,confidence);
 		}}
+		toReturn.distances.push_back(intervals);
 	}
+	for (int j=0;j<numPreps;j++){
+		for (int b=0;b<replicates;b++){curValues[b]=values[((size_t) b)*numStats+metrics.size()*matrixSize+j];}
+		toReturn.entropies.push_back(summarize(entropies[j],curValues,confidence));
+	}
+
 	if (filename!=""){
-		filename=filename+".txt";
-		ofstream fs(filename);
+		ofstream fs(filename+"_bootstrap.txt");
+		fs<<"Bootstrap with "<<replicates<<" replicates, "<<100*confidence<<"% confidence intervals"<<endl;
+		fs<<"statistic preparations estimate lower upper standardError"<<endl;
+		vector<string> names={"L"+to_string(p),"KL","JS","hellinger"};
+		for (int m=0;m<metrics.size();m++){for (int j=0;j<numPreps;j++){for (int k=0;k<numPreps;k++){
+			if (j==k){continue;}
+			if ((metrics[m]!=1) and (k<j)){continue;} //only the KL divergence is not symmetric
+			confidenceInterval& curInterval=toReturn.distances[m][j][k];
+			fs<<names[metrics[m]]<<" "<<j<<" "<<k<<" "<<curInterval.estimate<<" "<<curInterval.lower<<" "<<curInterval.upper<<" "<<curInterval.standardError<<endl;
+		}}}
 		for (int j=0;j<numPreps;j++){
-			for (int k=0;k<numPreps;k++){
-				fs<<div[j][k]<<" ";
-			}
-			fs<<endl;
+			confidenceInterval& curInterval=toReturn.entropies[j];
+			fs<<"entropy "<<j<<" "<<curInterval.estimate<<" "<<curInterval.lower<<" "<<curInterval.upper<<" "<<curInterval.standardError<<endl;
 		}
 		fs.close();
 	}
-	return div;
+	return toReturn;
+}
+
+vector<vector<double> > empiricalDistribution::LNorm(int p, string filename){
+	if (numPreps==1){cout<<"ONLY ONE PREPARATION - CANNOT COMPUTE L NORM"<<endl;}
+	return distances({0},p,filename)[0];
+}
+
+vector<vector<double> > empiricalDistribution::KLDivergence(string filename){
+	if (numPreps==1){cout<<"ONLY ONE PREPARATION - CANNOT COMPUTE KL DIVERGENCES"<<endl;}
+	return distances({1},1,filename)[0];
+}
+
+vector<vector<double> > empiricalDistribution::JSDivergence(string filename){
+	if (numPreps==1){cout<<"ONLY ONE PREPARATION - CANNOT COMPUTE JS DIVERGENCES"<<endl;}
+	return distances({2},1,filename)[0];
+}
+
+vector<vector<double> > empiricalDistribution::hellingerDistance(string filename){
+	if (numPreps==1){cout<<"ONLY ONE PREPARATION - CANNOT COMPUTE HELLINGER DISTANCES"<<endl;}
+	return distances({3},1,filename)[0];
 }
 
 
 vector<double> empiricalDistribution::shannonEntropy(string filename){
-	vector<eClass*> eVect=this->convertToVector();
-	vector<double> ent(numPreps,0.0);
-	for (int i=0;i<eVect.size();i++){for (int j=0;j<numPreps;j++){
-		if (eVect[i]->counts[j]!=0){
-			ent[j]+= -(eVect[i]->freqs[j])*log(eVect[i]->freqs[j]);
-		}
-	}}
+	frequencyMatrix matrix(this);
+	vector<double> ent=matrix.entropies();
 	if (filename!=""){
 		filename=filename+"_shannonEntropy_unrescaled.txt";
 		ofstream fs(filename);
@@ -537,3 +3133,248 @@ vector<double> empiricalDistribution::shannonEntropy(string filename){
 	return ent;
 
 }
+
+
+//data of a class relative to the data of its parent (see refinementNode::delta)
+static vector<int> encodeDelta(const vector<vector<int> >& data, const vector<vector<int> >& parentData){
+	vector<int> delta={(int) data.size()};
+	for (int i=0;i<data.size();i++){
+		int prefix=0;
+		if (i<parentData.size()){
+			int length=min(data[i].size(),parentData[i].size());
+			while ((prefix<length) and (data[i][prefix]==parentData[i][prefix])){prefix++;}
+			if ((prefix==data[i].size()) and (prefix==parentData[i].size())){//unchanged row
+				delta.push_back(-1);
+				continue;
+			}
+		}
+		delta.push_back(prefix);
+		delta.push_back(data[i].size()-prefix);
+		delta.insert(delta.end(),data[i].begin()+prefix,data[i].end());
+	}
+	return delta;
+}
+
+static vector<vector<int> > decodeDelta(const vector<int>& delta, const vector<vector<int> >& parentData){
+	vector<vector<int> > data(delta[0]);
+	int pos=1;
+	for (int i=0;i<data.size();i++){
+		if (delta[pos]<0){
+			data[i]=parentData[i];
+			pos++;
+			continue;
+		}
+		int prefix=delta[pos];
+		int rest=delta[pos+1];
+		pos+=2;
+		if (prefix>0){data[i].assign(parentData[i].begin(),parentData[i].begin()+prefix);}
+		data[i].insert(data[i].end(),delta.begin()+pos,delta.begin()+pos+rest);
+		pos+=rest;
+	}
+	return data;
+}
+
+refinementTrie::refinementTrie(int type1, int maxR1, int selection1):type(type1),maxR(maxR1),selection(selection1),pattern(defaultPattern(selection1)),numPreps(0),numRoots({}),maxExamples(-1),refinementRounds(-1),levels(maxR1+1),storedBytes(0),fullBytes(0),index(maxR1+1),mobius(maxR1+1){
+	levels[0].push_back(new refinementNode(0,0,0,NULL));
+	if (type==1){for (int k=1;k<=maxR;k++){mobius[k]=computeMobius(k);}}
+}
+
+refinementTrie::~refinementTrie(){
+	for (int k=0;k<levels.size();k++){for (int i=0;i<levels[k].size();i++){delete levels[k][i];}}
+}
+
+refinementNode* refinementTrie::addRoot(refinementNode* parent, const vector<vector<int> >& parentData, eClass* curClass, int dataPrep, int example){
+	int k=curClass->r;
+	vector<int> delta=encodeDelta(curClass->data,parentData);
+	uint64_t hash=counterRNG::mix(curClass->fingerprint^(parent->id*0x9e3779b97f4a7c15ULL));
+	vector<refinementNode*>& curCompare=index[k][hash];
+	refinementNode* node=NULL;
+	STATS_COUNT(probes,1);
+	for (int j=0;j<curCompare.size();j++){
+		if ((curCompare[j]->parent==parent) and (curCompare[j]->fingerprint==curClass->fingerprint) and (curCompare[j]->delta==delta)){
+			node=curCompare[j];
+			break;
+		}
+		STATS_COUNT(collisions,1);
+	}
+	if (node==NULL){//new equivalence class
+		node=new refinementNode(k,levels[k].size(),curClass->fingerprint,parent);
+		node->delta=delta;
+		node->counts.assign(numPreps,0);
+		node->examples.resize(numPreps);
+		levels[k].push_back(node);
+		parent->children.push_back(node);
+		curCompare.push_back(node);
+		storedBytes+=sizeof(vector<int>)+sizeof(int)*delta.size();
+		fullBytes+=sizeof(vector<vector<int> >)+sizeof(vector<int>)*curClass->data.size();
+		for (int i=0;i<curClass->data.size();i++){fullBytes+=sizeof(int)*curClass->data[i].size();}
+	}
+	delete curClass;
+
+	node->counts[dataPrep]++;
+	if ((maxExamples<0) or (node->examples[dataPrep].size()<maxExamples)){node->examples[dataPrep].push_back(example);}
+	return node;
+}
+
+void refinementTrie::computeDistribution(network* curGraph, vector<int> indices){
+	int dataPrep=curGraph->dataPrep;
+	if (dataPrep>=numPreps){
+		numPreps=dataPrep+1;
+		numRoots.resize(numPreps,0);
+		for (int k=0;k<levels.size();k++){for (int i=0;i<levels[k].size();i++){
+			levels[k][i]->counts.resize(numPreps,0);
+			levels[k][i]->examples.resize(numPreps);
+		}}
+	}
+
+	//candidate roots, as in empiricalDistribution::computeDistribution
+	if (selection!=-3){for (int i=0;i<curGraph->vertices.size();i++){
+		if ((pattern.rootColor<0) or (curGraph->vertices[i]->color==pattern.rootColor)){indices.push_back(i);}
+	}}
+	else if (curGraph->originalIndex.size()>0){
+		vector<int> position(curGraph->vertices.size());
+		for (int i=0;i<position.size();i++){position[curGraph->originalIndex[i]]=i;}
+		for (int i1=0;i1<indices.size();i1++){indices[i1]=position[indices[i1]];}
+		sort(indices.begin(),indices.end());
+	}
+
+	rootedGraph rGraph;
+	vector<int> selected={};
+	for (int i1=0;i1<indices.size();i1++){
+		if (rGraph.build(curGraph->vertices[indices[i1]],maxR,&pattern)){selected.push_back(indices[i1]);}
+		rGraph.clear();
+	}
+
+	//Primitive ring profiles are computed globally for each radius.
+	vector<vector<vector<int> > > ringProfiles={};
+	if (type==2){
+		vector<vector<int> > references=curGraph->computeReferences(curGraph->vertices[0]);
+		ringProfiles.resize(maxR+1,vector<vector<int> >(selected.size()));
+		for (int k=1;k<=maxR;k++){
+			STATS_TIMER(STATS_CLASSIFY_2);
+			curGraph->computePrimitiveRingsGlobal(k,selected,references);
+			for (int i1=0;i1<selected.size();i1++){ringProfiles[k][i1]=curGraph->vertices[selected[i1]]->primitiveRingProfile;}
+		}
+	}
+
+	//Each root descends the trie from radius 1 to maxR, and its rooted graph grows by one shell at each radius. Only 
+	//the data of its class at the previous radius is kept.
+	vector<vector<int> > previousData={};
+	for (int i1=0;i1<selected.size();i1++){
+		vertex* root=curGraph->vertices[selected[i1]];
+		refinementNode* node=levels[0][0];
+		previousData={};
+		for (int k=1;k<=maxR;k++){
+			STATS_START(ball);
+			if (k==1){rGraph.build(root,1);}
+			else {rGraph.extend();}
+			STATS_STOP(ball,STATS_BALL);
+			STATS_START(classify);
+			eClass* curClass;
+			if (type==0){curClass=rGraph.canonicalForm();}
+			else if (type==1){curClass=rGraph.H1Barcode(mobius[k]);}
+			else if (type==2){curClass=new eClass(2,k,{ringProfiles[k][i1]});}
+			else if (type==3){curClass=rGraph.valenceProfile();}
+			else if (type==5){curClass=rGraph.colorRefinement(refinementRounds);}
+			else {curClass=rGraph.shellCount();}
+			STATS_STOP(classify,STATS_CLASSIFY_0+type);
+
+			vector<vector<int> > curData=curClass->data;
+			STATS_START(probe);
+			node=addRoot(node,previousData,curClass,dataPrep,curGraph->fileIndex(selected[i1]));
+			STATS_STOP(probe,STATS_PROBE);
+			previousData.swap(curData);
+		}
+		rGraph.clear();
+		levels[0][0]->counts[dataPrep]++;
+	}
+	numRoots[dataPrep]+=selected.size();
+	if (selected.size()==0){cout<<"WARNING: NO ROOT VERTICES SELECTED"<<endl;}
+}
+
+vector<vector<int> > refinementTrie::data(refinementNode* node){
+	vector<refinementNode*> path={};
+	for (refinementNode* cur=node;cur->parent!=NULL;cur=cur->parent){path.push_back(cur);}
+	vector<vector<int> > curData={};
+	for (int i=path.size()-1;i>=0;i--){curData=decodeDelta(path[i]->delta,curData);}
+	return curData;
+}
+
+refinementNode* refinementTrie::find(eClass* curClass){
+	if ((curClass->type!=type) or (curClass->r<1) or (curClass->r>maxR)){return NULL;}
+	vector<refinementNode*>& level=levels[curClass->r];
+	for (int i=0;i<level.size();i++){
+		if ((level[i]->fingerprint==curClass->fingerprint) and (data(level[i])==curClass->data)){return level[i];}
+	}
+	return NULL;
+}
+
+empiricalDistribution* refinementTrie::distribution(int k){
+	empiricalDistribution* cloth=new empiricalDistribution(type,k,selection);
+	cloth->pattern=pattern;
+	cloth->numPreps=numPreps;
+	cloth->numRoots=numRoots;
+	cloth->maxExamples=maxExamples;
+	if ((k<1) or (k>maxR)){return cloth;}
+
+	//The data of the nodes is decoded one radius at a time, from the data of their parents.
+	vector<vector<vector<int> > > parentData(1);
+	for (int k1=1;k1<=k;k1++){
+		vector<vector<vector<int> > > curData(levels[k1].size());
+		for (int i=0;i<levels[k1].size();i++){
+			refinementNode* node=levels[k1][i];
+			curData[i]=decodeDelta(node->delta,parentData[node->parent->id]);
+		}
+		parentData.swap(curData);
+	}
+
+	for (int i=0;i<levels[k].size();i++){
+		refinementNode* node=levels[k][i];
+		eClass* curClass=new eClass(type,k,parentData[i]);
+		parentData[i]={};
+		vector<eClass*>& curCompare=cloth->distr[curClass->key];
+		eClass* storedClass=NULL;
+		for (int j=0;j<curCompare.size();j++){
+			if (*curCompare[j]==*curClass){
+				storedClass=curCompare[j];
+				delete curClass;
+				break;
+			}
+		}
+		if (storedClass==NULL){
+			storedClass=curClass;
+			storedClass->resize(numPreps);
+			storedClass->id=cloth->numClasses++;
+			curCompare.push_back(storedClass);
+		}
+		for (int j=0;j<numPreps;j++){
+			storedClass->counts[j]+=node->counts[j];
+			vector<int>& curExamples=storedClass->examples[j];
+			curExamples.insert(curExamples.end(),node->examples[j].begin(),node->examples[j].end());
+			if ((maxExamples>=0) and (curExamples.size()>maxExamples)){curExamples.resize(maxExamples);}
+		}
+	}
+	for (pair<const int,vector<eClass*> >& elt : cloth->distr){for (int i=0;i<elt.second.size();i++){
+		eClass* curClass=elt.second[i];
+		for (int j=0;j<numPreps;j++){curClass->freqs[j]=(numRoots[j]>0)?((double) curClass->counts[j])/numRoots[j]:0;}
+	}}
+	return cloth;
+}
+
+void refinementTrie::saveRefinements(string filename){
+	STATS_TIMER(STATS_OUTPUT);
+	ofstream fs(filename+"_refinements.txt");
+	fs<<"Type = "<<type<<"  Maximum radius = "<<maxR<<"  Number of Data Preparations = "<<numPreps<<endl;
+	fs<<"Classes by radius:";
+	for (int k=1;k<=maxR;k++){fs<<" "<<levels[k].size();}
+	fs<<endl;
+	fs<<"Bytes of class data: "<<storedBytes<<" (separate distributions: "<<fullBytes<<")"<<endl;
+	fs<<"radius id parentId counts"<<endl;
+	for (int k=1;k<=maxR;k++){for (int i=0;i<levels[k].size();i++){
+		refinementNode* node=levels[k][i];
+		fs<<k<<" "<<node->id<<" "<<((k>1)?node->parent->id:-1);
+		for (int j=0;j<numPreps;j++){fs<<" "<<node->counts[j];}
+		fs<<endl;
+	}}
+	fs.close();
+}
@@ -6,11 +6,12 @@ structure stores global graph data. It loads graphs in the format described in t
 data structure computes the empirical distribution of a network. To do so, first initialize the data structure using
      empiricalDistribution* cloth=new empiricalDistribution(type, radius, selection)wh
 where the type is 
-     0: Graph Isomorphism, 1: H1 Barcode, 2: Primitive Ring Profile, 3: Coordination Profile, 4: Shell Count
+     0: Graph Isomorphism, 1: H1 Barcode, 2: Primitive Ring Profile, 3: Coordination Profile, 4: Shell Count, 5: Color Refinement
 the radius is the radius of the local environment, and the selection determines which vertices are used to compute the
 empirical distribution: i>=0: all vertices with color=i used as roots, -1: all vertices used as roots; -2: option for
 selecting perfectly coordinated environments in silica (assumes silicons are color 0). -3: use custom choice by using
-the optional "indices" arguent in computeDistribution. Then, for each input data file load a network using
+the optional "indices" arguent in computeDistribution. More general valence and color patterns may be imposed on the
+local environments of the roots by modifying cloth->pattern (see selectionPattern in RootedGraph.h). Then, for each input data file load a network using
      network* newGraph=new network("myFile")
 and compute the empirical distribution using
      cloth->computeDistribution(network* curGraph, std::vector<int> indices={}).
@@ -46,6 +47,12 @@ Please see the readme and RootedGraph.h for additional documentation, and Exampl
 #include <unordered_map>
 #include <vector>
 #include <string>
+#include <iostream>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
 #include "RootedGraph.h"
 
 struct network
@@ -54,29 +61,296 @@ struct network
 
 	std::vector<vertex*> vertices;
 
+	std::vector<int> originalIndex;
+	//If the vertices have been reordered, originalIndex[i] is the index in the input file(s) of the vertex stored at
+	//position i. Empty if the vertices are in the order of the input file(s).
+
+	int fileIndex(int i){return (originalIndex.size()>0)?originalIndex[i]:i;} //Index in the input file(s) of vertex i.
+
 	void load(std::string filename); //Loads data from the format described in the readme.
 
+	bool load(std::istream& file, std::string filename="");
+	//Loads one graph in the format described in the readme from a stream containing several graphs, leaving the 
+	//stream at the following line. Returns false if the stream contains no further graph.
+
 	void loadRodney(std::string filename);
 
+	void load(int numVerts, const int64_t* offsets, const int32_t* adjacency, const int32_t* colors=NULL, int dataPrep1=0);
+	//Loads a graph held in memory in compressed sparse row format: the neighbors of vertex i are adjacency[offsets[i]],
+	//...,adjacency[offsets[i+1]-1], and its color is colors[i] (0 if colors is NULL). The adjacency must be symmetric. 
+	//Replaces the graph held by the network. If the network already has numVerts vertices, they are reused and only 
+	//their neighbors and colors are replaced, so that a graph whose bonds change (for example, every few hundred steps
+	//of a simulation) is reloaded without allocating vertices. See SwatchesAPI.h for a C interface.
+
+	std::vector<std::string> species;
+	void loadCoordinates(std::string filename, std::vector<std::vector<double> > cutoffs, int dataPrep1=0, int numThreads=0);
+	//Builds the network from the first frame of an XYZ file (including extended XYZ, whose Lattice, pbc and Properties
+	//keys are used) or a LAMMPS dump file (detected by its "ITEM:" lines, with orthogonal or triclinic boxes and 
+	//unscaled, scaled or unwrapped coordinates). Each atom is a vertex, whose color is the position of its species 
+	//(the element, or the atom type of a dump file without an element column) in species; species that are not in 
+	//species are appended in the order they are found, so the colors may be fixed by setting species first. Two atoms 
+	//of colors a and b are adjacent if their distance is at most cutoffs[a][b] (a single value applies to all pairs),
+	//with the minimum image convention in periodic directions. Uses a cell list, so the time is linear in the number 
+	//of atoms, and numThreads threads (0: one per hardware thread). The vertices of a dump file are ordered by atom id.
+
 	network(std::string filename):vertices({}){load(filename);};
 	
 	network():vertices({}){};
 
 
+	std::vector<eClass*> rootClasses;
+	//rootClasses[i] is the equivalence class of the local environment of vertex i in the last empirical distribution
+	//computed for this network, or NULL if vertex i was not used as a root. Used to update the distribution when edges
+	//are added or removed. Only valid while that empirical distribution exists.
+
+	std::vector<bool> rootCandidates;
+	//rootCandidates[i] is true if vertex i was one of the roots considered by the last empirical distribution computed
+	//for this network, whether or not its local environment satisfied the selection pattern (in the sampling mode, only
+	//the candidates that were sampled before it stopped). Only these vertices are reclassified when the distribution is
+	//updated.
+
+	std::vector<int> changedVertices; //endpoints of edges added or removed since the distribution was last updated
+
+	void addEdge(int i, int j);
+	void removeEdge(int i, int j);
+	//Adds or removes the edge between vertices[i] and vertices[j] (the indices are positions in vertices, which are the
+	//indices in the input file unless the network has been reordered), and records the endpoints in changedVertices.
+	//Call empiricalDistribution::updateDistribution to reclassify the affected roots.
+
+	void reorder(int method, int blockSize=1024);
+	//Renumbers the vertices to improve memory locality, so that vertices that are close in the graph are close in 
+	//memory. Methods: 0: breadth-first order, 1: reverse Cuthill-McKee, 2: recursive bisection of breadth-first level
+	//structures into blocks of at most blockSize vertices (for very large graphs). Each connected component is ordered
+	//separately. The vertices are reallocated in the new order and the index of each vertex in the input file is kept
+	//in originalIndex, so that examples in empirical distributions still refer to the input files. Roots are then
+	//processed in the new order: the equivalence classes and their counts do not change, but the order in which the
+	//classes and their examples are found does.
+
+	network* contract(int bridgeColor, std::vector<int>* position=NULL);
+	//Returns a new network in which every bridge, a vertex of color bridgeColor with two distinct neighbors of other 
+	//colors (for example, a bridging oxygen between two silicons), is replaced by an edge between its neighbors. Two
+	//vertices joined by several bridges are joined by as many edges. The other vertices (including non-bridging or 
+	//over-coordinated vertices of color bridgeColor) are kept, in the same order, with originalIndex referring to the
+	//input file, and vertex::bridged is set for those whose neighbors were all bridges. Valences are unchanged. If 
+	//position is not NULL, it is set to the position in the new network of each vertex of this one (-1 for bridges).
+	//See empiricalDistribution::contraction.
+
 	//Computes distances from three well-spaced vertices to the rest of the graph. Used in the primitive ring computation.	
 	std::vector<std::vector<int> > computeReferences(vertex* v1);
 
 	//avoids redundancy in primitive ring computation, stores primitive ring profile at each vertex
-	void computePrimitiveRingsGlobal(int r, std::vector<int> indices,std::vector<std::vector<int> > refs);
+	void computePrimitiveRingsGlobal(int r, std::vector<int> indices,std::vector<std::vector<int> > refs, int maxBallSize=0, int maxCandidates=0, std::vector<std::pair<int,int> >* overBudget=NULL);
+	//The profiles of any previous computation are replaced. Each ring is only checked from the root of smallest index
+	//it contains, so indices must be in increasing order. If maxBallSize>0 (maxCandidates>0), the candidate rings of 
+	//roots whose balls have more than maxBallSize vertices (that have more than maxCandidates candidate rings) are not
+	//checked, and the positions of these roots in indices are appended to overBudget with the reason (0: ball size, 
+	//1: candidate rings). Their rings are then checked from the other roots they contain, so that the profiles of the 
+	//other roots are complete, while their own profiles may miss some rings.
 
 	~network(); 
 };
 	
 
 
+//Header of the binary distribution format (see distributionFile). All offsets are in bytes from the start of the file,
+//and every section starts at a multiple of 8 bytes. Integers are stored in the byte order of the machine that wrote 
+//the file, which is checked using byteOrder.
+struct distributionHeader{
+	char magic[8]; //"SWATCHES"
+	int32_t version;
+	int32_t byteOrder; //0x01020304
+	int32_t type;
+	int32_t r;
+	int32_t selection;
+	int32_t numPreps;
+	int64_t numClasses;
+	int64_t numRootsOffset; //int64_t numRoots[numPreps]
+	int64_t classesOffset; //distributionFile::classRecord classes[numClasses]
+	int64_t payloadOffset; //int32_t arena holding the data of all equivalence classes
+	int64_t countsOffset; //int32_t counts[numPreps][numClasses], one row per preparation
+	int64_t exampleOffsetsOffset; //int64_t exampleOffsets[numClasses*numPreps+1]
+	int64_t examplesOffset; //int32_t examples[exampleOffsets[numClasses*numPreps]]
+	int64_t fileSize;
+};
+
+//Read-only view of an empirical distribution saved in the binary format by empiricalDistribution::saveData_toBinary.
+//The file is mapped into memory and its sections are used in place, without parsing: the count matrix and the 
+//example lists can be read directly, and the data of an equivalence class is only decoded when requested.
+struct distributionFile{
+	static const int version=1;
+
+	struct classRecord{
+		int64_t payload; //position in the payload arena (in int32_t entries) of the data of the class
+		int32_t key;
+		int32_t numVectors;
+		//The data consists of numVectors vector lengths followed by the entries of the vectors.
+	};
+
+	const distributionHeader* header;
+	const int64_t* numRoots;
+	const classRecord* classes;
+	const int32_t* payload;
+	const int32_t* counts;
+	const int64_t* exampleOffsets;
+	const int32_t* examples;
+
+	bool open(std::string filename); //Maps a file into memory. Returns false if it is not a valid binary distribution.
+	void close();
+
+	int numClasses(){return header->numClasses;}
+	int numPreps(){return header->numPreps;}
+	int count(int c, int p){return counts[((int64_t) p)*header->numClasses+c];}
+	const int32_t* countRow(int p){return counts+((int64_t) p)*header->numClasses;} //counts of all classes in preparation p
+
+	const int32_t* examplesBegin(int c, int p){return examples+exampleOffsets[((int64_t) c)*header->numPreps+p];}
+	int numExamples(int c, int p){int64_t i=((int64_t) c)*header->numPreps+p; return exampleOffsets[i+1]-exampleOffsets[i];}
+
+	std::vector<std::vector<int> > data(int c); //Decodes the data of equivalence class c.
+
+	static bool isBinary(std::string filename); //checks the magic string at the start of a file
+
+	size_t size(){return length;} //size of the mapped file, which may contain data after header->fileSize
+
+	distributionFile():header(NULL),base(NULL),length(0){};
+	~distributionFile(){close();}
+
+	private:
+	void* base;
+	size_t length;
+};
+
+
+//A bootstrap confidence interval for a statistic.
+struct confidenceInterval{
+	double estimate; //value of the statistic for the data
+	double lower;
+	double upper; //percentile interval
+	double standardError; //standard deviation of the bootstrap replicates
+};
+
+struct bootstrapIntervals{
+	std::vector<int> metrics;
+	std::vector<std::vector<std::vector<confidenceInterval> > > distances; //distances[m][j][k]: metrics[m] between preparations j and k
+	std::vector<confidenceInterval> entropies; //Shannon entropy of each preparation
+};
+
+
+//Bounded-memory summary of the equivalence classes of an empirical distribution, used in the approximate mode of 
+//empiricalDistribution (see setApproximate) when there are too many equivalence classes to store. Classes are 
+//identified by eClass::fingerprint.
+//  Space-Saving: at most capacity equivalence classes are stored (in the dictionary of the empirical distribution). 
+//      When a new class arrives and the summary is full, the stored class with the smallest total count is replaced,
+//      and the new class inherits that count as its error. Every class occurring more than numRoots/capacity times 
+//      in total is stored, and the count of a stored class in each preparation is between counts[j] and 
+//      counts[j]+error.
+//  Count-Min: for each preparation, an upper bound on the count of any class, which exceeds the true count by at 
+//      most epsilon*numRoots with probability at least 1-delta.
+//  HyperLogLog: for each preparation, estimates of the number of distinct classes, and of the number of classes 
+//      seen at least twice (according to the Count-Min sketch), whose difference estimates the number of singletons.
+struct classSketch{
+	int capacity;
+	int depth;
+	int width; //the Count-Min sketch of each preparation has depth rows of width counters
+	double epsilon;
+	double delta;
+	int precision; //the HyperLogLog sketches have 2^precision registers
+
+	std::vector<eClass*> slots; //slots[id] is the stored class with eClass::id=id
+	std::vector<long> totals; //total count over all preparations of the class in each slot, including its error
+	std::vector<long> errors; //count inherited by the class in each slot when it replaced another class
+	std::vector<int> heap; //slots in a min-heap ordered by total
+	std::vector<int> heapPos; //position of each slot in the heap
+
+	std::vector<std::vector<uint32_t> > countMin; //countMin[j][row*width+column]
+	std::vector<std::vector<uint8_t> > distinct; //registers of the classes of preparation j
+	std::vector<std::vector<uint8_t> > repeated; //registers of the classes of preparation j seen at least twice
+
+	void resize(int numPreps);
+	void observe(uint64_t fingerprint, int dataPrep); //Updates the Count-Min and HyperLogLog sketches with one root.
+	long countMinEstimate(uint64_t fingerprint, int dataPrep);
+	double cardinality(const std::vector<uint8_t>& registers); //HyperLogLog estimate with the small range correction
+
+	bool full(){return slots.size()>=capacity;}
+	void insert(eClass* curClass, long total, long error); //Stores a class in a new slot, or in the slot of the last evicted class.
+	eClass* evict(); //Removes the stored class with the smallest total from the summary, and returns it.
+	void increment(eClass* storedClass); //Adds a root to the total of a stored class.
+
+	classSketch(int capacity1, double epsilon1=0.0001, double delta1=0.01, int precision1=12);
+
+	private:
+	int freeSlot;
+	void siftUp(int i);
+	void siftDown(int i);
+	void swapHeap(int i, int k);
+};
+
+
+//Append-only store on disk that assigns stable integer ids to the equivalence classes of one type and radius, so that
+//the same class has the same id in every run that uses the catalog. The file starts with a header ("SWCATLOG", 
+//version, byte order, type and radius, as int32_t) followed by one record per class in the order of the ids: the 
+//fingerprint (uint64_t), the number of rows of the data, and each row as its length followed by its entries 
+//(int32_t). The whole catalog is held in memory, indexed by fingerprint, so that ids are found in constant time. A 
+//record that was only partly written (for example, if a run was killed) is removed when the catalog is opened. Not 
+//synchronized: a catalog must only be used by one thread and one process at a time.
+struct classCatalog{
+	std::string filename;
+	int type;
+	int r;
+	bool valid; //false if the file could not be opened or belongs to a different type or radius
+
+	std::vector<std::vector<std::vector<int> > > payloads; //payloads[id]: the data of class id
+	std::vector<uint64_t> fingerprints;
+	std::unordered_map<uint64_t,std::vector<int> > index; //ids of the classes with each fingerprint
+
+	int size(){return payloads.size();}
+	int lookup(eClass* curClass); //Returns the id of the class, or -1 if it is not in the catalog.
+	int insert(eClass* curClass); //Returns the id of the class, appending it to the catalog if it is new.
+	eClass* getClass(int id); //A new equivalence class with the data of class id.
+	void flush(); //Writes the appended classes to disk.
+
+	classCatalog(std::string filename1, int type1, int r1); //Opens the catalog, creating the file if needed.
+	~classCatalog();
+
+	private:
+	std::ofstream* file;
+};
+
+
+//Summary of a computation in the sampling mode of empiricalDistribution (see tolerance).
+struct samplingSummary{
+	int dataPrep;
+	long candidates; //number of candidate roots
+	long rootsUsed; //number of roots classified before the computation stopped
+	int batches;
+	double lastChange; //change between the last two batches
+	bool converged; //false if all candidates were used before the change fell below the tolerance
+	double entropy; //Shannon entropy of the preparation after the last batch
+	double entropyStandardError; //standard error of the entropy, by the delta method
+	double l1Error; //estimated expected l1 distance between the sampled distribution and the distribution of all roots
+};
+
+//Summary of the roots of one computeDistribution call that exceeded the per-root budget of empiricalDistribution (see
+//maxBallSize).
+struct budgetSummary{
+	int dataPrep;
+	long roots; //number of selected roots
+	long overBallSize;
+	long overCandidateRings;
+	long overNautyTime;
+	long skipped;
+	long fellBack; //classified with the fallback type
+	long deferred; //classified after the other roots
+	std::vector<std::pair<int,int> > affected; //index in the input file and reason (0: ball, 1: rings, 2: nauty) of each root
+};
+
+
+//The selection pattern corresponding to a value of the selection parameter (see empiricalDistribution).
+selectionPattern defaultPattern(int selection);
+
+
 struct empiricalDistribution{
 	int type;  
-        // 0: Graph Isomorphism, 1: H1 Barcode, 2: Primitive Ring Profile, 3: Coordination Profile, 4: Shell Count
+        // 0: Graph Isomorphism, 1: H1 Barcode, 2: Primitive Ring Profile, 3: Coordination Profile, 4: Shell Count, 5: Color Refinement
 
 	int r; //radius
 
@@ -85,12 +359,23 @@ struct empiricalDistribution{
         //perfectly coordinated environments in silica (assumes silicons are color 0). -3: use custom choice by using
         //the optional "indices" arguent in computeDistribution.
 
+	selectionPattern pattern;
+        //The predicate applied to each candidate root while its rooted graph is built. It is set from the selection
+        //(the root color for i>=0, the repeated valence pattern {4,2} for -2), and may be modified to select roots by
+        //arbitrary valence and color patterns. See selectionPattern in RootedGraph.h.
+
 	int numPreps;
         //Allows for data from different sources to be compared. See eClass in RootedGraph.h for information on how the
         //data is stored.
 
 	std::vector<int> numRoots;//stores the number of atomic environments for each preparation
 
+	int numClasses; //number of equivalence classes in the distribution. Used to assign eClass::id.
+
+	int maxExamples; 
+        //maximum number of examples stored for each equivalence class and preparation. The default, -1, stores the 
+        //indices of all roots.
+
 	std::vector<std::vector<std::vector<std::vector<int> > > > mobius; //Mobius function. Used for H1 barcode. 
 
 	std::unordered_map<int,std::vector<eClass*> > distr;
@@ -99,20 +384,178 @@ struct empiricalDistribution{
 	
 	//Standard initializer. For example, empiricalDistribution(0,5,-1) initializes an empiricalDistribution data structure to compute the
         //probability distribution of graph isomorphism classes at radius 5 centered at all vertices of a graph. 
-	empiricalDistribution(int type1, int r1, int selection1=0):numPreps(0),type(type1),r(r1),selection(selection1),distr({}),numRoots({}){
+	empiricalDistribution(int type1, int r1, int selection1=0):numPreps(0),type(type1),r(r1),selection(selection1),pattern(defaultPattern(selection1)),distr({}),numRoots({}),numClasses(0),maxExamples(-1),sketch(NULL),memoryBudget(0),spillDirectory("."),memoryUsed(0),tolerance(0),batchSize(1000),convergenceMetric(0),samplingSeed(0),checkpointFile(""),checkpointInterval(600),fileCursor(0),resumeCursor(0),catalog(NULL),refinementRounds(-1),verifiedRoots(0),verification({}),rootBegin(0),rootEnd(-1),maxBallSize(0),maxCandidateRings(0),maxNautyTime(0),budgetPolicy(0),fallbackType(5),fallback(NULL),contraction(-1),contractedRoots(0),checkpointWriter(NULL),checkpointBusy(new std::atomic<bool>(false)),lastCheckpoint(currentTime()){
 		if (type==1){mobius=computeMobius(r);}
 	}
 
-	//void merge(empiricalDistribution* other, bool samePreparations=true); Add later.
+	void merge(empiricalDistribution* other, bool samePreparations=true, bool takeClasses=false);
 	//Adds data from another empirical distribution. The empirical distributions must have the same radius and type
         //(but not necessarily the same selection). If samePreparations=true, uses the same numbering for data
-        //preparations. If not, assumes all data preparations are new.
+        //preparations. If not, assumes all data preparations are new (preparation j of other becomes preparation 
+        //numPreps+j). Equivalence classes are matched by looking up their keys in the dictionary. If 
+        //takeClasses=true, equivalence classes not previously detected are moved from other instead of being copied,
+        //and other is left empty.
 
-	//void merge(std::string filename, bool samePreparations=true); Add later.
+	void merge(std::string filename, bool samePreparations=true);
 	//Same as the previous, but loads the other empirical distribution from file.
 
-
-	empiricalDistribution(std::string filename); //Initialize by reloading a saved .dat file in the output format described in readme.txt.
+	classSketch* sketch; //NULL unless the approximate mode is used (see setApproximate)
+
+	void setApproximate(int capacity, double epsilon=0.0001, double delta=0.01);
+	//Switches to the approximate mode, which stores at most capacity equivalence classes and summarizes the rest with
+	//the sketches described in classSketch, so that memory does not grow with the number of roots. Must be called 
+	//before the first computeDistribution. The counts of the stored classes are lower bounds (see classSketch for 
+	//the error bounds), numRoots is exact, and at most maxExamples examples are stored per class (10 if maxExamples 
+	//was not set). Updating or removing roots and merging are not available in this mode.
+
+	void saveSketchReport(std::string filename);
+	//Saves filename_sketch.txt, which gives for each preparation the number of roots, the error bounds of the 
+	//sketches, estimates of the number of distinct equivalence classes and singletons, and an estimate of the Shannon
+	//entropy, followed by the stored classes with their counts and upper bounds.
+
+	long memoryBudget;
+	//Approximate number of bytes the dictionary may use (0: no limit). When the dictionary exceeds the budget during
+	//computeDistribution, its equivalence classes are sorted by fingerprint and written to a run file in 
+	//spillDirectory, and the dictionary is emptied. saveData_toLoad then merges the runs with the classes in memory
+	//and writes the .dat file directly (through a temporary file in spillDirectory, to restore the order of the
+	//classes), with the same content as without a budget. Once data has been spilled, the
+	//dictionary only contains the classes detected since the last spill, so the other analyses should be computed on
+	//the reloaded .dat file. Roots cannot be updated or removed when a budget is set.
+
+	std::string spillDirectory;
+	std::vector<std::string> runs; //run files written so far, in order
+	long memoryUsed; //estimated size of the dictionary in bytes
+
+	void spill(); //Writes the dictionary to a new run file and empties it.
+
+	double tolerance;
+	int batchSize;
+	int convergenceMetric;
+	unsigned long samplingSeed;
+	//Sampling mode, used if tolerance>0. computeDistribution then processes the selected roots in a random order 
+	//(determined by samplingSeed), in batches of batchSize roots. After each batch, the distribution of the 
+	//preparation is compared with the distribution after the previous batch, and the computation stops once the 
+	//change is below the tolerance. convergenceMetric 0: l1 distance between the two distributions, 1: absolute 
+	//difference of their Shannon entropies. The selection applies as usual, and only roots that satisfy it are 
+	//counted in batches.
+
+	std::vector<samplingSummary> samplingSummaries; //one for each call of computeDistribution in the sampling mode
+
+	void saveSamplingReport(std::string filename); //Saves the sampling summaries to filename_sampling.txt.
+
+	std::string checkpointFile;
+	double checkpointInterval;
+	//If checkpointFile is not empty, computeDistribution saves the state of the computation to it every 
+	//checkpointInterval seconds, so that an interrupted computation can be continued with resume. A checkpoint is the
+	//distribution in the binary format (see saveData_toBinary), including the roots of the current input file 
+	//classified so far, followed by fileCursor and the position of the next candidate root of the current file. The 
+	//state is copied to memory in the classification loop, and written to disk by a background thread (a new 
+	//checkpoint is skipped while the previous one is being written). Not available in the approximate, memory 
+	//budget, or sampling modes.
+
+	int fileCursor; //index of the input file being processed, set by the caller and saved in checkpoints
+	int resumeCursor; //position in the list of candidate roots at which the next computeDistribution starts
+
+	void checkpoint(int rootCursor, int dataPrep=-1, long pendingRoots=0, bool force=false);
+	//Saves a checkpoint if checkpointInterval seconds have passed since the last one (or if force=true). rootCursor 
+	//is the position of the next candidate root in the current input file, and pendingRoots roots of preparation 
+	//dataPrep have been classified but not yet added to numRoots.
+
+	bool resume(std::string filename);
+	//Restores the state saved in a checkpoint into an empty distribution, and sets fileCursor and resumeCursor, so 
+	//that the computation can continue with input file fileCursor. Returns false if the file is not a checkpoint. 
+	//The final results are identical to those of an uninterrupted computation with the same options.
+
+	void finishCheckpoints(); //waits until the last checkpoint has been written
+
+	classCatalog* catalog;
+	//If not NULL, every new equivalence class is given the id of its class in the catalog (eClass::globalId), adding 
+	//it to the catalog if needed. The catalog must have the same type and radius. See saveData_toIds.
+
+	void saveData_toIds(std::string filename);
+	//Saves filename+".ids": the header of the .dat format (type, radius, selection, number of preparations, and the 
+	//number of roots of each preparation), followed by one line per equivalence class with its catalog id and its 
+	//counts in each preparation. Classes are identified only by their ids, so the file is small and distributions of 
+	//different runs can be joined by comparing integers. Examples are not saved. Requires a catalog.
+
+	empiricalDistribution(std::string filename, classCatalog* catalog1);
+	//Initialize by reloading a file saved by saveData_toIds, with the data of the classes taken from the catalog.
+
+	int refinementRounds;
+	//Number of rounds of color refinement for type 5 (see rootedGraph::colorRefinement in RootedGraph.h). The default,
+	//-1, refines until the coloring is stable.
+
+	long verifiedRoots;
+	std::unordered_map<uint64_t,std::unordered_map<uint64_t,long> > verification;
+	//For each color refinement class (by fingerprint) of the roots sampled by verifyRefinement, the number of those 
+	//roots in each graph isomorphism class (by fingerprint).
+
+	void verifyRefinement(network* curGraph, int sampleSize, unsigned long seed=0);
+	//Checks how well color refinement (type 5) separates graph isomorphism classes: computes both the color 
+	//refinement class and the canonical form (type 0) of sampleSize roots of curGraph chosen uniformly at random 
+	//among the roots satisfying the selection, and adds them to verification. The sample depends only on the seed and
+	//on the number of roots verified so far.
+
+	void saveVerificationReport(std::string filename);
+	//Saves filename+"_verify.txt": the numbers of sampled roots, of color refinement and graph isomorphism classes
+	//among them, of color refinement classes that contain several graph isomorphism classes, and of sampled roots in 
+	//those classes, followed by one line "fingerprint roots isomorphismClasses" for each such class.
+
+	int rootBegin;
+	int rootEnd;
+	//Only vertices whose indices in the input file are in [rootBegin,rootEnd) are used as roots (rootEnd=-1 places no
+	//upper limit). Allows a large computation to be divided into jobs whose distributions are combined with merge.
+
+	int maxBallSize;
+	int maxCandidateRings;
+	double maxNautyTime;
+	//Per-root budget (0: no limit), so that a few pathological roots do not dominate the running time: the number of
+	//vertices of the ball, the number of candidate rings checked from the root (type 2), and the time in seconds 
+	//spent by nauty on the root (type 0, see rootedGraph::canonicalForm). A root is over the budget as soon as one of
+	//these is exceeded, and is then handled according to budgetPolicy:
+	//  0: skipped. It is not counted in numRoots, so the frequencies are those of the roots within the budget.
+	//  1: classified with the cheaper type fallbackType (1, 3, 4 or 5) and added to the distribution fallback, which
+	//     has the same radius and selection.
+	//  2: deferred. The balls of the roots over the budget are copied (see rootedGraph::copyBall) and classified 
+	//     without limits after the other roots of the network, in parallel, and then added in their original order. 
+	//     As nauty is not reentrant, the canonical forms (type 0) are still computed one at a time. For type 2, the 
+	//     rings of deferred roots are checked after those of the other roots, and the roots are classified in their
+	//     usual order. When checkpoints are saved, deferred roots are classified immediately instead.
+	//For type 2, the primitive ring profiles of the roots within the budget are complete with every policy (see 
+	//network::computePrimitiveRingsGlobal). Roots skipped or classified with the fallback type are removed from
+	//network::rootCandidates, so they are not reclassified by updateDistribution. The roots over the budget are 
+	//counted in budgetSummaries.
+
+	int budgetPolicy;
+	int fallbackType;
+	empiricalDistribution* fallback; //created by the first root that falls back, and deleted by the destructor
+	std::vector<budgetSummary> budgetSummaries; //one for each call of computeDistribution with a budget
+
+	void saveBudgetReport(std::string filename);
+	//Saves filename_budget.txt: for each call of computeDistribution with a budget, the numbers of selected roots, of
+	//roots over each part of the budget, and of roots skipped, classified with the fallback type, or deferred, 
+	//followed by the list of the roots over the budget with their reasons.
+
+	int contraction;
+	//Contracted mode, used if contraction>=0 (for example, 1 for the oxygens of silica loaded with loadRodney): each 
+	//network is contracted with network::contract(contraction), and a root whose local environment of radius r 
+	//consists of vertices whose neighbors are all bridges (up to distance r-2) is classified on the contracted network
+	//at radius r/2, which has about a third of the vertices and half the shells. The results are those of the original
+	//network: the selection pattern is applied to the shells of the original local environment, shell counts, 
+	//coordination profiles and H1 barcodes are identical, and graph isomorphism classes and color refinement classes
+	//are computed on the contracted local environments, which are isomorphic if and only if the original ones are. The
+	//other roots (for example, near non-bridging or over-coordinated vertices of color contraction, or vertices of that
+	//color themselves) are classified on the original network as usual. Requires an even radius and a type other than
+	//2, and is not available with the inline dictionaries, deferred roots, or updateDistribution.
+
+	long contractedRoots; //number of roots classified on contracted networks
+
+
+	empiricalDistribution(std::string filename);
+	//Initialize by reloading a saved file, either a .dat file in the output format described in readme.txt or a file
+	//in the binary format (see saveData_toBinary), which is detected automatically.
+
+	void loadBinary(distributionFile& file); //Initialize from a mapped binary distribution.
 
 	~empiricalDistribution(); //Deletes all equivalence classes as well.
 
@@ -120,6 +563,46 @@ struct empiricalDistribution{
 	//Computes the empirical probability distribution. Use the "indices" option to specify a subset of indices at 
         //which to compute local environments.
 
+	void updateDistribution(network* curGraph);
+	//Updates the distribution after edges of curGraph have been added or removed with network::addEdge and 
+	//network::removeEdge, for a network that was previously passed to computeDistribution. Only the roots within 
+	//distance r of an endpoint of a changed edge (2r for primitive ring profiles) are reclassified: each is removed 
+	//from its previous equivalence class and added to its new one, and roots whose local environments start or stop
+	//satisfying the selection pattern are added or removed. The cost is proportional to the number of affected roots. 
+	//Only the vertices considered as roots by computeDistribution are reclassified (see network::rootCandidates), and
+	//roots that stay in the same equivalence class are left as they are, so an update that changes no class leaves the
+	//distribution unchanged. Equivalence classes whose counts drop to zero are kept.
+
+	eClass* classify(rootedGraph& rGraph);
+	//Computes the equivalence class of a rooted graph. For type 2, the primitive ring profile of the root must have
+	//been computed by network::computePrimitiveRingsGlobal.
+
+	eClass* addRoot(eClass* curClass, int dataPrep, int example);
+	//Adds a root in the given equivalence class to the counts and examples of preparation dataPrep. If the class was
+	//previously detected, curClass is deleted. Returns the equivalence class stored in the distribution.
+
+	void removeRoot(eClass* storedClass, int dataPrep, int example);
+	//Removes a root from the counts and examples of an equivalence class stored in the distribution.
+
+	void removeNetwork(network* curGraph);
+	//Removes the roots of a network that was previously passed to computeDistribution from the distribution.
+
+	void computeTrajectory(std::string filename, std::string outname);
+	//Classifies the frames of a trajectory one at a time, using this distribution as a dictionary of equivalence 
+	//classes shared by all frames. The file contains a sequence of frames. A frame is either a graph in the input 
+	//format described in the readme (which replaces the previous frame), or a list of changes to the previous frame:
+	//a line "d k" followed by k lines of the form "+ i j" or "- i j", which add or remove the edge between the 
+	//vertices with indices i and j. Only the current frame is held in memory, and its roots are removed from the 
+	//counts of the distribution before the next frame is classified, so that memory does not grow with the number of
+	//frames (examples are not stored). Saves the following files:
+	//  outname_trajectory.txt: one line per frame, "frame numRoots id:count id:count ...", where id is the index 
+	//      (eClass::id) of an equivalence class and count the number of roots in it.
+	//  outname_transitions.txt: for each pair of consecutive frames with the same vertices, the number of roots that
+	//      changed equivalence class, followed by the total number of roots that moved from class i to class j over
+	//      the whole trajectory for each pair of classes "i j count".
+	//  outname_classes.txt: the equivalence classes in the dictionary, with the total number of roots in each over
+	//      all frames.
+
 	void computePrimitiveRingDistribution_faster(network* curGraph, int dataPrep=0, std::vector<int> indices={});
 	//Faster method to compute primitive ring profiles: computes all primitive rings globally, then distributes to
         //each root. 
@@ -130,7 +613,15 @@ struct empiricalDistribution{
 
 	void load(std::string filename);//Loads from file in the format described in the readme.
 
-	void saveData_toLoad(std::string filename); //Saves the data to filename.dat in the format described in the readme.
+	void saveData_toLoad(std::string filename);
+	//Saves the data to filename.dat in the format described in the readme. If data has been spilled to disk (see 
+	//memoryBudget), the runs are merged into the file and deleted.
+
+	void saveData_toBinary(std::string filename);
+	void saveData_toBinary(std::ostream& fs);
+	//Saves the data to filename.bdat (or to a binary stream) in the binary format described by distributionHeader,
+	//which can be reloaded with the usual initializer or read in place with distributionFile. The equivalence classes
+	//are stored in the order of their ids.
 
 	void saveData_toView(std::string filename);
 	//Saves the data to filename.txt in an easily interpretable format. Prints the 10 highest ranked equivalence 
@@ -138,6 +629,21 @@ struct empiricalDistribution{
         //preparation j) for all i,j. 
 
 
+	std::vector<std::vector<std::vector<double> > > distances(std::vector<int> metrics, int p=1, std::string filename="", bool binary=false);
+	//Computes the distances between the empirical distributions of all pairs of preparations for several metrics 
+	//(see frequencyMatrix::distances) in a single pass over the data. If the filename option is used, saves each
+	//matrix in "filename_L"+p, "filename_KL", "filename_JS" or "filename_hellinger", followed by ".txt", or by ".bin"
+	//if binary=true (see saveMatrix).
+
+	bootstrapIntervals bootstrap(std::vector<int> metrics, int p=1, int replicates=1000, double confidence=0.95, unsigned long seed=0, std::string filename="", int numThreads=0);
+	//Computes bootstrap confidence intervals for the distances between preparations (for the metrics of 
+	//frequencyMatrix::distances) and for the Shannon entropies. Each replicate resamples the roots of every 
+	//preparation with the Poisson bootstrap: the count of each equivalence class is replaced by a Poisson random 
+	//variable with the same mean, and the frequencies are renormalized. The random numbers are generated by a 
+	//counter-based generator (see counterRNG), so the results depend only on the seed, and not on the number of
+	//threads. Requires memory for one matrix of frequencies per thread and for the statistics of all replicates. If 
+	//the filename option is used, saves the intervals in "filename_bootstrap.txt".
+
 	std::vector<std::vector<double> > LNorm(int p=1,std::string filename="");
 	//Computes the lp distance between the empirical distributions for each preparation. If the filename option is 
         //used, saves the distances in "filename_L"+p+".txt".
@@ -146,13 +652,197 @@ struct empiricalDistribution{
 	//Computes the KL divergence between the empirical distributions for each preparation, under the assumption 
 	//that the true distributions are absolutely continuous. If the filename option is used, saves the data in 
 	//"filename_KL.txt".
+
+	std::vector<std::vector<double> > JSDivergence(std::string filename="");
+	//Computes the Jensen-Shannon divergence between the empirical distributions for each preparation. If the 
+	//filename option is used, saves the data in "filename_JS.txt".
+
+	std::vector<std::vector<double> > hellingerDistance(std::string filename="");
+	//Computes the Hellinger distance between the empirical distributions for each preparation. If the filename 
+	//option is used, saves the data in "filename_hellinger.txt".
        
 	std::vector<double> shannonEntropy(std::string filename="");
 	//Computes the (unrescaled) Shannon entropy of the empirical distributions. If the filename option is used,
         //saves the data in "filename_shannonEntropy_unresscaled.txt".
 
+	private:
+	void addPreparation(int dataPrep); //resizes the data structures if dataPrep has not been seen previously
+	void updateFrequencies(int dataPrep);
+
+	eClass* overBudget(rootedGraph& rGraph, network* curGraph, int i, int reason, budgetSummary& budget, std::vector<int>* deferredRoots);
+	//Handles vertex i of curGraph, whose rooted graph is over the budget, according to budgetPolicy. Returns the 
+	//equivalence class stored in this distribution if the root is classified immediately, and NULL otherwise. Deferred
+	//roots are appended to deferredRoots if it is not NULL, and classified immediately if it is.
+
+	void classifyDeferred(network* curGraph, std::vector<int>& deferredRoots);
+
+	std::thread* checkpointWriter;
+	std::atomic<bool>* checkpointBusy;
+	double lastCheckpoint; //time of the last checkpoint, in seconds
+
+	static double currentTime(); //seconds on a monotonic clock
+
+};
+
+
+//A node of a refinementTrie: an equivalence class at radius r, whose children are the equivalence classes at radius
+//r+1 of the roots in this class.
+struct refinementNode{
+	int r;
+	int id; //index of the node in refinementTrie::levels[r]
+	uint64_t fingerprint; //eClass::fingerprint of the data of the class
+	refinementNode* parent;
+	std::vector<int> delta;
+	//The data of the class relative to the data of its parent, so that the part shared with the parent is not stored
+	//again: the number of rows, then for each row either -1 if it equals the same row of the parent, or the length of 
+	//the prefix it shares with that row, the number of remaining entries, and those entries. Use refinementTrie::data
+	//to recover the data.
+	std::vector<refinementNode*> children;
+	std::vector<long> counts; //number of roots of each preparation in the class
+	std::vector<std::vector<int> > examples;
+
+	refinementNode(int r1, int id1, uint64_t fingerprint1, refinementNode* parent1):r(r1),id(id1),fingerprint(fingerprint1),parent(parent1),delta({}),children({}),counts({}),examples({}){};
+};
+
+
+//Multi-resolution empirical distribution: the equivalence classes of every radius from 1 to maxR, arranged as a trie in
+//which the children of a class at radius k are the classes at radius k+1 of its roots. Each root is classified once 
+//at every radius, in a single pass over the roots. Since the data of a class usually extends the data of its parent
+//(the shell counts and coordination profiles of the first k shells are unchanged at radius k+1, and so are most rows 
+//of an H1 barcode), only the difference is stored, and the distribution at every radius and the refinements of every 
+//class are available without recomputation, in much less memory than one empiricalDistribution per radius. 
+//Selection as in empiricalDistribution; a root is used at every radius if its rooted graph of radius maxR satisfies 
+//the selection pattern.
+struct refinementTrie{
+	int type;
+	int maxR;
+	int selection;
+	selectionPattern pattern;
+	int numPreps;
+	std::vector<int> numRoots;
+	int maxExamples; //maximum number of examples stored for each node and preparation (-1: no limit)
+	int refinementRounds; //see empiricalDistribution
+
+	std::vector<std::vector<refinementNode*> > levels;
+	//levels[k]: the nodes of radius k, in the order they were detected. levels[0] holds a single node, with no data, 
+	//whose children are the classes at radius 1.
+
+	long storedBytes; //memory used by the deltas of all nodes
+	long fullBytes; //memory used by the data of all nodes, as stored by separate distributions
+
+	void computeDistribution(network* curGraph, std::vector<int> indices={});
+	//Adds the roots of curGraph to the trie (see empiricalDistribution::computeDistribution).
+
+	std::vector<std::vector<int> > data(refinementNode* node); //The data of the class of a node (see eClass).
+
+	refinementNode* find(eClass* curClass);
+	//The node of an equivalence class of radius at most maxR computed by the same type, or NULL if no root is in it. 
+	//Its children give the classes it splits into at the next radius.
+
+	empiricalDistribution* distribution(int k);
+	//A new empirical distribution with the classes of radius k. Equivalence classes have the ids of their nodes, 
+	//except that nodes with the same data under different parents (which is only possible for types whose class at 
+	//radius k+1 does not determine the class at radius k, such as primitive ring profiles) are combined.
+
+	void saveRefinements(std::string filename);
+	//Saves filename+"_refinements.txt", with one line "radius id parentId counts..." for each node, so that the 
+	//splitting of each class at the next radius can be read off by matching ids.
+
+	refinementTrie(int type1, int maxR1, int selection1=0);
+	~refinementTrie();
+
+	private:
+	std::vector<std::unordered_map<uint64_t,std::vector<refinementNode*> > > index;
+	//index[k]: the nodes of radius k by a hash of their fingerprint and the id of their parent
+	std::vector<std::vector<std::vector<std::vector<std::vector<int> > > > > mobius; //Mobius function for each radius (H1 barcode)
+
+	refinementNode* addRoot(refinementNode* parent, const std::vector<std::vector<int> >& parentData, eClass* curClass, int dataPrep, int example);
+	//Adds a root to the child of parent with the data of curClass, creating it if needed, and deletes curClass.
+};
+
+
+//Dense matrix of the frequencies of the equivalence classes of an empirical distribution, stored one row per 
+//preparation, used to compute distances between the empirical distributions of many preparations. The rows are 
+//processed in tiles of preparations and equivalence classes so that the data in use stays in the cache, and the
+//tiles are distributed among threads.
+struct frequencyMatrix{
+	int numClasses;
+	int numPreps;
+	std::vector<double> freqs; //freqs[p*numClasses+c] is the frequency of equivalence class c in preparation p
+
+	const double* row(int p){return freqs.data()+((size_t) p)*numClasses;}
+
+	std::vector<std::vector<std::vector<double> > > distances(std::vector<int> metrics, int p=1, int numThreads=0);
+	//Computes the matrices of distances between all pairs of preparations for each metric in a single pass. 
+	//Metrics: 0: lp distance, 1: KL divergence (ignoring classes that do not occur in both preparations), 
+	//2: Jensen-Shannon divergence, 3: Hellinger distance.
+
+	std::vector<double> entropies(); //(unrescaled) Shannon entropy of each preparation
+
+	frequencyMatrix(int numClasses1, int numPreps1):numClasses(numClasses1),numPreps(numPreps1),freqs(((size_t) numPreps1)*numClasses1,0.0){};
+	frequencyMatrix(empiricalDistribution* distribution); //The columns are the equivalence classes in the order of their ids.
+	frequencyMatrix(distributionFile& file); //Reads the counts of a mapped binary distribution directly.
+};
+
+//Counter-based random number generator: the i-th number of a stream is a hash of the seed, the stream and i, so that 
+//streams can be generated independently of each other, in any order and on any thread.
+struct counterRNG{
+	uint64_t key;
+	uint64_t counter;
+
+	static uint64_t mix(uint64_t x){ //the splitmix64 finalizer
+		x=(x^(x>>30))*0xbf58476d1ce4e5b9ULL;
+		x=(x^(x>>27))*0x94d049bb133111ebULL;
+		return x^(x>>31);
+	}
+
+	uint64_t next(){return mix(key+(++counter)*0x9e3779b97f4a7c15ULL);}
+	double uniform(){return (next()>>11)*(1.0/9007199254740992.0);} //uniform in [0,1)
+	int poisson(double lambda); //inversion for small means, and the PTRS method of Hormann (1993) for large means
+
+	counterRNG(uint64_t seed, uint64_t stream):key(mix(seed^mix(stream+0x632be59bd9b4e019ULL))),counter(0){};
+};
+
+void saveMatrix(std::vector<std::vector<double> >& matrix, std::string filename, bool binary=false);
+//Saves a matrix as text, one row per line, or if binary=true as the number of rows and the number of columns 
+//(int64_t) followed by the entries (double) in row-major order.
+
+void parallelFor(int n, std::function<void(int)> f, int numThreads=0);
+//Calls f(0),...,f(n-1) using numThreads threads (the default, 0, uses one thread per hardware thread). The calls must
+//not share vertices or equivalence classes, as these store local data.
+
+//Ranks the equivalence classes in every preparation and answers top-k queries without sorting all classes. The 
+//classes present in each preparation are ordered by decreasing count with a counting sort (ties are broken by the 
+//order of the classes in the input vector), which also fills eClass::ranks.
+struct classRanking{
+	std::vector<eClass*> classes;
+	std::vector<std::vector<int> > order;
+	//order[j] lists the indices in classes of the equivalence classes with nonzero count in preparation j, from most
+	//to least common
+
+	std::vector<eClass*> topK(int j, int k); //the k most common equivalence classes in preparation j
+
+	std::vector<eClass*> topKDifference(int j, int l, int k);
+	//The k equivalence classes maximizing (frequency in preparation j - frequency in preparation l), in decreasing 
+	//order. Scans the classes in order of decreasing frequency in preparation j, and stops once that frequency is 
+	//below the k-th largest difference found, since no later class can exceed it.
+
+	classRanking(std::vector<eClass*> eVect);
+	//Computes the orders and sets ranks[j] of each class to the number of classes that are strictly more common in
+	//preparation j (so equally common classes have equal ranks, and classes absent from preparation j are ranked 
+	//after all present classes).
 };
 
+template <class Compare>
+std::vector<eClass*> topK(std::vector<eClass*> eVect, int k, Compare comp){
+	//The first k elements of eVect in the order given by a comparator such as rankCompare or differenceCompare,
+	//found with a partial selection instead of a full sort.
+	k=std::min(k,(int) eVect.size());
+	std::nth_element(eVect.begin(),eVect.begin()+k,eVect.end(),comp);
+	std::sort(eVect.begin(),eVect.begin()+k,comp);
+	eVect.resize(k);
+	return eVect;
+}
 
 void saveData_toView_fromVect(std::vector<eClass*> eVect, std::string filename, int n=10, bool defaultSort=true); 
 //Saves the data in an easily interpretable format. If defaultSort=false, prints data from all equivalence classes 
@@ -3,7 +3,7 @@ In this example, we compute the empirical distributions of radius three graph is
 
 To compile, use the following:
 
- g++ Example.cpp Classification.cpp RootedGraph.cpp nauty26r12/nauty.c nauty26r12/nautil.c nauty26r12/schreier.c nauty26r12/naurng.c nauty26r12/nausparse.c -Wno-write-strings -o swatchesExample -std=c++0x -O2
+ g++ Example.cpp Classification.cpp RootedGraph.cpp nauty26r12/nauty.c nauty26r12/nautil.c nauty26r12/schreier.c nauty26r12/naurng.c nauty26r12/nausparse.c -Wno-write-strings -o swatchesExample -std=c++0x -O2 -pthread
 
 */
 
@@ -0,0 +1,344 @@
+/*
+Generates large deterministic test graphs in the input format described in the readme, for scaling tests of the
+classification. The same options and seed always give the same file. Generators (-g):
+  - silica: a periodic 4/2-coordinated network with the topology of beta-cristobalite: silicon atoms on the sites of a
+    diamond lattice of n x n x n primitive cells, and an oxygen atom on each Si-Si bond (6n^3 vertices). With
+    --defects, each oxygen is independently non-bridging (bonded to a single silicon) with the given probability.
+  - regular: a random d-regular graph on n vertices (-d, default 4), sampled with the configuration model. Self-loops
+    and repeated edges are removed by exchanging endpoints with random edges. If one cannot be removed (which can only
+    happen for very dense graphs), no file is written and the exit status is 1.
+  - voronoi: the one-skeleton of the Voronoi diagram of a periodic n x n square lattice whose points are displaced by
+    Gaussian noise with standard deviation --sigma (default 0.1) times the spacing (2n^2 vertices of valence three).
+    Each square of the lattice is split into two Delaunay triangles by an in-circle test, which is exact as long as
+    points do not leave their squares, and the vertices of the Voronoi diagram are the triangles.
+  - cubic: a periodic n x n x n simple cubic lattice (n^3 vertices of valence six).
+With --components k, k disjoint copies of the graph (generated with different seeds) are written to the same file.
+The vertex lines of the lattice generators are computed one at a time, so they use little memory at any size; the
+regular generator stores about 4nd integers.
+
+Options:
+ -g: generator (silica, regular, voronoi or cubic)
+ -n: the number of cells per side (silica, voronoi, cubic) or of vertices (regular)
+ -d: the valence of the regular graph
+ --defects: the rate of non-bridging oxygens of the silica network
+ --sigma: the standard deviation of the noise of the voronoi generator
+ --components: the number of disjoint copies
+ --seed: the seed (default 0)
+ --colors: comma-separated colors. For silica, the colors of silicon and oxygen (default 0,1). Otherwise, each vertex
+           is given one of the colors uniformly at random (default 0).
+ --prep: the data preparation written in the file (default 0)
+ -o: the name of the output file
+
+For example, to write a silica network with 1.5 million vertices and 1% defects:
+
+ ./swatchesGenerate -g silica -n 63 --defects 0.01 -o silica_63.cfg
+
+To compile, use the following:
+
+ g++ Generate.cpp Classification.cpp RootedGraph.cpp nauty26r12/nauty.c nauty26r12/nautil.c nauty26r12/schreier.c nauty26r12/naurng.c nauty26r12/nausparse.c -Wno-write-strings -o swatchesGenerate -std=c++0x -O2 -pthread
+
+*/
+
+
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdio.h>
+#include <stdint.h>
+#include <getopt.h>
+#include "Classification.h"
+
+
+
+using namespace std;
+
+
+
+//streams of the random number generator, so that the noise, the defects, the colors and the edges are independent
+enum {NOISE_STREAM=1,DEFECT_STREAM,COLOR_STREAM,EDGE_STREAM};
+
+struct generator{
+	string name;
+	long n;
+	int d;
+	double defects;
+	double sigma;
+	uint64_t seed;
+	vector<int> colors;
+
+	vector<int> edges; //regular graph: the neighbors of vertex i are edges[d*i],...,edges[d*i+d-1]
+
+	//random numbers indexed by (seed, stream, i), so that they do not depend on the order of the computation
+	double uniform(int stream, long i){return counterRNG(seed*8+stream,i).uniform();}
+	double gaussian(int stream, long i){
+		counterRNG rng(seed*8+stream,i);
+		double u1=1-rng.uniform();
+		double u2=rng.uniform();
+		return sqrt(-2*log(u1))*cos(2*M_PI*u2);
+	}
+
+	long numVertices(){
+		if (name=="silica"){return 6*n*n*n;}
+		if (name=="voronoi"){return 2*n*n;}
+		if (name=="cubic"){return n*n*n;}
+		return n;
+	}
+
+	int color(long i){
+		if (name=="silica"){return colors[(i%6<2)?0:1];}
+		if (colors.size()==1){return colors[0];}
+		return colors[min((long) colors.size()-1,(long) (uniform(COLOR_STREAM,i)*colors.size()))];
+	}
+
+	long wrap(long i){return ((i%n)+n)%n;}
+
+	//silica: cell c=(i*n+j)*n+k, at i*a_1+j*a_2+k*a_3 where a_1, a_2, a_3 are the primitive vectors of the face-centered
+	//cubic lattice, holds silicon A (6c), silicon B (6c+1, displaced by (1/4,1/4,1/4)) and the oxygens on the bonds of A
+	//(6c+2+b). Bond 0 joins A to the B of the same cell, and bond b>0 to the B of the cell c-a_b.
+	long cell(long i, long j, long k){return (wrap(i)*n+wrap(j))*n+wrap(k);}
+	long shift(long c, int b, int sign){ //the cell c+sign*a_b
+		long i=c/(n*n);
+		long j=(c/n)%n;
+		long k=c%n;
+		if (b==1){return cell(i+sign,j,k);}
+		if (b==2){return cell(i,j+sign,k);}
+		if (b==3){return cell(i,j,k+sign);}
+		return c;
+	}
+	bool bridging(long oxygen){return (defects<=0) or (uniform(DEFECT_STREAM,oxygen)>=defects);}
+
+	//voronoi: the lattice point (i,j), displaced by noise
+	void point(long i, long j, double& x, double& y){
+		long p=wrap(i)*n+wrap(j);
+		x=i+sigma*gaussian(NOISE_STREAM,2*p);
+		y=j+sigma*gaussian(NOISE_STREAM,2*p+1);
+	}
+	//true if the square (i,j) is split by the diagonal from (i,j) to (i+1,j+1), false for the other diagonal
+	bool mainDiagonal(long i, long j){
+		double ax,ay,bx,by,cx,cy,dx,dy;
+		point(i,j,ax,ay);
+		point(i+1,j,bx,by);
+		point(i+1,j+1,cx,cy);
+		point(i,j+1,dx,dy);
+		//in-circle test of d with respect to the counterclockwise triangle a, b, c
+		double adx=ax-dx, ady=ay-dy, bdx=bx-dx, bdy=by-dy, cdx=cx-dx, cdy=cy-dy;
+		double det=(adx*adx+ady*ady)*(bdx*cdy-cdx*bdy)-(bdx*bdx+bdy*bdy)*(adx*cdy-cdx*ady)+(cdx*cdx+cdy*cdy)*(adx*bdy-bdx*ady);
+		return (det<=0);
+	}
+	//the triangle (0: lower, 1: upper) of square (i,j) on a side (0: bottom, 1: right, 2: top, 3: left)
+	long triangle(long i, long j, int side){
+		long square=wrap(i)*n+wrap(j);
+		int t=(side==0)?0:((side==2)?1:(((side==1)==mainDiagonal(wrap(i),wrap(j)))?0:1));
+		return 2*square+t;
+	}
+
+	vector<long> neighbors(long v){
+		vector<long> toReturn;
+		if (name=="silica"){
+			long c=v/6;
+			int site=v%6;
+			if (site==0){for (int b=0;b<4;b++){toReturn.push_back(6*c+2+b);}}
+			else if (site==1){for (int b=0;b<4;b++){
+				long oxygen=6*shift(c,b,1)+2+b;
+				if (bridging(oxygen)){toReturn.push_back(oxygen);}
+			}}
+			else {
+				toReturn.push_back(6*c);
+				if (bridging(v)){toReturn.push_back(6*shift(c,site-2,-1)+1);}
+			}
+		}
+		else if (name=="voronoi"){
+			long square=v/2;
+			long i=square/n;
+			long j=square%n;
+			toReturn.push_back(v^1);
+			bool diagonal=mainDiagonal(i,j);
+			bool lower=(v%2==0);
+			if (lower){toReturn.push_back(triangle(i,j-1,2));}
+			else {toReturn.push_back(triangle(i,j+1,0));}
+			if (lower==diagonal){toReturn.push_back(triangle(i+1,j,3));}
+			else {toReturn.push_back(triangle(i-1,j,1));}
+		}
+		else if (name=="cubic"){
+			long i=v/(n*n);
+			long j=(v/n)%n;
+			long k=v%n;
+			for (int sign=-1;sign<=1;sign+=2){
+				toReturn.push_back((wrap(i+sign)*n+j)*n+k);
+				toReturn.push_back((i*n+wrap(j+sign))*n+k);
+				toReturn.push_back((i*n+j)*n+wrap(k+sign));
+			}
+		}
+		else {for (int a=0;a<d;a++){toReturn.push_back(edges[d*v+a]);}}
+		return toReturn;
+	}
+
+	bool hasEdge(long v, long w){
+		for (int a=0;a<d;a++){if (edges[d*v+a]==w){return true;}}
+		return false;
+	}
+	bool buildRegular(){ //false if a self-loop or repeated edge could not be removed
+		long numStubs=n*d;
+		vector<int> stubs(numStubs);
+		for (long a=0;a<numStubs;a++){stubs[a]=a/d;}
+		counterRNG rng(seed*8+EDGE_STREAM,0);
+		for (long a=numStubs-1;a>0;a--){swap(stubs[a],stubs[(long) (rng.uniform()*(a+1))]);}
+		//pair consecutive stubs: the edges of vertex v are filled in order
+		edges.assign(numStubs,-1);
+		vector<int> filled(n,0);
+		vector<long> pairs; //positions in edges of the two endpoints of each edge
+		for (long a=0;a+1<numStubs;a+=2){
+			long v=stubs[a];
+			long w=stubs[a+1];
+			long pv=d*v+filled[v]++;
+			long pw=d*w+filled[w]++;
+			edges[pv]=w;
+			edges[pw]=v;
+			pairs.push_back(pv);
+			pairs.push_back(pw);
+		}
+		//exchange the endpoints of self-loops and repeated edges with those of random edges
+		long numEdges=pairs.size()/2;
+		for (long e=0;e<numEdges;e++){
+			bool repaired=false;
+			for (int attempts=0;attempts<1000;attempts++){
+				long pv=pairs[2*e];
+				long pw=pairs[2*e+1];
+				long v=pv/d;
+				long w=pw/d;
+				bool bad=(v==w);
+				for (int a=0;(a<d) and !bad;a++){bad=(d*v+a!=pv) and (edges[d*v+a]==w);}
+				if (!bad){repaired=true; break;}
+				long f=(long) (rng.uniform()*numEdges);
+				long px=pairs[2*f];
+				long py=pairs[2*f+1];
+				long x=px/d;
+				long y=py/d;
+				//replace the edges v-w and x-y by v-y and x-w
+				if ((f==e) or (v==y) or (x==w) or hasEdge(v,y) or hasEdge(x,w)){continue;}
+				edges[pv]=y;
+				edges[py]=v;
+				edges[px]=w;
+				edges[pw]=x;
+				pairs[2*e+1]=py;
+				pairs[2*f+1]=pw;
+			}
+			if (!repaired){return false;}
+		}
+		return true;
+	}
+
+	void write(ostream& fs, long offset){
+		long numVerts=numVertices();
+		string line;
+		for (long v=0;v<numVerts;v++){
+			line=to_string(color(v));
+			vector<long> toWrite=neighbors(v);
+			for (int a=0;a<toWrite.size();a++){line+=" "+to_string(toWrite[a]+offset);}
+			fs<<line<<"\n";
+		}
+	}
+};
+
+
+
+vector<int> parseInts(string toParse){
+	vector<int> toReturn;
+	stringstream ss(toParse);
+	string substring;
+	while (getline(ss,substring,',')){toReturn.push_back(atoi(substring.c_str()));}
+	return toReturn;
+}
+
+int main(int argc, char** argv) {
+
+	generator gen;
+	gen.name="";
+	gen.n=0;
+	gen.d=4;
+	gen.defects=0;
+	gen.sigma=0.1;
+	gen.seed=0;
+	gen.colors={};
+	int components=1;
+	int dataPrep=0;
+	string outname="";
+
+	enum {DEFECTS=256,SIGMA,COMPONENTS,SEED,COLORS,PREP};
+	static struct option longOptions[]={
+		{"defects",required_argument,0,DEFECTS},
+		{"sigma",required_argument,0,SIGMA},
+		{"components",required_argument,0,COMPONENTS},
+		{"seed",required_argument,0,SEED},
+		{"colors",required_argument,0,COLORS},
+		{"prep",required_argument,0,PREP},
+		{0,0,0,0}
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc,argv,"g:n:d:o:",longOptions,NULL)) != EOF)
+	switch(opt)
+	{
+		case DEFECTS: gen.defects=atof(optarg); break;
+		case SIGMA: gen.sigma=atof(optarg); break;
+		case COMPONENTS: components=atoi(optarg); break;
+		case SEED: gen.seed=strtoul(optarg,NULL,10); break;
+		case COLORS: gen.colors=parseInts(optarg); break;
+		case PREP: dataPrep=atoi(optarg); break;
+		case 'g': gen.name=optarg; break;
+		case 'n': gen.n=atol(optarg); break;
+		case 'd': gen.d=atoi(optarg); break;
+		case 'o': outname=optarg; break;
+		case '?': fprintf(stderr, "Usage is \n -g: for the generator (silica, regular, voronoi or cubic) \n -n: for the number of cells per side, or of vertices of a regular graph \n -d: for the valence of a regular graph \n -o: for the name of the output file \n --defects: for the rate of non-bridging oxygens \n --sigma: for the noise of the voronoi generator \n --components: for the number of disjoint copies \n --seed: for the seed \n --colors: for the colors of the vertices \n --prep: for the data preparation \n Please see the top of Generate.cpp for more details."); return 1;
+	}
+
+	if ((gen.name!="silica") and (gen.name!="regular") and (gen.name!="voronoi") and (gen.name!="cubic")){
+		cout<<"Please choose a generator: silica, regular, voronoi or cubic."<<endl;
+		return 0;
+	}
+	if ((gen.n<=0) or ((gen.name=="regular") and ((gen.d<=0) or (gen.d>=gen.n) or ((gen.n*gen.d)%2!=0)))){
+		cout<<"Please enter a valid size (for regular graphs, n>d and nd even)."<<endl;
+		return 0;
+	}
+	if ((gen.name=="voronoi") and (gen.n<3)){
+		cout<<"Please enter a size of at least 3 for the voronoi generator."<<endl;
+		return 0;
+	}
+	if ((gen.name=="cubic") and (gen.n<3)){ //smaller lattices would have repeated edges or self-loops
+		cout<<"Please enter a size of at least 3 for the cubic generator."<<endl;
+		return 0;
+	}
+	if (outname==""){outname=gen.name+"_"+to_string(gen.n)+".cfg";}
+	if (gen.colors.size()==0){gen.colors=(gen.name=="silica")?vector<int>({0,1}):vector<int>({0});}
+	if ((gen.name=="silica") and (gen.colors.size()<2)){gen.colors.push_back(gen.colors[0]);}
+
+	long numVerts=gen.numVertices();
+	if (numVerts*components>2147483647L){
+		cout<<"Please enter a smaller size: vertex indices must fit in an int."<<endl;
+		return 0;
+	}
+
+	ofstream fs(outname);
+	fs<<numVerts*components<<" "<<dataPrep<<"\n";
+	uint64_t firstSeed=gen.seed;
+	for (int c=0;c<components;c++){
+		gen.seed=firstSeed+c;
+		if ((gen.name=="regular") and !gen.buildRegular()){
+			cout<<"WARNING: COULD NOT REMOVE THE SELF-LOOPS AND REPEATED EDGES OF THE REGULAR GRAPH. NO FILE WAS WRITTEN."<<endl;
+			fs.close();
+			remove(outname.c_str());
+			return 1;
+		}
+		gen.write(fs,numVerts*c);
+	}
+	fs.close();
+
+	cout<<"Wrote "<<numVerts*components<<" vertices to "<<outname<<"."<<endl;
+	return 0;
+}
@@ -0,0 +1,196 @@
+/*
+Dictionaries with fixed-size inline keys for the equivalence types with small data: shell counts (type 4), coordination
+profiles (type 3) and, at small radii, H1 barcodes (type 1). For these types, building an eClass (with its heap-allocated
+data) and probing the generic dictionary of empiricalDistribution costs more than the classification itself. A policy
+computes a key of a fixed length, known at compile time, directly from the arrays of a rootedGraph:
+  - shellCountKey<R>: the number of vertices in each shell,
+  - valenceProfileKey<R>: for each shell, the number of vertices of each valence below maxValence (valence profiles are
+    sorted, so this is the same information; a ball with a larger valence has no key),
+  - H1CountsKey<R>: the upper triangle of the H1 counts of the shell annuli, which determine the H1 barcode by Mobius
+    inversion.
+An inlineDictionary<Policy> maps keys to the equivalence classes stored in an empiricalDistribution, in an open
+addressing table whose slots hold the keys themselves, so that hashing and comparing keys never touch the heap and the
+loops over the entries have constant bounds. It is a cache in front of empiricalDistribution::addRoot: a root whose
+key is found is counted directly, and only the first root of each class is classified in the usual way. The policies
+are instantiated for every radius up to a maximum, and makeInlineDictionary selects one at run time.
+*/
+
+#ifndef INLINEKEYS_H
+#define INLINEKEYS_H
+
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include "RootedGraph.h"
+
+template <int R>
+struct shellCountKey{
+	static constexpr int type=4;
+	static constexpr int size=R+1;
+	static bool compute(rootedGraph& rGraph, int32_t* key){
+		for (int i=0;i<size;i++){key[i]=rGraph.shells[i+1]-rGraph.shells[i];}
+		return true;
+	}
+	static eClass* makeClass(const int32_t* key, const std::vector<std::vector<std::vector<std::vector<int> > > >&){
+		return new eClass(4,R,{std::vector<int>(key,key+size)});
+	}
+};
+
+template <int R>
+struct valenceProfileKey{
+	static constexpr int type=3;
+	static constexpr int maxValence=8;
+	static constexpr int size=(R+1)*maxValence;
+	static bool compute(rootedGraph& rGraph, int32_t* key){
+		memset(key,0,sizeof(int32_t)*size);
+		for (int i=0;i<=R;i++){
+			int32_t* shellKey=key+i*maxValence;
+			for (int j=rGraph.shells[i];j<rGraph.shells[i+1];j++){
+				int valence=rGraph.degrees[j];
+				if (valence>=maxValence){return false;}
+				shellKey[valence]++;
+			}
+		}
+		return true;
+	}
+	static eClass* makeClass(const int32_t* key, const std::vector<std::vector<std::vector<std::vector<int> > > >&){
+		std::vector<std::vector<int> > valences(R+1);
+		for (int i=0;i<=R;i++){for (int valence=0;valence<maxValence;valence++){
+			valences[i].insert(valences[i].end(),key[i*maxValence+valence],valence);
+		}}
+		return new eClass(3,R,valences);
+	}
+};
+
+template <int R>
+struct H1CountsKey{
+	static constexpr int type=1;
+	static constexpr int size=(R+1)*(R+2)/2;
+	static bool compute(rootedGraph& rGraph, int32_t* key){
+		int counts[(R+1)*(R+1)];
+		rGraph.computeH1Counts(counts);
+		int k=0;
+		for (int i=0;i<=R;i++){for (int j=i;j<=R;j++){key[k++]=counts[i*(R+1)+j];}}
+		return true;
+	}
+	static eClass* makeClass(const int32_t* key, const std::vector<std::vector<std::vector<std::vector<int> > > >& mobius){
+		//Mobius inversion, as in rootedGraph::H1Barcode
+		int counts[R+1][R+1];
+		int k=0;
+		for (int i=0;i<=R;i++){for (int j=i;j<=R;j++){counts[i][j]=key[k++];}}
+		std::vector<std::vector<int> > intervals(R+1,std::vector<int>(R+1,0));
+		for (int i=0;i<=R;i++){for (int j=i;j<=R;j++){
+			int temp=0;
+			for (int m=i;m<=j;m++){for (int n=m;n<=j;n++){temp=temp+counts[m][n]*mobius[i][j][m][n];}}
+			intervals[i][j]=temp;
+		}}
+		return new eClass(1,R,intervals);
+	}
+};
+
+
+//Type-erased interface, so that the root loop of empiricalDistribution::computeDistribution is not duplicated for
+//every policy.
+struct inlineCache{
+	bool hasKey; //false if the rooted graph of the last call to find has no key
+
+	//Computes the key of the rooted graph and returns the equivalence class stored with it, or NULL if there is none
+	//(or if the rooted graph has no key).
+	virtual eClass* find(rootedGraph& rGraph)=0;
+	//A new equivalence class for the key of the last call to find, built from the key without recomputation.
+	virtual eClass* makeClass(const std::vector<std::vector<std::vector<std::vector<int> > > >& mobius)=0;
+	virtual void insert(eClass* storedClass)=0; //Stores an equivalence class with the key of the last call to find.
+	virtual ~inlineCache(){};
+};
+
+template <class Policy>
+struct inlineDictionary : inlineCache{
+	struct slot{
+		int32_t key[Policy::size];
+		eClass* storedClass; //NULL for an empty slot
+	};
+
+	std::vector<slot> slots; //a power of two, at most half full
+	int numStored;
+	int32_t curKey[Policy::size];
+
+	static uint64_t hash(const int32_t* key){
+		uint64_t h=0x9e3779b97f4a7c15ULL;
+		for (int i=0;i<Policy::size;i++){
+			h=(h^(uint32_t) key[i])*0xbf58476d1ce4e5b9ULL;
+			h^=h>>29;
+		}
+		return h^(h>>32);
+	}
+
+	static bool equal(const int32_t* key1, const int32_t* key2){
+		for (int i=0;i<Policy::size;i++){if (key1[i]!=key2[i]){return false;}}
+		return true;
+	}
+
+	eClass* find(rootedGraph& rGraph){
+		hasKey=Policy::compute(rGraph,curKey);
+		if (!hasKey){return NULL;}
+		size_t mask=slots.size()-1;
+		for (size_t i=hash(curKey)&mask;slots[i].storedClass!=NULL;i=(i+1)&mask){
+			if (equal(slots[i].key,curKey)){return slots[i].storedClass;}
+		}
+		return NULL;
+	}
+
+	eClass* makeClass(const std::vector<std::vector<std::vector<std::vector<int> > > >& mobius){return Policy::makeClass(curKey,mobius);}
+
+	void insert(eClass* storedClass){
+		if (!hasKey){return;}
+		if (2*(numStored+1)>slots.size()){grow();}
+		size_t mask=slots.size()-1;
+		size_t i=hash(curKey)&mask;
+		while (slots[i].storedClass!=NULL){i=(i+1)&mask;}
+		memcpy(slots[i].key,curKey,sizeof(curKey));
+		slots[i].storedClass=storedClass;
+		numStored++;
+	}
+
+	void grow(){
+		std::vector<slot> oldSlots;
+		oldSlots.swap(slots);
+		slots.resize(2*oldSlots.size());
+		for (size_t i=0;i<slots.size();i++){slots[i].storedClass=NULL;}
+		size_t mask=slots.size()-1;
+		for (size_t k=0;k<oldSlots.size();k++){if (oldSlots[k].storedClass!=NULL){
+			size_t i=hash(oldSlots[k].key)&mask;
+			while (slots[i].storedClass!=NULL){i=(i+1)&mask;}
+			slots[i]=oldSlots[k];
+		}}
+	}
+
+	inlineDictionary():slots(64),numStored(0){
+		hasKey=false;
+		for (size_t i=0;i<slots.size();i++){slots[i].storedClass=NULL;}
+	}
+};
+
+
+//Instantiates inlineDictionary<Policy<R> > for the radius r, for every R from 1 to MaxR.
+template <template <int> class Policy, int MaxR>
+struct inlineDictionaries{
+	static inlineCache* make(int r){
+		if (r==MaxR){return new inlineDictionary<Policy<MaxR> >();}
+		return inlineDictionaries<Policy,MaxR-1>::make(r);
+	}
+};
+
+template <template <int> class Policy>
+struct inlineDictionaries<Policy,0>{
+	static inlineCache* make(int){return NULL;}
+};
+
+//A new inline dictionary for the type and radius, or NULL if the type has no inline keys at that radius.
+inline inlineCache* makeInlineDictionary(int type, int r){
+	if (type==4){return inlineDictionaries<shellCountKey,16>::make(r);}
+	if (type==3){return inlineDictionaries<valenceProfileKey,8>::make(r);}
+	if (type==1){return inlineDictionaries<H1CountsKey,6>::make(r);}
+	return NULL;
+}
+
+#endif
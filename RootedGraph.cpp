@@ -9,8 +9,13 @@
 #include <string>
 #include <fstream>
 #include <limits.h>
+#include <stdint.h>
+#include <algorithm>
+#include <iomanip>
+#include <chrono>
 #include <boost/array.hpp> 
 #include "RootedGraph.h"
+#include "Stats.h"
 
 
 
@@ -22,61 +27,178 @@ using namespace std;
 #include "nauty26r12/nausparse.h"
 
 
-vertex::vertex(int i, int color1):in(false),isIndex(false),index(i),curIndex(-1),distance(INT_MAX),color(color1),component(INT_MAX),neighbors({}){};
+vertex::vertex(int i, int color1):index(i),color(color1),neighbors({}),in(false),isIndex(false),bridged(false),curIndex(-1),distance(INT_MAX){};
+
+
+bool selectionPattern::accepts(vertex* v, int shell){
+	if ((shell==0) and (rootColor>=0) and (v->color!=rootColor)){return false;}
+	if (valences.size()>0){
+		int desiredValence=valences[shell%valences.size()];
+		if ((desiredValence>=0) and (v->neighbors.size()!=desiredValence)){return false;}
+	}
+	if (colors.size()>0){
+		int desiredColor=colors[shell%colors.size()];
+		if ((desiredColor>=0) and (v->color!=desiredColor)){return false;}
+	}
+	return true;
+}
 
 
 //compute the rooted graph of radius r centered at v, and the distances
-rootedGraph::rootedGraph(vertex* v, int r1){
+rootedGraph::rootedGraph(vertex* v, int r1):bridgeColor(-1),bridgesOnly(true),nautyTimeLimit(0){
+	build(v,r1);
+}
+
+//Breadth-first search writing the ball directly into the flat vertex array. The vertices of shell depth are read from [shells[depth],shells[depth+1]) while the next shell is appended behind them, so no separate frontier is needed.
+bool rootedGraph::build(vertex* v, int r1, selectionPattern* pattern){
 	r=r1;
-	vertices={{v}};
+	vertices.clear();
+	shells.clear();
+	bridgesOnly=true;
+	if ((pattern!=NULL) and (!pattern->accepts(v,0))){return false;}
 
 	//set local data
 	v->in=true; //used only in this computation 
 	v->distance=0; //used in other computations
-	
-	vector<vertex*> curStack={v};
-	int depth=0;
-
-	//breadth-first search
-	while (depth<r){
-		vector<vertex*> nextStack;
-		while(curStack.size()>0){
-			vertex* curV=curStack.back();
-			curStack.pop_back();
-			for (int i=0;i<curV->neighbors.size();i++){
-				if(curV->neighbors[i]->in==false){ //not seen previously
-					curV->neighbors[i]->distance=depth+1;
-					curV->neighbors[i]->in=true;
-					nextStack.push_back(curV->neighbors[i]);
+	v->curIndex=0;
+	vertices.push_back(v);
+	shells.push_back(0);
+
+	int start=0;
+	for (int depth=0;depth<r;depth++){
+		int end=vertices.size();
+		shells.push_back(end);
+		for (int i=start;i<end;i++){
+			vertex* curV=vertices[i];
+			if ((bridgeColor>=0) and (!curV->bridged)){//the contracted shells no longer correspond to the original ones
+				for (int k=0;k<vertices.size();k++){vertices[k]->in=false;}
+				clear();
+				bridgesOnly=false;
+				return false;
+			}
+			for (int j=0;j<curV->neighbors.size();j++){
+				vertex* nextV=curV->neighbors[j];
+				if (nextV->in==false){ //not seen previously
+					nextV->in=true;
+					nextV->distance=depth+1;
+					nextV->curIndex=vertices.size();
+					vertices.push_back(nextV);
+					if ((pattern!=NULL) and (!pattern->accepts(nextV,depth+1))){//early exit
+						for (int k=0;k<vertices.size();k++){vertices[k]->in=false;}
+						clear();
+						return false;
+					}
 				}
 			}
 		}
-		depth++;
-		vertices.push_back(nextStack);
-		curStack=nextStack;
+		start=end;
+	}
+	shells.push_back(vertices.size());
+
+	//ball-local data and the induced subgraph in compressed sparse row format
+	int n=vertices.size();
+	colors.resize(n);
+	degrees.resize(n);
+	offsets.resize(n+1);
+	adjacency.clear();
+	for (int i=0;i<n;i++){
+		vertex* curV=vertices[i];
+		colors[i]=curV->color;
+		degrees[i]=curV->neighbors.size();
+		offsets[i]=adjacency.size();
+		for (int j=0;j<curV->neighbors.size();j++){if (curV->neighbors[j]->in){
+			if ((bridgeColor>=0) and (curV->distance==r) and (curV->neighbors[j]->distance==r)){continue;} //bridge at distance 2r+1
+			adjacency.push_back(curV->neighbors[j]->curIndex);
+		}}
 	}
+	offsets[n]=adjacency.size();
 
 	//reset data
-	for (int i=0;i<vertices.size();i++){for (int j=0;j<vertices[i].size();j++){vertices[i][j]->in=false;}}
+	for (int i=0;i<n;i++){vertices[i]->in=false;}
+	return true;
+}
+
+
+//Extends the rooted graph by one shell. The neighbors of the outermost shell are in the previous shell, the outermost
+//shell or the new shell, so only these are marked, and only the rows of the outermost and the new shells of the 
+//induced subgraph change.
+void rootedGraph::extend(){
+	int previous=shells[max(r-1,0)];
+	int start=shells[r];
+	int end=vertices.size();
+	for (int i=previous;i<end;i++){vertices[i]->in=true;}
+	for (int i=start;i<end;i++){
+		vertex* curV=vertices[i];
+		for (int j=0;j<curV->neighbors.size();j++){
+			vertex* nextV=curV->neighbors[j];
+			if (nextV->in==false){ //not seen previously
+				nextV->in=true;
+				nextV->distance=r+1;
+				nextV->curIndex=vertices.size();
+				vertices.push_back(nextV);
+			}
+		}
+	}
+	r++;
+	shells.push_back(vertices.size());
+
+	int n=vertices.size();
+	colors.resize(n);
+	degrees.resize(n);
+	offsets.resize(n+1);
+	adjacency.resize(offsets[start]);
+	for (int i=start;i<n;i++){
+		vertex* curV=vertices[i];
+		colors[i]=curV->color;
+		degrees[i]=curV->neighbors.size();
+		offsets[i]=adjacency.size();
+		for (int j=0;j<curV->neighbors.size();j++){if (curV->neighbors[j]->in){
+			adjacency.push_back(curV->neighbors[j]->curIndex);
+		}}
+	}
+	offsets[n]=adjacency.size();
+
+	for (int i=previous;i<n;i++){vertices[i]->in=false;}
 }
 
 
+//clears all local data
+void rootedGraph::clear(){
+	for (int i=0;i<vertices.size();i++){
+		vertices[i]->curIndex=-1;
+		vertices[i]->distance=INT_MAX;
+	}
+	vertices.clear();
+	shells.clear();
+}
+
+vector<vertex*> rootedGraph::copyBall(){
+	int n=vertices.size();
+	vector<vertex*> copies(n+1);
+	for (int i=0;i<n;i++){copies[i]=new vertex(vertices[i]->index,vertices[i]->color);}
+	copies[n]=new vertex(-1,-1); //placeholder for the neighbors outside the ball
+	for (int i=0;i<n;i++){
+		vector<vertex*>& curNeighbors=vertices[i]->neighbors;
+		copies[i]->neighbors.resize(curNeighbors.size());
+		for (int j=0;j<curNeighbors.size();j++){
+			int k=curNeighbors[j]->curIndex;
+			copies[i]->neighbors[j]=((k>=0) and (k<n) and (vertices[k]==curNeighbors[j]))?copies[k]:copies[n];
+		}
+	}
+	return copies;
+}
+
 //destructor: clears all local data
 rootedGraph::~rootedGraph(){
-	for (int i=0;i<vertices.size();i++){for (int j=0;j<vertices[i].size();j++){
-		vertices[i][j]->curIndex=-1;
-		vertices[i][j]->distance=INT_MAX;
-		vertices[i][j]->component=INT_MAX;
-	}}
-	vertices={};
+	clear();
 }
 
 // Checks if atoms in the rooted graph satisfy the (repeated) pattern. For example, if pattern={4,2} this will return true if the atoms in shells 0, 2, 4, .. have four neighbors and atoms in shells  1,3,5,... have two neighbors.
 bool rootedGraph::checkValences(vector<int> pattern){
-	for (int i=0;i<vertices.size();i++){
+	for (int i=0;i<=r;i++){
 		int desiredValence=pattern[i%pattern.size()];
-		for (int j=0;j<vertices[i].size();j++){
-			if (vertices[i][j]->neighbors.size()!=desiredValence){return false;}
+		for (int j=shells[i];j<shells[i+1];j++){
+			if (degrees[j]!=desiredValence){return false;}
 		}
 	}
 	return true;
@@ -86,7 +208,13 @@ bool rootedGraph::checkValences(vector<int> pattern){
 
 
 
-eClass::eClass(int type1, int r1, vector<vector<int> > data1):type(type1),r(r1),data(data1),counts({}),examples({{}}),ranks({}),freqs({}){
+static uint64_t mixFingerprint(uint64_t x){
+	x=(x^(x>>30))*0xbf58476d1ce4e5b9ULL;
+	x=(x^(x>>27))*0x94d049bb133111ebULL;
+	return x^(x>>31);
+}
+
+eClass::eClass(int type1, int r1, vector<vector<int> > data1):type(type1),r(r1),id(-1),globalId(-1),data(data1),counts({}),examples({{}}),ranks({}),freqs({}){
 	//compute the hash key using the hash-combine method in boost
 	key=0;
 	if (type==1){
@@ -101,7 +229,13 @@ eClass::eClass(int type1, int r1, vector<vector<int> > data1):type(type1),r(r1),
 			key=key^(data[i][j]+ 0x9e3779b9 + (key << 6) + (key >> 2));
 		}}
 	}
-	
+
+	//64-bit fingerprint of the sizes and entries of the data, combined with the splitmix64 finalizer
+	fingerprint=mixFingerprint(type*0x9e3779b97f4a7c15ULL+r);
+	for (int i=0;i<data.size();i++){
+		fingerprint=mixFingerprint(fingerprint^(data[i].size()+0x632be59bd9b4e019ULL));
+		for (int j=0;j<data[i].size();j++){fingerprint=mixFingerprint(fingerprint+(uint32_t) data[i][j]);}
+	}
 }
 	
 void eClass::resize(int numPreps){
@@ -146,6 +280,7 @@ void eClass::print(){
 			}
 			cout<<endl;
 		}
+		if (data.size()>4){cout<<"contracted: bridges of color "<<data[4][0]<<" replaced by edges"<<endl;}
 			
 	}
 	else if (type==1){
@@ -173,6 +308,11 @@ void eClass::print(){
 			if ((data[0][i]>0) and (i<data[0].size()-1)){cout<<", ";}
 		}
 	}
+	else if (type==5){
+		uint64_t certificate=(((uint64_t) (uint32_t) data[0][3])<<32)+(uint32_t) data[0][4];
+		cout<<data[0][0]<<" vertices, "<<data[0][1]<<" rounds, "<<data[0][2]<<" colors, certificate "<<hex<<setw(16)<<setfill('0')<<certificate<<dec<<setfill(' ');
+		if (data.size()>1){cout<<" (contracted, bridges of color "<<data[1][0]<<" replaced by edges)";}
+	}
 
 
 	else{
@@ -219,6 +359,7 @@ void eClass::print(ostream &fs){
 			}
 			fs<<endl;
 		}
+		if (data.size()>4){fs<<"contracted: bridges of color "<<data[4][0]<<" replaced by edges"<<endl;}
 			
 	}
 	else if (type==1){
@@ -246,6 +387,11 @@ void eClass::print(ostream &fs){
 			if ((data[0][i]>0) and (i<data[0].size()-1)){fs<<", ";}
 		}
 	}
+	else if (type==5){
+		uint64_t certificate=(((uint64_t) (uint32_t) data[0][3])<<32)+(uint32_t) data[0][4];
+		fs<<data[0][0]<<" vertices, "<<data[0][1]<<" rounds, "<<data[0][2]<<" colors, certificate "<<hex<<setw(16)<<setfill('0')<<certificate<<dec<<setfill(' ');
+		if (data.size()>1){fs<<" (contracted, bridges of color "<<data[1][0]<<" replaced by edges)";}
+	}
 
 
 	else{
@@ -281,6 +427,12 @@ void eClass::printWithStats(std::ofstream& fs, int numExamples){
 	fs<<"Frequencies: ";
 	for (int j=0;j<freqs.size();j++){fs<<freqs[j]<<" ";}
 	fs<<endl;
+	if (globalId>=0){fs<<"Catalog id: "<<globalId<<endl;}
+	if (ranks.size()==freqs.size()){
+		fs<<"Ranks: ";
+		for (int j=0;j<ranks.size();j++){fs<<ranks[j]<<" ";}
+		fs<<endl;
+	}
 
 
 	for (int j=0;j<freqs.size();j++){
@@ -297,114 +449,211 @@ void eClass::printWithStats(std::ofstream& fs, int numExamples){
 
 
 eClass* rootedGraph::valenceProfile(){
-	vector<vector<int> > valences={};
+	if (bridgeColor>=0){//the bridges of the odd shells of the original rooted graph have valence 2
+		vector<vector<int> > valences(2*r+1);
+		for (int i=0;i<=r;i++){
+			valences[2*i].assign(degrees.begin()+shells[i],degrees.begin()+shells[i+1]);
+			std::sort(valences[2*i].begin(),valences[2*i].end());
+			if (i<r){valences[2*i+1].assign(bridgeCount(i),2);}
+		}
+		return new eClass(3,2*r,valences);
+	}
+	vector<vector<int> > valences(r+1);
 	for (int i=0;i<=r;i++){
-		vector<int> curShell={};
-		for (int j=0;j<vertices[i].size();j++){curShell.push_back(vertices[i][j]->neighbors.size());}
-		std::sort(curShell.begin(),curShell.end());
-		valences.push_back(curShell);
+		valences[i].assign(degrees.begin()+shells[i],degrees.begin()+shells[i+1]);
+		std::sort(valences[i].begin(),valences[i].end());
 	}
 	return new eClass(3,r,valences);
 }
 
 eClass* rootedGraph::shellCount(){
-	vector<int> shellCounts={};
-	for (int i=0;i<=r;i++){shellCounts.push_back(vertices[i].size());}
+	if (bridgeColor>=0){
+		vector<int> shellCounts(2*r+1);
+		for (int i=0;i<=r;i++){
+			shellCounts[2*i]=shellSize(i);
+			if (i<r){shellCounts[2*i+1]=bridgeCount(i);}
+		}
+		return new eClass(4,2*r,{shellCounts});
+	}
+	vector<int> shellCounts(r+1);
+	for (int i=0;i<=r;i++){shellCounts[i]=shellSize(i);}
 
 	return new eClass(4,r,{shellCounts});
 }
 
+//For a contracted rooted graph, the number of bridges at distance 2i+1 from the root in the original network: the edges
+//within shell i and between shells i and i+1.
+int rootedGraph::bridgeCount(int i){
+	int count=0;
+	for (int j=shells[i];j<shells[i+1];j++){
+		for (int k=offsets[j];k<offsets[j+1];k++){
+			if ((adjacency[k]>=shells[i+1]) or (adjacency[k]>j)){count++;}
+		}
+	}
+	return count;
+}
 
+//number of distinct entries of a vector of colors, which is sorted in the process
+static int countColors(vector<uint64_t>& colors){
+	sort(colors.begin(),colors.end());
+	return unique(colors.begin(),colors.end())-colors.begin();
+}
 
-//computes the rank of the first homology group of the shell annuli of the rooted graph, using the formula rank(H1)= #components-#vertices+#edges
-vector<vector<int> > rootedGraph::computeH1Counts(){
-
-	vector<vector<int> > H1Counts(r+1,vector<int>(r+1,0));
-
+eClass* rootedGraph::colorRefinement(int rounds){
+	int n=vertices.size();
+	refinedColors.resize(n);
+	nextColors.resize(n);
 
-	//shell annulus between r1 and r2
-	for (int r1=0;r1<=r;r1++){
-		vector<vector<vertex*> > components={};
-		//Each vertex at radius r1 starts in its own component. Note that the graph is NOT assumed to be bi-partite and the number of components decreases with r2 when r1 is fixed.
-		for (int i=0;i<vertices[r1].size();i++){
-			components.push_back(vector<vertex*>({vertices[r1][i]}));
-			vertices[r1][i]->component=i;
+	//initial colors: the shell and the color of each vertex
+	for (int i=0;i<=r;i++){for (int j=shells[i];j<shells[i+1];j++){
+		refinedColors[j]=mixFingerprint((((uint64_t) i)<<32)+(uint32_t) colors[j]+0x9e3779b97f4a7c15ULL);
+	}}
+	neighborColors=refinedColors;
+	int numColors=countColors(neighborColors);
+
+	int round=0;
+	while ((rounds<0) or (round<rounds)){
+		for (int j=0;j<n;j++){
+			neighborColors.clear();
+			for (int k=offsets[j];k<offsets[j+1];k++){neighborColors.push_back(refinedColors[adjacency[k]]);}
+			sort(neighborColors.begin(),neighborColors.end());
+			uint64_t color=mixFingerprint(refinedColors[j]^0x632be59bd9b4e019ULL);
+			for (int k=0;k<neighborColors.size();k++){color=mixFingerprint(color+neighborColors[k]);}
+			nextColors[j]=color;
 		}
-		int nC=components.size();	
-		int nE=0;
-		int nV=0;	
+		refinedColors.swap(nextColors);
+		round++;
+		neighborColors=refinedColors;
+		int newNumColors=countColors(neighborColors);
+		if (newNumColors==numColors){break;} //the partition is stable
+		numColors=newNumColors;
+	}
 
-		for (int r2=r1;r2<=r;r2++){
+	//certificate: the multiset of final colors
+	neighborColors=refinedColors;
+	sort(neighborColors.begin(),neighborColors.end());
+	uint64_t certificate=mixFingerprint(n+0x9e3779b97f4a7c15ULL);
+	for (int j=0;j<n;j++){certificate=mixFingerprint(certificate+neighborColors[j]);}
 
-			nV=nV+vertices[r2].size();
+	if (bridgeColor>=0){return new eClass(5,2*r,{{n,round,numColors,(int) (certificate>>32),(int) (uint32_t) certificate},{bridgeColor}});}
+	return new eClass(5,r,{{n,round,numColors,(int) (certificate>>32),(int) (uint32_t) certificate}});
+}
 
 
-			for (int i=0;i<vertices[r2].size();i++){
 
-				vertex* curVert=vertices[r2][i];
+int rootedGraph::findRoot(int i){
+	while (parent[i]!=i){
+		parent[i]=parent[parent[i]];
+		i=parent[i];
+	}
+	return i;
+}
 
-				vector<vertex*> toCheck=curVert->neighbors;
-				int ind=0;
+//computes the rank of the first homology group of the shell annuli of the rooted graph, using the formula rank(H1)= #components-#vertices+#edges
+vector<vector<int> > rootedGraph::computeH1Counts(){
+	int R=(bridgeColor>=0)?2*r:r;
+	vector<int> flatCounts((R+1)*(R+1),0);
+	computeH1Counts(flatCounts.data());
+	vector<vector<int> > H1Counts(R+1);
+	for (int r1=0;r1<=R;r1++){H1Counts[r1].assign(flatCounts.begin()+r1*(R+1),flatCounts.begin()+(r1+1)*(R+1));}
+	return H1Counts;
+}
 
-				//account for edges between vertices in shell r2 and ones in shells r2 and r2-1
-				while (ind<toCheck.size()){
-					vertex* otherVert=toCheck[ind];
-					ind++;
+void rootedGraph::computeH1Counts(int* H1Counts){
+	parent.resize(vertices.size());
 
-					//deal with neighbors vertices at the same radius last (*)
-					//if curVert has yet to be assigned to a component, then curVert->component=INT_MAX
-					if ((curVert->component>components.size()) and ((otherVert->distance==r2) and (otherVert->index>curVert->index))){ 
-						toCheck.push_back(otherVert);
+	/*
+	Contracted rooted graph: in the annulus between the shells a and b of the original rooted graph, a bridge with 
+	only one endpoint in the annulus is a leaf and a bridge with none is an isolated vertex, so neither changes the rank
+	of H1. The rank is that of the contracted annulus between the shells (a+1)/2 and b/2, where the edges within shell 
+	b/2 are included only if b is odd (their bridges are at distance b). Both counts are computed for each pair of 
+	contracted shells, the second after the edges within the outer shell are added.
+	*/
+	if (bridgeColor>=0){
+		int R=2*r;
+		vector<int> withoutOuter((r+1)*(r+1),0);
+		vector<int> withOuter((r+1)*(r+1),0);
+		for (int r1=0;r1<=r;r1++){
+			int nC=0;
+			int nE=0;
+			int nV=0;
+			for (int r2=r1;r2<=r;r2++){
+				nV=nV+shellSize(r2);
+				nC=nC+shellSize(r2);
+				for (int i=shells[r2];i<shells[r2+1];i++){parent[i]=i;}
+				for (int outer=0;outer<2;outer++){
+					for (int i=shells[r2];i<shells[r2+1];i++){
+						for (int k=offsets[i];k<offsets[i+1];k++){
+							int j=adjacency[k];
+							bool counted=(outer==0)?((j>=shells[r1]) and (j<shells[r2])):((j>i) and (j<shells[r2+1]));
+							if (counted){
+								nE++;
+								int rootI=findRoot(i);
+								int rootJ=findRoot(j);
+								if (rootI!=rootJ){
+									parent[rootI]=rootJ;
+									nC--;
+								}
+							}
+						}
 					}
-					//Count an edge if it is contained in the shell annulus and hasn't been seen before. 
-					else if ( ((r2>r1) and (otherVert->distance<r2)) or ((otherVert->distance==r2) and (otherVert->index>curVert->index))){
+					((outer==0)?withoutOuter:withOuter)[r1*(r+1)+r2]=nC-nV+nE;
+				}
+			}
+		}
+		for (int a=0;a<=R;a++){for (int b=a;b<=R;b++){
+			int r1=(a+1)/2;
+			int r2=b/2;
+			if (r1>r2){H1Counts[a*(R+1)+b]=0;}
+			else {H1Counts[a*(R+1)+b]=((b%2==0)?withoutOuter:withOuter)[r1*(r+1)+r2];}
+		}}
+		return;
+	}
+
+	//shell annulus between r1 and r2
+	for (int r1=0;r1<=r;r1++){
+		//Components are tracked with a union-find structure over the ball-local indices. Note that the graph is NOT assumed to be bi-partite and the number of components decreases with r2 when r1 is fixed.
+		int nC=0;
+		int nE=0;
+		int nV=0;	
+
+		for (int r2=r1;r2<=r;r2++){
+			nV=nV+shellSize(r2);
+			nC=nC+shellSize(r2);
+			for (int i=shells[r2];i<shells[r2+1];i++){parent[i]=i;}
+
+			//account for edges between vertices in shell r2 and ones in shells r2 and r2-1. Edges within shell r2 are counted from their endpoint with the smaller index.
+			for (int i=shells[r2];i<shells[r2+1];i++){
+				for (int k=offsets[i];k<offsets[i+1];k++){
+					int j=adjacency[k];
+					if ((j>=shells[r1]) and (j<shells[r2+1]) and ((j<shells[r2]) or (j>i))){
 						nE++;
 						//check if the edge kills a component
-						if (curVert->component!= otherVert->component){
-							//otherVert ha has not been seen (note: it must also be in shell r2)
-							if (otherVert->component>components.size()){
-								//our earlier step (*) ensures that curVert has been seen
-								otherVert->component=curVert->component;
-								components[curVert->component].push_back(otherVert);
-							}
-							else if (curVert->component<components.size()){//vertex previously seen, merge components
-								nC--;
-								vector<vertex*> otherComponent=components[otherVert->component];
-								for (int k=0;k<otherComponent.size();k++){
-									otherComponent[k]->component=curVert->component;
-									components[curVert->component].push_back(otherComponent[k]);	
-								}
-								otherComponent={};
-							}
-							else{
-								curVert->component=otherVert->component;
-								components[otherVert->component].push_back(curVert);	
-							}
+						int rootI=findRoot(i);
+						int rootJ=findRoot(j);
+						if (rootI!=rootJ){
+							parent[rootI]=rootJ;
+							nC--;
 						}
 					}
 				}
-				
 			}
-			H1Counts[r1][r2]=nC-nV+nE;
+			H1Counts[r1*(r+1)+r2]=nC-nV+nE;
 
 		}
-		//reset components
-		for (int i=r1;i<=r;i++){
-			for (int j=0;j<vertices[i].size();j++){vertices[i][j]->component=INT_MAX;}
-		}
 	}
-	return H1Counts;
 }
 
 
 
 //computes the H1 Barcode using Mobius inversion.
-eClass* rootedGraph::H1Barcode(vector<vector<vector<vector<int> > > > mobius){
+eClass* rootedGraph::H1Barcode(const vector<vector<vector<vector<int> > > >& mobius){
 
-	vector<vector<int> > intervals(r+1,vector<int>(r+1,0));
+	int R=(bridgeColor>=0)?2*r:r; //radius of the original rooted graph
+	vector<vector<int> > intervals(R+1,vector<int>(R+1,0));
 	vector<vector<int> > counts=computeH1Counts();
 
-	for (int i=0;i<r+1;i++){for (int j=i;j<r+1;j++){
+	for (int i=0;i<R+1;i++){for (int j=i;j<R+1;j++){
 		int temp=0;
 		for (int m=i;m<=j;m++){for (int n=m;n<=j;n++){
 			temp=temp+counts[m][n]*mobius[i][j][m][n]; //note: Mobius function computed with opposite ordering
@@ -413,7 +662,7 @@ eClass* rootedGraph::H1Barcode(vector<vector<vector<vector<int> > > > mobius){
 
 	}}
 
-	return new eClass(1,r,intervals);
+	return new eClass(1,R,intervals);
 }
 		
 
@@ -581,8 +830,8 @@ bool checkPrimitiveDirected(vector<vertex*> ring, vector<vector<int> > reference
 vector<vector<vertex*> > rootedGraph::possiblePrimitive(int r, bool global){
 	vector<vector<vertex*> > rings={};
 	
-	for (int i1=1;i1<vertices.size();i1++){for (int i2=0;i2<vertices[i1].size();i2++){if ((!global) or ((!vertices[i1][i2]->isIndex) or (vertices[i1][i2]->index>vertices[0][0]->index))){
-		vertex* curV=vertices[i1][i2];
+	for (int i=shells[1];i<vertices.size();i++){if ((!global) or ((!vertices[i]->isIndex) or (vertices[i]->index>vertices[0]->index))){
+		vertex* curV=vertices[i];
 		int d=curV->distance;
 		int numSame=0;
 		int numShorter=0;
@@ -600,7 +849,7 @@ vector<vector<vertex*> > rootedGraph::possiblePrimitive(int r, bool global){
 	
 		//candidate even rings: concatenate paths from curV to v that have the same length
 		if (numShorter>1){
-			vector<vector<vertex*> > curPaths=vertices[0][0]->findPaths(curV,global);
+			vector<vector<vertex*> > curPaths=vertices[0]->findPaths(curV,global);
 			for (int j=0;j<curPaths.size();j++){for (int k=j+1;k<curPaths.size();k++){
 				vector<vertex*> curRing=curPaths[j];
 				curRing.insert(curRing.end(),curPaths[k].rbegin()+1,curPaths[k].rend()-1); //concatenate
@@ -609,9 +858,9 @@ vector<vector<vertex*> > rootedGraph::possiblePrimitive(int r, bool global){
 		}
 		//candidate odd rings
 		if (numSame>0){
-			vector<vector<vertex*> > curPaths=vertices[0][0]->findPaths(curV,global);
+			vector<vector<vertex*> > curPaths=vertices[0]->findPaths(curV,global);
 			for (int l=0;l<sameDistanceVertices.size();l++){
-				vector<vector<vertex*> > otherPaths=vertices[0][0]->findPaths(sameDistanceVertices[l],global);
+				vector<vector<vertex*> > otherPaths=vertices[0]->findPaths(sameDistanceVertices[l],global);
 				for (int j=0;j<curPaths.size();j++){for (int k=0;k<otherPaths.size();k++){
 					vector<vertex*> curRing=curPaths[j];
 					curRing.insert(curRing.end(),otherPaths[k].rbegin(),otherPaths[k].rend()-1); //concatenate
@@ -619,7 +868,7 @@ vector<vector<vertex*> > rootedGraph::possiblePrimitive(int r, bool global){
 				}} 
 			}
 		}
-	}}}
+	}}
 
 	return rings;
 }
@@ -627,9 +876,11 @@ vector<vector<vertex*> > rootedGraph::possiblePrimitive(int r, bool global){
 eClass* rootedGraph::primitiveRingProfile(std::vector<std::vector<int> > refs){
 	//computes a list of candidate primitive rings
 	vector<vector<vertex*> > candidateRings=possiblePrimitive(r);
+	STATS_COUNT(candidateRings,candidateRings.size());
 
 	vector<int> ringProfile={};
 	for (int i=0;i<candidateRings.size();i++){if (checkPrimitiveDirected(candidateRings[i],refs)){//check if a ring is primitive
+		STATS_COUNT(primitiveRings,1);
 		//if a primitive ring is longer than those previously detected, increase the length of the profile
 		while (candidateRings[i].size()>ringProfile.size()){ringProfile.push_back(0);} 
 		ringProfile[candidateRings[i].size()-1]++;
@@ -680,35 +931,88 @@ vector<vector<vector<vector<int> > > > computeMobius(int r){
 }
 
 
-//computes canonical form for the graph isomorphism class of radius rad, using the package nauty.
-eClass* rootedGraph::canonicalForm(bool primitiveCluster)
-{
-	vector<vector<vertex*> > verticesByColor={{}};
-	for (int i=0;i<vertices.size();i++){for (int j=0;j<vertices[i].size();j++){
-		while (vertices[i][j]->color >= verticesByColor.size()){verticesByColor.push_back({});}
-		verticesByColor[vertices[i][j]->color].push_back(vertices[i][j]);
-		vertices[i][j]->in=true;
-	
-	}}
+int rootedGraph::subdivideMultipleEdges(){
+	int n=vertices.size();
+	bool multiple=false;
+	for (int i=0;(i<n) and (!multiple);i++){
+		for (int k=offsets[i];k<offsets[i+1];k++){for (int l=offsets[i];l<k;l++){
+			if (adjacency[l]==adjacency[k]){multiple=true;}
+		}}
+	}
+	if (!multiple){return 0;}
 
-	
-	
-	
-	int ind=0;
-	int numEdges=0; //note: this is the number of DIRECTED edges (so twice the number of edges)
+	int newColor=0;
+	for (int i=0;i<n;i++){newColor=max(newColor,colors[i]+1);}
+	multiColors.assign(colors.begin(),colors.begin()+n);
+	vector<vector<int> > lists(n);
+	for (int i=0;i<n;i++){
+		for (int k=offsets[i];k<offsets[i+1];k++){
+			int j=adjacency[k];
+			if (j<i){continue;} //each pair is handled from its first vertex
+			bool first=true;
+			for (int l=offsets[i];l<k;l++){if (adjacency[l]==j){first=false;}}
+			if (first){
+				lists[i].push_back(j);
+				lists[j].push_back(i);
+			}
+			else {
+				int w=lists.size();
+				lists.push_back({i,j});
+				lists[i].push_back(w);
+				lists[j].push_back(w);
+				multiColors.push_back(newColor);
+			}
+		}
+	}
+	multiOffsets.assign(1,0);
+	multiAdjacency.clear();
+	for (int i=0;i<lists.size();i++){
+		multiAdjacency.insert(multiAdjacency.end(),lists[i].begin(),lists[i].end());
+		multiOffsets.push_back(multiAdjacency.size());
+	}
+	return lists.size();
+}
 
+//deadline of the current nauty call, checked by stopAtDeadline at each node of the search tree. Like the static nauty
+//state of canonicalForm, it is shared by all rooted graphs, so calls to canonicalForm must not overlap.
+static chrono::steady_clock::time_point nautyDeadline;
 
-	for (int i=0;i<verticesByColor.size();i++){
-		for (int j=0;j<verticesByColor[i].size();j++){
-			for (int k=0;k<verticesByColor[i][j]->neighbors.size();k++){if (verticesByColor[i][j]->neighbors[k]->in){
-				numEdges++;
-			}}
-			verticesByColor[i][j]->curIndex=ind;
-			ind++;
-			
+static void stopAtDeadline(graph*, int*, int*, int, int, int, int, int, int){
+	if (chrono::steady_clock::now()>nautyDeadline){nauty_kill_request=1;}
+}
+
+//computes canonical form for the graph isomorphism class of radius rad, using the package nauty.
+eClass* rootedGraph::canonicalForm(bool primitiveCluster)
+{
+	int n=vertices.size();
+	int ne=adjacency.size(); //note: this is the number of DIRECTED edges (so twice the number of edges)
+	const int* ballColors=colors.data();
+	const int* ballOffsets=offsets.data();
+	const int* ballAdjacency=adjacency.data();
+	if (bridgeColor>=0){//a contracted rooted graph may have multiple edges, which nauty does not allow
+		int multiN=subdivideMultipleEdges();
+		if (multiN>0){
+			n=multiN;
+			ne=multiAdjacency.size();
+			ballColors=multiColors.data();
+			ballOffsets=multiOffsets.data();
+			ballAdjacency=multiAdjacency.data();
 		}
-	}	
-	
+	}
+
+	//order the vertices by color (a stable counting sort, so that vertices of the same color remain in breadth-first order). order[ind] is the ball-local index of the ind-th vertex passed to nauty, and label is the inverse permutation.
+	int numColors=0;
+	for (int i=0;i<n;i++){if (ballColors[i]>=numColors){numColors=ballColors[i]+1;}}
+	parent.assign(numColors+1,0);
+	for (int i=0;i<n;i++){parent[ballColors[i]+1]++;}
+	for (int c=0;c<numColors;c++){parent[c+1]+=parent[c];}
+	order.resize(n);
+	label.resize(n);
+	for (int i=0;i<n;i++){
+		order[parent[ballColors[i]]]=i;
+		label[i]=parent[ballColors[i]];
+		parent[ballColors[i]]++;
+	}
 
 	//initialize nauty variables
 	DYNALLSTAT(int,lab,lab_sz);
@@ -720,15 +1024,12 @@ eClass* rootedGraph::canonicalForm(bool primitiveCluster)
 	options.digraph= FALSE;
 	options.getcanon = TRUE;
 	options.defaultptn = FALSE;
+	options.usernodeproc = (nautyTimeLimit>0)?stopAtDeadline:NULL;
 
 
-	SG_DECL(sg);
-	SG_DECL(cg);
-
-	
-
-	int n=ind;
-	int ne=numEdges;
+	//the sparse graphs are reused between calls, so that nauty only allocates memory when a larger ball is encountered
+	static SG_DECL(sg);
+	static SG_DECL(cg);
 
 	int m = SETWORDSNEEDED(n);
 	nauty_check(WORDSIZE,m,n,NAUTYVERSIONID);
@@ -739,27 +1040,20 @@ eClass* rootedGraph::canonicalForm(bool primitiveCluster)
 	sg.nv = n; 
 	sg.nde = ne; 
 
-	ind=0;
 	int edgesInd=0;
-
-	for (int l=0;l<verticesByColor.size();l++){
-		for (int j=0;j<verticesByColor[l].size();j++){
-			vertex* curVert=verticesByColor[l][j];
-			ptn[ind]=1; 
-			lab[ind]=ind;
-			int curDegree=0;
-			sg.v[ind]=edgesInd;
-			for (int i=0;i<curVert->neighbors.size();i++){if (curVert->neighbors[i]->in){
-				curDegree++;
-				sg.e[edgesInd]=curVert->neighbors[i]->curIndex;
-				edgesInd++;
-			}}	
-		
-			sg.d[ind]=curDegree;
-			if (curDegree==0){sg.v[ind]=0;}
-			ind++;		
-		}
-		ptn[ind-1]=0;//end of color
+	for (int ind=0;ind<n;ind++){
+		int i=order[ind];
+		lab[ind]=ind;
+		//the last vertex of each color ends a cell of the partition
+		ptn[ind]=((ind<n-1) and (ballColors[order[ind+1]]==ballColors[i]))?1:0;
+		int curDegree=ballOffsets[i+1]-ballOffsets[i];
+		sg.v[ind]=edgesInd;
+		for (int k=ballOffsets[i];k<ballOffsets[i+1];k++){
+			sg.e[edgesInd]=label[ballAdjacency[k]];
+			edgesInd++;
+		}	
+		sg.d[ind]=curDegree;
+		if (curDegree==0){sg.v[ind]=0;}
 	}
 
 	
@@ -777,33 +1071,31 @@ eClass* rootedGraph::canonicalForm(bool primitiveCluster)
 
 	*/
 
-	int *ptn2=new int[n];
-	memcpy (ptn2, ptn, n *sizeof(int));
+	vector<vector<int> > data={{},{},{},{}};
+	data[3].assign(ptn,ptn+n);
 	
+	STATS_COUNT(nautyCalls,1);
+	if (nautyTimeLimit>0){nautyDeadline=chrono::steady_clock::now()+chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(nautyTimeLimit));}
 	sparsenauty(&sg,lab,ptn,orbits,&options,&stats,&cg);
+	if (stats.errstatus==NAUKILLED){//stopped by stopAtDeadline
+		nauty_kill_request=0;
+		return NULL;
+	}
 	sortlists_sg(&cg);
 
-
-
-	for (int i=0;i<vertices.size();i++){for (int j=0;j<vertices[i].size();j++){
-		vertices[i][j]->curIndex=0;
-		vertices[i][j]->in=false;
-	}}
-
-
-	vector<vector<int> > data={{},{},{},{}};
+	data[0].resize(n);
+	data[1].resize(n);
+	data[2].resize(ne);
 	for (int i=0;i<n;i++){
-		data[0].push_back((int)cg.d[i]);
-
-		data[1].push_back((int)cg.v[i]);
-		data[3].push_back((int)ptn2[i]);
+		data[0][i]=(int)cg.d[i];
+		data[1][i]=(int)cg.v[i];
 	}
-	for (int i=0;i<ne;i++){data[2].push_back((int)cg.e[i]);}
-
-
+	for (int i=0;i<ne;i++){data[2][i]=(int)cg.e[i];}
 
+	if (bridgeColor>=0){
+		data.push_back({bridgeColor});
+		return new eClass(0,2*r,data);
+	}
 	return new eClass(0,r,data);
-
-
 	
 }
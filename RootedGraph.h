@@ -3,6 +3,8 @@
 #ifndef ROOTEDGRAPH_H
 #define ROOTEDGRAPH_H
 
+#include <stdint.h>
+
 struct vertex
 {
 	int index;
@@ -13,9 +15,9 @@ struct vertex
 	//Local variables used in various computations.
 	bool in;
 	bool isIndex;
+	bool bridged; //in a contracted network (see network::contract), true if all neighbors of the vertex in the original network were contracted
 	int curIndex;
 	int distance;
-	int component; //used when computing the number of components of the shell annuli in the H1 barcode computation
 	std::vector<int> primitiveRingProfile; //used in global computation of primitive ring profile
 
 
@@ -32,9 +34,12 @@ struct vertex
 
 //eClass: short for equivalence class
 struct eClass{
-	int type; // 0: graph isomorphism, 1: H1 Barcode, 2: Primitive Ring Profile, 3: Coordination Profile, 4: Shell Count
+	int type; // 0: graph isomorphism, 1: H1 Barcode, 2: Primitive Ring Profile, 3: Coordination Profile, 4: Shell Count, 5: Color Refinement
 	int r;
 	int key; // a key to be used in a hash table
+	uint64_t fingerprint; // a 64-bit hash of the data, used to identify the class in sketches (see classSketch in Classification.h)
+	int id; // index of the equivalence class in the empirical distribution, in the order that classes were detected
+	int globalId; // id of the equivalence class in a classCatalog (see Classification.h), or -1
 	
 	std::vector<std::vector<int> > data; 
 	/*The essential information representing an equivalence class. The format is different for each type:
@@ -43,6 +48,9 @@ struct eClass{
 		2: A single vector {{c_1,c_2,c_3...}} where c_i is the number of primitive i-rings.
 		3: A vector of vectors {v_0,v_1,v_2,...} where v_i contains the valences of the vertices in the i-th shell.
 		4: A single vector {{c_1,c_2,c_3...}} where c_i is the number of atoms in the i-th shell.
+		5: A single vector {{n,k,c,h_1,h_0}}, where n is the number of vertices of the rooted graph, k the number of rounds
+		   of color refinement, c the number of colors after the last round, and h_1,h_0 the high and low 32 bits of the
+		   64-bit certificate (see rootedGraph::colorRefinement).
 	
 	*/
 	
@@ -70,45 +78,131 @@ struct eClass{
 };
 
 
-//Data structure for the rooted graph/swatch/local atomic environment of radius r. Initializing the rooted graph sets local variables in the included vertices that are used in the computations of the various equivalence classes. These must be reset by calling the destructor before proceeding to a computation with a different local environment. 
+//Predicate used to select root vertices. It is evaluated while the rooted graph is built, so that the construction stops as soon as a vertex violates it. The shell patterns are repeated: for example, valences={4,2} requires the vertices in shells 0, 2, 4, ... to have four neighbors and the vertices in shells 1, 3, 5, ... to have two neighbors. Entries equal to -1 and empty patterns place no constraint.
+struct selectionPattern{
+	int rootColor; //-1: any color
+	std::vector<int> valences; //repeated pattern of valences by shell
+	std::vector<int> colors; //repeated pattern of colors by shell
+
+	bool needsBall(){return (valences.size()>0) or (colors.size()>0);} //true if the pattern constrains vertices other than the root
+	bool accepts(vertex* v, int shell);
+
+	selectionPattern(int rootColor1=-1, std::vector<int> valences1={}, std::vector<int> colors1={}):rootColor(rootColor1),valences(valences1),colors(colors1){};
+};
+
+
+//Data structure for the rooted graph/swatch/local atomic environment of radius r. Building the rooted graph sets local variables in the included vertices that are used in the computations of the various equivalence classes. These must be reset by calling clear() (or the destructor) before proceeding to a computation with a different local environment. 
+//A single rootedGraph can be reused for many roots: build() and clear() keep the capacity of the internal arrays, so that no memory is allocated once the arrays have grown to the size of the largest ball.
 struct rootedGraph{
 	int r;
 
-	//vertices are stored in shells. vertices[0]={root}, vertices[1]=neighbors of root, vertices[2]=vertices at distance two from the root, etc
-	std::vector<std::vector<vertex*> > vertices;
-	
+	//Vertices are stored in one array ordered by distance from the root. Shell i (the vertices at distance i from the root) occupies the positions shells[i],...,shells[i+1]-1, so vertices[0] is the root and shells has r+2 entries.
+	//The position of a vertex in this array is its ball-local index, which is also stored in vertex::curIndex while the rooted graph is built.
+	std::vector<vertex*> vertices;
+	std::vector<int> shells;
+
+	//Ball-local data, indexed by ball-local index.
+	std::vector<int> colors;
+	std::vector<int> degrees; //valences in the full graph
+	std::vector<int> offsets;
+	std::vector<int> adjacency;
+	//The subgraph induced on the ball in compressed sparse row format: the neighbors of vertex i are adjacency[offsets[i]],...,adjacency[offsets[i+1]-1]. 
+
+	int shellSize(int i){return shells[i+1]-shells[i];}
+	int size(){return vertices.size();}
+
+	bool build(vertex* v, int r1, selectionPattern* pattern=NULL); 
+	//Computes the rooted graph of radius r1 centered at v, reusing the internal arrays. If a selection pattern is given
+	//and a vertex of the ball violates it, stops immediately, clears the local data and returns false.
+	void extend(); //Extends a built rooted graph to radius r+1 by adding one shell, without repeating the search of the inner shells (not on contracted networks).
+
+	int bridgeColor;
+	bool bridgesOnly;
+	//bridgeColor is -1 unless the rooted graph is built on a contracted network (see network::contract), in which each
+	//edge stands for a vertex of color bridgeColor between its endpoints. The rooted graph of radius r then stands for
+	//the rooted graph of radius 2r of the original network: build omits the edges between vertices of shell r (their
+	//bridges are at distance 2r+1), and stops with bridgesOnly=false if a vertex of shells 0,...,r-1 is not bridged, as
+	//the shells of the two networks then differ. shellCount, valenceProfile and H1Barcode return the equivalence 
+	//classes of the original rooted graph, while canonicalForm and colorRefinement classify the contracted rooted graph
+	//(which determines the original one) and mark their data with an extra row {bridgeColor}.
+	void clear(); //Resets local data at each vertex. Must be called before building the rooted graph of another root.
+
 	//eClass* graphIsomorphsimClass();
 	eClass* canonicalForm(bool primitiveCluster=false); //both options need to be implemented
-	eClass* H1Barcode(std::vector<std::vector<std::vector<std::vector<int> > > > mobius);
+	//Returns NULL if nautyTimeLimit>0 and nauty runs for longer than nautyTimeLimit seconds. The time is checked at
+	//each node of the search tree, and nauty is stopped with nauty_kill_request (nauty 2.6 or later).
+	//Not reentrant: nauty, its buffers and the deadline are shared by all rooted graphs, so threads must hold a common
+	//lock around calls (as in empiricalDistribution::classifyDeferred).
+
+	double nautyTimeLimit; //0: no limit
+	eClass* H1Barcode(const std::vector<std::vector<std::vector<std::vector<int> > > >& mobius);
 	eClass* primitiveRingProfile(std::vector<std::vector<int> > references={});
 	eClass* valenceProfile();
 	eClass* shellCount();
+	eClass* colorRefinement(int rounds=-1);
+	//Color refinement (the 1-dimensional Weisfeiler-Lehman test) on the rooted graph. Each vertex starts with a color
+	//given by its distance from the root and its own color. In each round, the color of a vertex is replaced by a hash
+	//of its color and the multiset of the colors of its neighbors. Stops after the given number of rounds, or earlier 
+	//(and with rounds=-1, only) once a round does not increase the number of colors, and returns a 64-bit hash of the
+	//multiset of final colors. Isomorphic rooted graphs always have the same certificate, and non-isomorphic ones
+	//usually have different certificates, except for graphs that color refinement cannot distinguish (for example, 
+	//regular graphs of the same degree and size). Each round takes time O(e log(d)) for e edges and maximum valence d. 
 
 	// Checks if atoms in the rooted graph satisfy the (repeated) pattern. For example, if pattern={4,2} this will return true if the atoms in shells 0, 2, 4, .. have four neighbors and atoms in shells  1,3,5,... have two neighbors.
 	bool checkValences(std::vector<int> pattern);
 
 	std::vector<std::vector<int> > computeH1Counts(); //used in the computation of the H1 Barcode
+	void computeH1Counts(int* H1Counts); //The same, in a (r+1)x(r+1) row-major array; entries below the diagonal are not set.
+	//For a contracted rooted graph, the counts of the original rooted graph of radius 2r, in a (2r+1)x(2r+1) array.
 
 
 	std::vector<std::vector<vertex*> > possiblePrimitive(int rad, bool global=false); //Finds a list of possible primitive rings containing the root.
 
 
-        //After computations with one local atomic environment are complete, it is important to call this destructor which resets local data at each vertex. 
+        //After computations with one local atomic environment are complete, it is important to call clear() or this destructor which resets local data at each vertex. 
 	~rootedGraph(); 
 
 	rootedGraph(vertex* v, int r1);
-
+	rootedGraph():r(0),bridgeColor(-1),bridgesOnly(true),nautyTimeLimit(0){};
+
+	std::vector<vertex*> copyBall();
+	//Copies the vertices of the ball, with the same indices, colors and order of neighbors, so that the same rooted 
+	//graph can be rebuilt from the copy of the root (the first vertex) without touching the network, for example in 
+	//another thread. Neighbors outside the ball are replaced by a placeholder vertex (the last copy), so that valences
+	//are unchanged. The copies must be deleted by the caller.
+
+	private:
+	//scratch arrays reused by the equivalence class computations
+	std::vector<int> order;
+	std::vector<int> label;
+	std::vector<int> parent;
+	std::vector<uint64_t> refinedColors;
+	std::vector<uint64_t> nextColors;
+	std::vector<uint64_t> neighborColors;
+	std::vector<int> multiColors;
+	std::vector<int> multiOffsets;
+	std::vector<int> multiAdjacency;
+
+	int subdivideMultipleEdges();
+	//For canonicalForm on a contracted rooted graph: if some pairs of vertices are joined by several edges, fills the
+	//multi arrays with the graph in which each edge after the first between a pair is replaced by a new vertex (of a 
+	//new color) adjacent to both, and returns its number of vertices. Returns 0 if there are no multiple edges.
+
+	int findRoot(int i); //union-find with path halving, used in computeH1Counts
+	int bridgeCount(int i);
 };
 
 
 
-//Compares two equivalence classes by their rank in preparation dataPrep
+//Compares two equivalence classes by their rank in preparation dataPrep. See also classRanking in Classification.h, 
+//which computes all ranks and the most common classes without sorting.
 struct rankCompare{
 	int dataPrep;
 	rankCompare(int dataPrep1=0):dataPrep(dataPrep1){};
 	bool operator ()(const eClass* e1,const eClass* e2)
 	{
-		return (e1->counts[dataPrep]>e2->counts[dataPrep]);
+		if (e1->counts[dataPrep]!=e2->counts[dataPrep]){return (e1->counts[dataPrep]>e2->counts[dataPrep]);}
+		return (e1->id<e2->id); //ties in the order classes were detected
 	}
 
 };
@@ -120,7 +214,10 @@ struct differenceCompare {
 	differenceCompare(int dataPrep1a, int dataPrep2a):dataPrep1(dataPrep1a),dataPrep2(dataPrep2a){};
 	bool operator ()(const eClass* e1,const eClass* e2)
 	{
-		return (e1->freqs[dataPrep1]-e1->freqs[dataPrep2]>e2->freqs[dataPrep1]-e2->freqs[dataPrep2]);
+		double diff1=e1->freqs[dataPrep1]-e1->freqs[dataPrep2];
+		double diff2=e2->freqs[dataPrep1]-e2->freqs[dataPrep2];
+		if (diff1!=diff2){return (diff1>diff2);}
+		return (e1->id<e2->id);
 	}
 
 };
@@ -0,0 +1,181 @@
+/*
+Instrumentation of the classification. To enable it, compile with -DSWATCHES_STATS; otherwise all of the macros below
+expand to nothing, so that there is no overhead. When enabled, a single global swatchesStatistics collects
+  - the time spent in each phase (loading and symmetrizing graphs, building rooted graphs, computing equivalence
+    classes of each type, probing the dictionary, and writing output), and the number of times each phase was entered,
+  - counters: roots, ball sizes (total, maximum and a histogram by powers of two), nauty calls, candidate and
+    primitive rings, dictionary probes and hash collisions (comparisons with classes with the same key but different
+    data),
+  - the latency of each root (from the start of the construction of its rooted graph until it is added to the
+    dictionary), as a histogram by powers of two of nanoseconds, with estimates of the median and the 99th percentile,
+    the maximum, and the indices of the slowest roots.
+The statistics are saved in JSON format with STATS_SAVE(filename) (the --stats option of Swatches). They may be updated
+from several threads: the counters are atomic, and the phase times and histograms are updated under a mutex. The time
+of a phase that runs on several threads is the sum of the times of all threads.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#ifdef SWATCHES_STATS
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <utility>
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+
+enum statsPhase {STATS_LOAD, STATS_SYMMETRIZE, STATS_BALL, STATS_CLASSIFY_0, STATS_CLASSIFY_1, STATS_CLASSIFY_2, STATS_CLASSIFY_3, STATS_CLASSIFY_4, STATS_CLASSIFY_5, STATS_PROBE, STATS_OUTPUT, STATS_NUM_PHASES};
+
+struct swatchesStatistics{
+	double phaseTime[STATS_NUM_PHASES]; //seconds
+	long phaseCalls[STATS_NUM_PHASES];
+
+	long roots;
+	long ballVertices;
+	long maxBall;
+	std::vector<long> ballHistogram; //ballHistogram[i]: number of balls with between 2^i and 2^(i+1)-1 vertices
+	std::atomic<long> nautyCalls;
+	std::atomic<long> candidateRings;
+	std::atomic<long> primitiveRings;
+	std::atomic<long> probes;
+	std::atomic<long> collisions;
+
+	std::vector<long> latencyHistogram; //latencyHistogram[i]: number of roots whose latency is between 2^i and 2^(i+1)-1 ns
+	double maxLatency; //seconds
+	int numSlowest;
+	std::vector<std::pair<double,int> > slowest; //min-heap of the latencies and indices of the slowest roots
+
+	std::mutex lock; //guards all of the statistics that are not atomic
+
+	static double now(){return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();}
+
+	static int log2Bucket(uint64_t x){
+		int bucket=0;
+		while (x>1){x>>=1; bucket++;}
+		return bucket;
+	}
+
+	void addPhase(int phase, double time){
+		std::lock_guard<std::mutex> guard(lock);
+		phaseTime[phase]+=time;
+		phaseCalls[phase]++;
+	}
+
+	void addBall(long size){
+		std::lock_guard<std::mutex> guard(lock);
+		ballVertices+=size;
+		maxBall=std::max(maxBall,size);
+		ballHistogram[log2Bucket(size)]++;
+	}
+
+	void addRoot(double latency, int index){
+		std::lock_guard<std::mutex> guard(lock);
+		roots++;
+		latencyHistogram[log2Bucket((uint64_t) (latency*1e9))]++;
+		maxLatency=std::max(maxLatency,latency);
+		std::greater<std::pair<double,int> > order;
+		if (slowest.size()<numSlowest){
+			slowest.push_back(std::make_pair(latency,index));
+			std::push_heap(slowest.begin(),slowest.end(),order);
+		}
+		else if (latency>slowest[0].first){
+			std::pop_heap(slowest.begin(),slowest.end(),order);
+			slowest.back()=std::make_pair(latency,index);
+			std::push_heap(slowest.begin(),slowest.end(),order);
+		}
+	}
+
+	double latencyQuantile(double q){ //upper end of the histogram bucket containing the quantile, in seconds
+		long target=(long) (q*roots);
+		long seen=0;
+		for (int i=0;i<latencyHistogram.size();i++){
+			seen+=latencyHistogram[i];
+			if (seen>target){return ((double) (1L<<(i+1)))*1e-9;}
+		}
+		return maxLatency;
+	}
+
+	void save(std::string filename){
+		const char* phaseNames[STATS_NUM_PHASES]={"load","symmetrize","ballBuild","classifyGraphIsomorphism","classifyH1Barcode","classifyPrimitiveRings","classifyCoordinationProfile","classifyShellCount","classifyColorRefinement","dictionaryProbe","output"};
+		std::ofstream fs(filename);
+		fs<<"{"<<std::endl<<"  \"phases\": {"<<std::endl;
+		for (int i=0;i<STATS_NUM_PHASES;i++){
+			fs<<"    \""<<phaseNames[i]<<"\": {\"seconds\": "<<phaseTime[i]<<", \"calls\": "<<phaseCalls[i]<<"}"<<((i<STATS_NUM_PHASES-1)?",":"")<<std::endl;
+		}
+		fs<<"  },"<<std::endl;
+		fs<<"  \"roots\": "<<roots<<","<<std::endl;
+		fs<<"  \"ballVertices\": "<<ballVertices<<","<<std::endl;
+		fs<<"  \"meanBallSize\": "<<((roots>0)?((double) ballVertices)/roots:0)<<","<<std::endl;
+		fs<<"  \"maxBallSize\": "<<maxBall<<","<<std::endl;
+		fs<<"  \"ballSizeHistogramLog2\": [";
+		for (int i=0;i<ballHistogram.size();i++){fs<<ballHistogram[i]<<((i<ballHistogram.size()-1)?", ":"");}
+		fs<<"],"<<std::endl;
+		fs<<"  \"nautyCalls\": "<<nautyCalls<<","<<std::endl;
+		fs<<"  \"candidateRings\": "<<candidateRings<<","<<std::endl;
+		fs<<"  \"primitiveRings\": "<<primitiveRings<<","<<std::endl;
+		fs<<"  \"dictionaryProbes\": "<<probes<<","<<std::endl;
+		fs<<"  \"hashCollisions\": "<<collisions<<","<<std::endl;
+		fs<<"  \"rootLatency\": {"<<std::endl;
+		fs<<"    \"p50Seconds\": "<<latencyQuantile(0.5)<<","<<std::endl;
+		fs<<"    \"p99Seconds\": "<<latencyQuantile(0.99)<<","<<std::endl;
+		fs<<"    \"maxSeconds\": "<<maxLatency<<","<<std::endl;
+		fs<<"    \"histogramLog2Nanoseconds\": [";
+		for (int i=0;i<latencyHistogram.size();i++){fs<<latencyHistogram[i]<<((i<latencyHistogram.size()-1)?", ":"");}
+		fs<<"],"<<std::endl;
+		std::vector<std::pair<double,int> > sorted=slowest;
+		std::sort(sorted.begin(),sorted.end(),std::greater<std::pair<double,int> >());
+		fs<<"    \"slowestRoots\": [";
+		for (int i=0;i<sorted.size();i++){fs<<"{\"index\": "<<sorted[i].second<<", \"seconds\": "<<sorted[i].first<<"}"<<((i<sorted.size()-1)?", ":"");}
+		fs<<"]"<<std::endl<<"  }"<<std::endl<<"}"<<std::endl;
+		fs.close();
+	}
+
+	swatchesStatistics():roots(0),ballVertices(0),maxBall(0),ballHistogram(64,0),nautyCalls(0),candidateRings(0),primitiveRings(0),probes(0),collisions(0),latencyHistogram(64,0),maxLatency(0),numSlowest(10),slowest({}){
+		for (int i=0;i<STATS_NUM_PHASES;i++){
+			phaseTime[i]=0;
+			phaseCalls[i]=0;
+		}
+	}
+};
+
+inline swatchesStatistics& globalStats(){
+	static swatchesStatistics statistics;
+	return statistics;
+}
+
+//Adds the time between its construction and destruction to a phase.
+struct statsTimer{
+	int phase;
+	double start;
+	statsTimer(int phase1):phase(phase1),start(swatchesStatistics::now()){};
+	~statsTimer(){globalStats().addPhase(phase,swatchesStatistics::now()-start);}
+};
+
+#define STATS_CONCAT2(a,b) a##b
+#define STATS_CONCAT(a,b) STATS_CONCAT2(a,b)
+#define STATS_TIMER(phase) statsTimer STATS_CONCAT(statsTimer_,__LINE__)(phase)
+#define STATS_START(name) double statsStart_##name=swatchesStatistics::now()
+#define STATS_STOP(name,phase) globalStats().addPhase(phase,swatchesStatistics::now()-statsStart_##name)
+#define STATS_COUNT(counter,n) (globalStats().counter+=(n))
+#define STATS_BALL(size) globalStats().addBall(size)
+#define STATS_ROOT(name,index) globalStats().addRoot(swatchesStatistics::now()-statsStart_##name,index)
+#define STATS_SAVE(filename) globalStats().save(filename)
+
+#else
+
+#define STATS_TIMER(phase)
+#define STATS_START(name)
+#define STATS_STOP(name,phase)
+#define STATS_COUNT(counter,n)
+#define STATS_BALL(size)
+#define STATS_ROOT(name,index)
+#define STATS_SAVE(filename)
+
+#endif
+
+#endif
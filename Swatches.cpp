@@ -1,13 +1,14 @@
 /*
 See the the readme for documentation.
 
-g++ Swatches.cpp Classification.cpp RootedGraph.cpp nauty26r12/nauty.c nauty26r12/nautil.c nauty26r12/schreier.c nauty26r12/naurng.c nauty26r12/nausparse.c -Wno-write-strings -o Swatches -std=c++0x -O2 
+g++ Swatches.cpp Classification.cpp RootedGraph.cpp nauty26r12/nauty.c nauty26r12/nautil.c nauty26r12/schreier.c nauty26r12/naurng.c nauty26r12/nausparse.c -Wno-write-strings -o Swatches -std=c++0x -O2 -pthread 
 
 */
 
 
 
 #define _USE_MATH_DEFINES
+#include <stdio.h>
 #include <math.h>
 #include <iostream>
 #include <list>
@@ -19,7 +20,9 @@ g++ Swatches.cpp Classification.cpp RootedGraph.cpp nauty26r12/nauty.c nauty26r1
 #include <unordered_map>
 #include <utility> 
 #include <iomanip> 
+#include <getopt.h>
 #include "Classification.h"
+#include "Stats.h"
 
 
 
@@ -39,6 +42,74 @@ vector<string> parseString(string toParse){
 	return toReturn;
 }
 
+//parses a comma-delimited list of integers
+vector<int> parseInts(string toParse){
+	vector<string> entries=parseString(toParse);
+	vector<int> toReturn;
+	for (int i=0;i<entries.size();i++){toReturn.push_back(atoi(entries[i].c_str()));}
+	return toReturn;
+}
+
+//true for the coordinate files read by network::loadCoordinates
+bool isCoordinateFile(string filename){
+	size_t dot=filename.rfind('.');
+	if (dot==string::npos){return false;}
+	string extension=filename.substr(dot);
+	return (extension==".xyz") or (extension==".extxyz") or (extension==".dump") or (extension==".lammpstrj");
+}
+
+//Converts a list of cutoffs to a matrix: a single value applies to all pairs of species, and otherwise the list holds
+//the cutoffs of the pairs (0,0),(0,1),...,(0,k-1),(1,1),...,(k-1,k-1) of species
+vector<vector<double> > cutoffMatrix(vector<string> entries){
+	if (entries.size()<=1){return {{(entries.size()==1)?atof(entries[0].c_str()):0.0}};}
+	int k=0;
+	while ((k+1)*(k+2)/2<=entries.size()){k++;}
+	if (k*(k+1)/2!=entries.size()){cout<<"WARNING: THE NUMBER OF CUTOFFS IS NOT k(k+1)/2 FOR k SPECIES."<<endl;}
+	vector<vector<double> > cutoffs(k,vector<double>(k,0));
+	int next=0;
+	for (int a=0;a<k;a++){for (int b=a;b<k;b++){
+		cutoffs[a][b]=atof(entries[next++].c_str());
+		cutoffs[b][a]=cutoffs[a][b];
+	}}
+	return cutoffs;
+}
+
+//The class catalog of a type and radius, in a file named after catalogPrefix.
+classCatalog* openCatalog(string catalogPrefix, int type, int r){
+	return new classCatalog(catalogPrefix+"_type"+to_string(type)+"_r"+to_string(r)+".cat",type,r);
+}
+
+bool isIdsFile(string filename){return (filename.size()>4) and (filename.substr(filename.size()-4)==".ids");}
+
+//Loads the empirical distributions saved in several .dat files (or .ids files, whose classes are taken from the catalog
+//with catalogPrefix) and combines them by a tree reduction. The files are loaded in parallel, and the merges in each
+//round of the reduction are performed in parallel.
+empiricalDistribution* mergeFiles(vector<string> files, bool samePreparations, string catalogPrefix){
+	classCatalog* catalog=NULL;
+	for (int i=0;(i<files.size()) and (catalog==NULL);i++){if (isIdsFile(files[i])){
+		if (catalogPrefix==""){
+			cout<<"WARNING: .ids FILES CAN ONLY BE MERGED WITH --catalog."<<endl;
+			break;
+		}
+		int fileType, fileR;
+		ifstream header(files[i]);
+		header>>fileType>>fileR;
+		catalog=openCatalog(catalogPrefix,fileType,fileR);
+	}}
+	vector<empiricalDistribution*> parts(files.size(),NULL);
+	parallelFor(files.size(),[&](int i){parts[i]=isIdsFile(files[i])?new empiricalDistribution(files[i],catalog):new empiricalDistribution(files[i]);});
+	while (parts.size()>1){
+		parallelFor(parts.size()/2,[&](int k){
+			parts[2*k]->merge(parts[2*k+1],samePreparations,true);
+			delete parts[2*k+1];
+		});
+		vector<empiricalDistribution*> merged={};
+		for (int k=0;k<parts.size();k+=2){merged.push_back(parts[k]);}
+		parts=merged;
+	}
+	return parts[0];
+}
+
 int main(int argc, char** argv) {
 	//f: file (SEPARATED BY COMMAS, EACH FILE A DIFFERENT DATA PREPARATION)
 
@@ -51,12 +122,119 @@ int main(int argc, char** argv) {
 	bool KL=false;
 	bool shannon=false;
 	string outname="";
-
+	vector<int> valencePattern={};
+	vector<int> colorPattern={};
+	int ordering=-1;
+	string trajectoryFile="";
+	vector<string> mergeList={};
+	bool samePreparations=true;
+	vector<int> rootRange={};
+	bool binary=false;
+	bool JS=false;
+	bool hellinger=false;
+	int replicates=0;
+	unsigned long seed=0;
+	int capacity=0;
+	long memoryBudget=0;
+	string spillDirectory=".";
+	double tolerance=0;
+	int batchSize=1000;
+	int convergenceMetric=0;
+	string checkpointFile="";
+	double checkpointInterval=600;
+	bool resume=false;
+	string statsFile="";
+	vector<string> speciesList={};
+	vector<string> cutoffList={};
+	vector<int> prepList={};
+	string catalogPrefix="";
+	bool refine=false;
+	int refinementRounds=-1;
+	int verifySample=0;
+	int maxBallSize=0;
+	int maxCandidateRings=0;
+	double maxNautyTime=0;
+	int budgetPolicy=0;
+	int fallbackType=5;
+	int contraction=-1;
+	string convertFile="";
+
+	//options without a single-letter form
+	enum {TRAJECTORY=256,MERGE,SEPARATE,ROOTS,BINARY,CONVERT,JSDIV,HELLINGER,BOOTSTRAP,SEED,APPROXIMATE,MEMORY,SPILL,SAMPLE,BATCH,CONVERGE,CHECKPOINT,CHECKPOINT_INTERVAL,RESUME,STATS,SPECIES,CUTOFFS,PREPS,CATALOG,REFINE,ROUNDS,VERIFY,MAX_BALL,MAX_RINGS,MAX_NAUTY_TIME,OVER_BUDGET,FALLBACK_TYPE,CONTRACT};
+	static struct option longOptions[]={
+		{"trajectory",required_argument,0,TRAJECTORY},
+		{"merge",required_argument,0,MERGE},
+		{"separate",no_argument,0,SEPARATE},
+		{"roots",required_argument,0,ROOTS},
+		{"binary",no_argument,0,BINARY},
+		{"convert",required_argument,0,CONVERT},
+		{"js",no_argument,0,JSDIV},
+		{"hellinger",no_argument,0,HELLINGER},
+		{"bootstrap",required_argument,0,BOOTSTRAP},
+		{"seed",required_argument,0,SEED},
+		{"approximate",required_argument,0,APPROXIMATE},
+		{"memory",required_argument,0,MEMORY},
+		{"spill",required_argument,0,SPILL},
+		{"sample",required_argument,0,SAMPLE},
+		{"batch",required_argument,0,BATCH},
+		{"converge",required_argument,0,CONVERGE},
+		{"checkpoint",required_argument,0,CHECKPOINT},
+		{"checkpoint-interval",required_argument,0,CHECKPOINT_INTERVAL},
+		{"resume",no_argument,0,RESUME},
+		{"stats",required_argument,0,STATS},
+		{"species",required_argument,0,SPECIES},
+		{"cutoffs",required_argument,0,CUTOFFS},
+		{"preps",required_argument,0,PREPS},
+		{"catalog",required_argument,0,CATALOG},
+		{"refine",no_argument,0,REFINE},
+		{"rounds",required_argument,0,ROUNDS},
+		{"verify",required_argument,0,VERIFY},
+		{"max-ball",required_argument,0,MAX_BALL},
+		{"max-rings",required_argument,0,MAX_RINGS},
+		{"max-nauty-time",required_argument,0,MAX_NAUTY_TIME},
+		{"over-budget",required_argument,0,OVER_BUDGET},
+		{"fallback-type",required_argument,0,FALLBACK_TYPE},
+		{"contract",required_argument,0,CONTRACT},
+		{0,0,0,0}
+	};
 	
 	int opt;
-	while ((opt = getopt(argc,argv,"f:t:r:s:p:keo:")) != EOF)
+	while ((opt = getopt_long(argc,argv,"f:t:r:s:p:keo:v:c:l:",longOptions,NULL)) != EOF)
 	switch(opt)
 	{
+		case TRAJECTORY: trajectoryFile=optarg; break;
+		case MERGE: mergeList=parseString(optarg); break;
+		case SEPARATE: samePreparations=false; break;
+		case ROOTS: rootRange=parseInts(optarg); break;
+		case BINARY: binary=true; break;
+		case CONVERT: convertFile=optarg; break;
+		case JSDIV: JS=true; break;
+		case HELLINGER: hellinger=true; break;
+		case BOOTSTRAP: replicates=atoi(optarg); break;
+		case SEED: seed=strtoul(optarg,NULL,10); break;
+		case APPROXIMATE: capacity=atoi(optarg); break;
+		case MEMORY: memoryBudget=atol(optarg)*1048576L; break;
+		case SPILL: spillDirectory=optarg; break;
+		case SAMPLE: tolerance=atof(optarg); break;
+		case BATCH: batchSize=atoi(optarg); break;
+		case CONVERGE: convergenceMetric=(string(optarg)=="entropy")?1:0; break;
+		case CHECKPOINT: checkpointFile=optarg; break;
+		case CHECKPOINT_INTERVAL: checkpointInterval=atof(optarg); break;
+		case RESUME: resume=true; break;
+		case STATS: statsFile=optarg; break;
+		case SPECIES: speciesList=parseString(optarg); break;
+		case CUTOFFS: cutoffList=parseString(optarg); break;
+		case PREPS: prepList=parseInts(optarg); break;
+		case CATALOG: catalogPrefix=optarg; break;
+		case REFINE: refine=true; break;
+		case ROUNDS: refinementRounds=atoi(optarg); break;
+		case VERIFY: verifySample=atoi(optarg); break;
+		case MAX_BALL: maxBallSize=atoi(optarg); break;
+		case MAX_RINGS: maxCandidateRings=atoi(optarg); break;
+		case MAX_NAUTY_TIME: maxNautyTime=atof(optarg); break;
+		case OVER_BUDGET: budgetPolicy=(string(optarg)=="fallback")?1:((string(optarg)=="defer")?2:0); break;
+		case FALLBACK_TYPE: fallbackType=atoi(optarg); break;
+		case CONTRACT: contraction=atoi(optarg); break;
 		case 'f': dataFiles=parseString(optarg); break;
 		case 't': type=atoi(optarg) ; break;
 		case 'r': r=atoi(optarg); break;
@@ -65,12 +243,42 @@ int main(int argc, char** argv) {
 		case 'k': KL=true; break;
 		case 'e': shannon=true; break;
 		case 'o': outname=optarg; break;
+		case 'v': valencePattern=parseInts(optarg); break;
+		case 'c': colorPattern=parseInts(optarg); break;
+		case 'l': ordering=atoi(optarg); break;
 
-		case '?': fprintf(stderr, "Usage is \n -f : for names of graphs to load \n -t: for the equivalence class type \n -r: for the radius \n -s: for the selection type \n -o: for the name of the output file \n  -p: for the exponent of the Lp norm \n -k: to compute the KL divergence \n -e: to compute the Shannon entropy. \n Please see the readme for more details.");
+		case '?': fprintf(stderr, "Usage is \n -f : for names of graphs to load \n -t: for the equivalence class type \n -r: for the radius \n -s: for the selection type \n -o: for the name of the output file \n  -p: for the exponent of the Lp norm \n -k: to compute the KL divergence \n -e: to compute the Shannon entropy \n -v: for a repeated pattern of valences by shell that roots must satisfy \n -c: for a repeated pattern of colors by shell that roots must satisfy \n -l: to reorder the vertices for memory locality (0: breadth-first, 1: reverse Cuthill-McKee, 2: recursive bisection) \n --trajectory: for the name of a trajectory file, whose frames are classified one at a time \n --merge: for names of saved .dat files to combine \n --separate: to treat the preparations of each merged file as new preparations \n --roots: for a range of root indices begin,end \n --binary: to save the distribution and distances in binary formats \n --js: to compute the Jensen-Shannon divergence \n --hellinger: to compute the Hellinger distance \n --bootstrap: for a number of bootstrap replicates used to compute confidence intervals \n --seed: for the seed of the bootstrap \n --approximate: for the maximum number of equivalence classes stored in the approximate mode \n --memory: for the memory budget of the dictionary in megabytes \n --spill: for the directory of the files written when the memory budget is exceeded \n --sample: for the tolerance of the sampling mode \n --batch: for the number of roots in each batch of the sampling mode \n --converge: for the convergence criterion of the sampling mode (l1 or entropy) \n --checkpoint: for the name of a checkpoint file \n --checkpoint-interval: for the number of seconds between checkpoints \n --resume: to continue from the checkpoint \n --stats: for the name of a JSON file of timings and counters (requires compiling with -DSWATCHES_STATS) \n --species: for the species of coordinate files, in the order of their colors \n --cutoffs: for the bond cutoffs of pairs of species in coordinate files \n --preps: for the data preparations of the files \n --catalog: for the name of the class catalogs giving stable ids to equivalence classes \n --refine: to compute the distributions of all radii up to r in a single pass, using the roots selected at radius r \n --rounds: for the number of rounds of color refinement (type 5) \n --verify: for the number of roots of each file on which color refinement is compared with graph isomorphism \n --max-ball: for the maximum number of vertices in the ball of a root \n --max-rings: for the maximum number of candidate rings of a root (type 2) \n --max-nauty-time: for the maximum number of seconds nauty may spend on a root (type 0) \n --over-budget: for the handling of roots over these limits (skip, fallback or defer) \n --fallback-type: for the equivalence type used for roots over the limits with --over-budget fallback \n --contract: for the color of bridging vertices (two neighbors) to replace by edges, e.g. 1 for the oxygens of silica \n --convert: for the name of a saved distribution to convert between the text and binary formats. \n Please see the readme for more details.");
 	}
 
 
-	if (dataFiles.size()==0){
+#ifndef SWATCHES_STATS
+	if (statsFile!=""){
+		cout<<"WARNING: --stats requires compiling with -DSWATCHES_STATS. No statistics will be saved."<<endl;
+		statsFile="";
+	}
+#endif
+
+	if (convertFile!=""){
+		bool toText=distributionFile::isBinary(convertFile);
+		if (outname==""){
+			outname=convertFile;
+			size_t dot=outname.rfind('.');
+			if ((dot!=string::npos) and ((outname.substr(dot)==".dat") or (outname.substr(dot)==".bdat"))){outname=outname.substr(0,dot);}
+		}
+		empiricalDistribution* cloth=new empiricalDistribution(convertFile);
+		if (toText){
+			cloth->saveData_toLoad(outname);
+			cout<<"Empirical distribution saved to "<<outname<<".dat."<<endl;
+		}
+		else {
+			cloth->saveData_toBinary(outname);
+			cout<<"Empirical distribution saved to "<<outname<<".bdat."<<endl;
+		}
+		delete cloth;
+		return 0;
+	}
+
+	if ((dataFiles.size()==0) and (trajectoryFile=="") and (mergeList.size()==0)){
 		cout<<"Please provide at least one data file. See the readme for usage information."<<endl;
 		return 0;
 	}
@@ -86,50 +294,246 @@ int main(int argc, char** argv) {
 	}
 
 
-	cout<<endl<<"Classifying environments up to ";
+	empiricalDistribution* cloth;
 
-	if (type==1){cout<<"H1 barcode equivalence ";}
-	else if (type==2){cout<<"primitive ring profile equivalence ";}
-	else if (type==3){cout<<"coordination profile equivalence ";}
-	else if (type==4){cout<<"shell count equivalence ";}
-	else {cout<<"graph isomorphism ";} //t=0
-	cout<<"at radius "<<r<<endl<<endl;
- 
+	if (mergeList.size()>0){
+		cout<<endl<<"Merging "<<mergeList.size()<<" saved distributions."<<endl;
+		cloth=mergeFiles(mergeList,samePreparations,catalogPrefix);
+		cout<<endl<<"Merge complete."<<endl<<endl;
+		if (outname==""){outname=mergeList[0]+"_merged";}
+	}
+	else {
 
-	empiricalDistribution* cloth=new empiricalDistribution(type,r,selection);
+		cout<<endl<<"Classifying environments up to ";
 
-	cout<<"Loading data."<<endl;
+		if (type==1){cout<<"H1 barcode equivalence ";}
+		else if (type==2){cout<<"primitive ring profile equivalence ";}
+		else if (type==3){cout<<"coordination profile equivalence ";}
+		else if (type==4){cout<<"shell count equivalence ";}
+		else if (type==5){cout<<"color refinement equivalence ";}
+		else {cout<<"graph isomorphism ";} //t=0
+		cout<<"at radius "<<r<<endl<<endl;
+ 
 
-	for (int i=0;i<dataFiles.size();i++){
-		cout<<"Loading file "<<i<<endl;
-		network* curGraph=new network(dataFiles[i]);
-		cout<<"Computing the empirical distribution for file "<<i<<endl;
-		cloth->computeDistribution(curGraph);
+		if ((verifySample>0) and (type!=5)){
+			cout<<"WARNING: --verify IS ONLY AVAILABLE FOR TYPE 5."<<endl;
+			verifySample=0;
+		}
+
+		cloth=new empiricalDistribution(type,r,selection);
+		cloth->refinementRounds=refinementRounds;
+		if (valencePattern.size()>0){cloth->pattern.valences=valencePattern;}
+		if (colorPattern.size()>0){cloth->pattern.colors=colorPattern;}
+		if (rootRange.size()==2){
+			cloth->rootBegin=rootRange[0];
+			cloth->rootEnd=rootRange[1];
+		}
+		if (capacity>0){cloth->setApproximate(capacity);}
+		cloth->memoryBudget=memoryBudget;
+		cloth->spillDirectory=spillDirectory;
+		cloth->tolerance=tolerance;
+		cloth->batchSize=batchSize;
+		cloth->convergenceMetric=convergenceMetric;
+		cloth->samplingSeed=seed;
+		cloth->checkpointFile=checkpointFile;
+		cloth->checkpointInterval=checkpointInterval;
+		cloth->maxBallSize=maxBallSize;
+		cloth->maxCandidateRings=maxCandidateRings;
+		cloth->maxNautyTime=maxNautyTime;
+		cloth->budgetPolicy=budgetPolicy;
+		cloth->fallbackType=fallbackType;
+		if ((contraction>=0) and ((type==2) or (r%2==1) or refine or (trajectoryFile!=""))){
+			cout<<"WARNING: --contract REQUIRES AN EVEN RADIUS AND A TYPE OTHER THAN 2, AND IS NOT AVAILABLE WITH --refine OR --trajectory. IT WILL NOT BE USED."<<endl;
+			contraction=-1;
+		}
+		cloth->contraction=contraction;
+		bool budget=(maxBallSize>0) or (maxCandidateRings>0) or (maxNautyTime>0);
+		if (catalogPrefix!=""){cloth->catalog=openCatalog(catalogPrefix,type,r);}
+
+		int firstFile=0;
+		if (resume){
+			if ((checkpointFile!="") and cloth->resume(checkpointFile)){
+				firstFile=cloth->fileCursor;
+				cout<<"Resuming from file "<<firstFile<<", candidate root "<<cloth->resumeCursor<<"."<<endl;
+			}
+			else {cout<<"WARNING: NO CHECKPOINT FOUND. STARTING FROM THE FIRST FILE."<<endl;}
+		}
+
+		if (trajectoryFile!=""){
+			if (outname==""){outname=trajectoryFile;}
+			cout<<"Classifying the frames of "<<trajectoryFile<<"."<<endl;
+			cloth->computeTrajectory(trajectoryFile,outname);
+			cout<<endl<<"Computation complete."<<endl<<endl;
+			cout<<"Per-frame histograms saved to "<<outname<<"_trajectory.txt, transitions between frames to "<<outname<<"_transitions.txt, and equivalence classes to "<<outname<<"_classes.txt."<<endl<<endl;
+			return 0;
+		}
+
+		//all radii up to r in a refinement trie, from which the distribution of radius r is taken
+		refinementTrie* trie=NULL;
+		if (refine){
+			if ((capacity>0) or (memoryBudget>0) or (tolerance>0) or (checkpointFile!="") or (rootRange.size()>0) or budget){
+				cout<<"WARNING: THE APPROXIMATE, MEMORY BUDGET, SAMPLING, CHECKPOINT, ROOT RANGE AND PER-ROOT BUDGET OPTIONS ARE NOT AVAILABLE WITH --refine."<<endl;
+			}
+			budget=false;
+			trie=new refinementTrie(type,r,selection);
+			trie->pattern=cloth->pattern;
+			trie->refinementRounds=refinementRounds;
+			firstFile=0;
+		}
+
+		cout<<"Loading data."<<endl;
+
+		for (int i=firstFile;i<dataFiles.size();i++){
+			cout<<"Loading file "<<i<<endl;
+			network* curGraph;
+			if (isCoordinateFile(dataFiles[i])){
+				curGraph=new network();
+				curGraph->species=speciesList;
+				curGraph->loadCoordinates(dataFiles[i],cutoffMatrix(cutoffList),(i<prepList.size())?prepList[i]:0);
+			}
+			else {curGraph=new network(dataFiles[i]);}
+			if (i<prepList.size()){curGraph->dataPrep=prepList[i];}
+			if (ordering>=0){curGraph->reorder(ordering);}
+			cout<<"Computing the empirical distribution for file "<<i<<endl;
+			if (verifySample>0){cloth->verifyRefinement(curGraph,verifySample,seed);}
+			if (trie!=NULL){
+				trie->computeDistribution(curGraph);
+				continue;
+			}
+			cloth->fileCursor=i;
+			cloth->computeDistribution(curGraph);
+			cloth->fileCursor=i+1;
+			cloth->checkpoint(0);
+		}
+		cloth->finishCheckpoints();
+		cout<<endl<<"Computation complete."<<endl<<endl;
+		if (contraction>=0){cout<<cloth->contractedRoots<<" roots classified on the contracted networks."<<endl<<endl;}
+
+		if (outname==""){outname=dataFiles[0];}
+
+		if (verifySample>0){
+			cloth->saveVerificationReport(outname);
+			cout<<"Comparison of color refinement with graph isomorphism on "<<cloth->verifiedRoots<<" roots saved to "<<outname<<"_verify.txt."<<endl<<endl;
+		}
+
+		if (trie!=NULL){
+			for (int k=1;k<r;k++){
+				empiricalDistribution* curCloth=trie->distribution(k);
+				if (binary){curCloth->saveData_toBinary(outname+"_r"+to_string(k));}
+				else {curCloth->saveData_toLoad(outname+"_r"+to_string(k));}
+				delete curCloth;
+			}
+			trie->saveRefinements(outname);
+			cout<<"Empirical distributions of radii 1 to "<<r-1<<" saved to "<<outname<<"_r1"<<(binary?".bdat":".dat")<<", ..., and the refinements of each class to "<<outname<<"_refinements.txt (class data in "<<trie->storedBytes<<" bytes instead of "<<trie->fullBytes<<")."<<endl<<endl;
+			classCatalog* catalog=cloth->catalog;
+			delete cloth;
+			cloth=trie->distribution(r);
+			cloth->catalog=catalog;
+			delete trie;
+		}
+
+		if (tolerance>0){
+			for (int i=0;i<cloth->samplingSummaries.size();i++){
+				samplingSummary& cur=cloth->samplingSummaries[i];
+				cout<<"File "<<i<<": used "<<cur.rootsUsed<<" of "<<cur.candidates<<" candidate roots"<<(cur.converged?"":" (did not converge)")<<", entropy "<<cur.entropy<<" +/- "<<cur.entropyStandardError<<endl;
+			}
+			cloth->saveSamplingReport(outname);
+			cout<<"Sampling summary saved to "<<outname<<"_sampling.txt."<<endl<<endl;
+		}
+
+		if (budget){
+			for (int i=0;i<cloth->budgetSummaries.size();i++){
+				budgetSummary& cur=cloth->budgetSummaries[i];
+				long over=cur.overBallSize+cur.overCandidateRings+cur.overNautyTime;
+				cout<<"File "<<i<<": "<<over<<" of "<<cur.roots<<" roots over the budget ("<<cur.skipped<<" skipped, "<<cur.fellBack<<" classified with type "<<cloth->fallbackType<<", "<<cur.deferred<<" deferred)"<<endl;
+			}
+			cloth->saveBudgetReport(outname);
+			cout<<"Roots over the budget saved to "<<outname<<"_budget.txt."<<endl;
+			if (cloth->fallback!=NULL){
+				if (binary){cloth->fallback->saveData_toBinary(outname+"_fallback");}
+				else {cloth->fallback->saveData_toLoad(outname+"_fallback");}
+				cout<<"Empirical distribution of the roots classified with type "<<cloth->fallbackType<<" saved to "<<outname<<"_fallback"<<(binary?".bdat":".dat")<<"."<<endl;
+			}
+			cout<<endl;
+		}
+
+		if (capacity>0){
+			cloth->saveSketchReport(outname);
+			cout<<"Approximate mode: error bounds and estimates saved to "<<outname<<"_sketch.txt."<<endl<<endl;
+		}
+
+		if (cloth->runs.size()>0){
+			cout<<"The memory budget was exceeded and data was written to "<<cloth->runs.size()<<" files in "<<spillDirectory<<". Merging."<<endl;
+			//the dictionary only holds the classes detected since the last spill, so the rest of the output is
+			//computed from the merged distribution
+			cloth->saveData_toLoad(outname);
+			delete cloth;
+			cloth=new empiricalDistribution(outname+".dat");
+			if (binary){remove((outname+".dat").c_str());}
+			cout<<"Merge complete."<<endl<<endl;
+		}
 	}
-	cout<<endl<<"Computation complete."<<endl<<endl;
-
-	if (outname==""){outname=dataFiles[0];}
 
+	//all requested distances are computed in a single pass over the frequencies
+	vector<int> metrics={};
+	vector<string> metricNames={};
+	string extension=binary?".bin":".txt";
 	if (Lp>0){
-		cloth->LNorm(Lp,outname);
-		cout<<"L"<<Lp<<" norm data saved to "<<outname<<"_L"<<Lp<<".txt."<<endl<<endl;
+		metrics.push_back(0);
+		metricNames.push_back("L"+to_string(Lp)+" norm data saved to "+outname+"_L"+to_string(Lp)+extension);
+	}
+	if (KL){
+		metrics.push_back(1);
+		metricNames.push_back("KL Divergence data saved to "+outname+"_KL"+extension);
+	}
+	if (JS){
+		metrics.push_back(2);
+		metricNames.push_back("Jensen-Shannon divergence data saved to "+outname+"_JS"+extension);
+	}
+	if (hellinger){
+		metrics.push_back(3);
+		metricNames.push_back("Hellinger distance data saved to "+outname+"_hellinger"+extension);
+	}
+	if (metrics.size()>0){
+		if (cloth->numPreps==1){cout<<"ONLY ONE PREPARATION - CANNOT COMPUTE DISTANCES"<<endl;}
+		cloth->distances(metrics,max(Lp,1),outname,binary);
+		for (int i=0;i<metricNames.size();i++){cout<<metricNames[i]<<"."<<endl<<endl;}
 	}
+
 	if (shannon){
 		cloth->shannonEntropy(outname);
 		cout<<"Shannon entropy data saved to "<<outname<<"_shannonEntropy_unrescaled.txt."<<endl<<endl;
 	}
 
-	if (KL){
-		cloth->KLDivergence(outname);
-		cout<<"KL Divergence data saved to "<<outname<<"_KL.txt."<<endl<<endl;
+	if (replicates>0){
+		cout<<"Computing "<<replicates<<" bootstrap replicates."<<endl;
+		cloth->bootstrap(metrics,max(Lp,1),replicates,0.95,seed,outname);
+		cout<<"Bootstrap confidence intervals saved to "<<outname<<"_bootstrap.txt."<<endl<<endl;
+	}
+
+	if (binary){
+		cloth->saveData_toBinary(outname);
+		cout<<"Empirical distribution saved to "<<outname<<".bdat."<<endl<<endl;
+	}
+	else {
+		cloth->saveData_toLoad(outname);
+		cout<<"Empirical distribution saved to "<<outname<<".dat."<<endl<<endl;
 	}
 
-	cloth->saveData_toLoad(outname);
-	cout<<"Empirical distribution saved to "<<outname<<".dat."<<endl<<endl;
+	if (catalogPrefix!=""){
+		if (cloth->catalog==NULL){cloth->catalog=openCatalog(catalogPrefix,cloth->type,cloth->r);}
+		cloth->saveData_toIds(outname);
+		cout<<"Class ids saved to "<<outname<<".ids, with the classes in "<<cloth->catalog->filename<<" ("<<cloth->catalog->size()<<" classes)."<<endl<<endl;
+	}
 
 	cloth->saveData_toView(outname);
 	cout<<"Empirical distribution data can be viewed at "<<outname<<".txt."<<endl<<endl;
 
+	if (statsFile!=""){
+		STATS_SAVE(statsFile);
+		cout<<"Timings and counters saved to "<<statsFile<<"."<<endl<<endl;
+	}
+
 
 	return 0;
 }
@@ -0,0 +1,109 @@
+//Please see SwatchesAPI.h for documentation.
+
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <boost/array.hpp>
+#include "Classification.h"
+#include "SwatchesAPI.h"
+
+using namespace std;
+
+struct swatchesContext{
+	empiricalDistribution* cloth;
+	network* curGraph;
+};
+
+swatchesContext* swatchesCreate(int type, int r, int selection, int maxExamples){
+	if ((type<0) or (type>5) or (r<=0)){return NULL;}
+	swatchesContext* context=new swatchesContext;
+	context->cloth=new empiricalDistribution(type,r,selection);
+	context->cloth->maxExamples=maxExamples;
+	context->curGraph=new network();
+	return context;
+}
+
+int swatchesCompute(swatchesContext* context, const swatchesGraph* graph, swatchesResult* result){
+	if ((context==NULL) or (graph==NULL) or (graph->numVertices<0) or (graph->dataPrep<0)){return -1;}
+	if ((graph->numVertices>0) and ((graph->offsets==NULL) or (graph->adjacency==NULL))){return -1;}
+	for (int i=0;i<graph->numVertices;i++){
+		if (graph->offsets[i]>graph->offsets[i+1]){return -1;}
+	}
+	for (int64_t k=0;k<((graph->numVertices>0)?graph->offsets[graph->numVertices]:0);k++){
+		if ((graph->adjacency[k]<0) or (graph->adjacency[k]>=graph->numVertices)){return -1;}
+	}
+
+	network* curGraph=context->curGraph;
+	empiricalDistribution* cloth=context->cloth;
+	curGraph->load(graph->numVertices,graph->offsets,graph->adjacency,graph->colors,graph->dataPrep);
+	cloth->computeDistribution(curGraph);
+	if (result==NULL){return 0;}
+
+	result->numVertices=graph->numVertices;
+	result->rootClasses=(int32_t*) malloc(sizeof(int32_t)*max(1,graph->numVertices));
+	for (int i=0;i<graph->numVertices;i++){
+		eClass* curClass=(i<curGraph->rootClasses.size())?curGraph->rootClasses[i]:NULL;
+		result->rootClasses[i]=(curClass!=NULL)?curClass->id:-1;
+	}
+
+	//the class table, indexed by id
+	int numClasses=cloth->numClasses;
+	int numPreps=cloth->numPreps;
+	vector<eClass*> classes(numClasses,NULL);
+	for (auto& elt:cloth->distr){for (int j=0;j<elt.second.size();j++){classes[elt.second[j]->id]=elt.second[j];}}
+	long numRows=0;
+	long numData=0;
+	for (int c=0;c<numClasses;c++){
+		numRows+=classes[c]->data.size();
+		for (int k=0;k<classes[c]->data.size();k++){numData+=classes[c]->data[k].size();}
+	}
+	result->numClasses=numClasses;
+	result->numPreps=numPreps;
+	result->counts=(int64_t*) malloc(sizeof(int64_t)*max(1,numClasses*numPreps));
+	result->classRows=(int64_t*) malloc(sizeof(int64_t)*(numClasses+1));
+	result->rowOffsets=(int64_t*) malloc(sizeof(int64_t)*(numRows+1));
+	result->data=(int32_t*) malloc(sizeof(int32_t)*max(1L,numData));
+	long row=0;
+	long entry=0;
+	result->rowOffsets[0]=0;
+	for (int c=0;c<numClasses;c++){
+		for (int p=0;p<numPreps;p++){result->counts[c*numPreps+p]=classes[c]->counts[p];}
+		result->classRows[c]=row;
+		for (int k=0;k<classes[c]->data.size();k++){
+			vector<int>& curRow=classes[c]->data[k];
+			for (int m=0;m<curRow.size();m++){result->data[entry++]=curRow[m];}
+			result->rowOffsets[++row]=entry;
+		}
+	}
+	result->classRows[numClasses]=row;
+	return 0;
+}
+
+int swatchesSave(swatchesContext* context, const char* filename){
+	if ((context==NULL) or (filename==NULL)){return -1;}
+	context->cloth->saveData_toLoad(filename);
+	return 0;
+}
+
+void swatchesFreeResult(swatchesResult* result){
+	if (result==NULL){return;}
+	free(result->rootClasses);
+	free(result->counts);
+	free(result->classRows);
+	free(result->rowOffsets);
+	free(result->data);
+	result->rootClasses=NULL;
+	result->counts=NULL;
+	result->classRows=NULL;
+	result->rowOffsets=NULL;
+	result->data=NULL;
+}
+
+void swatchesDestroy(swatchesContext* context){
+	if (context==NULL){return;}
+	delete context->cloth;
+	delete context->curGraph;
+	delete context;
+}
@@ -0,0 +1,73 @@
+/*
+C interface for computing empirical distributions of graphs held in memory, for example by a simulation that calls
+Swatches every few hundred steps without writing input files. The graph is passed in compressed sparse row format and
+loaded with network::load (see Classification.h), which reuses the vertices of the previous call when the number of
+vertices is unchanged. A context keeps one empirical distribution across calls, so the ids of equivalence classes are
+stable and the counts accumulate over calls (use the data preparation of each graph to keep them apart).
+
+	swatchesContext* context=swatchesCreate(1,3,-1,10);
+	swatchesGraph graph={numVertices,offsets,adjacency,colors,0};
+	swatchesResult result;
+	if (swatchesCompute(context,&graph,&result)==0){
+		//result.rootClasses[i] is the id of the equivalence class of the local environment of vertex i
+		swatchesFreeResult(&result);
+	}
+	swatchesDestroy(context);
+
+All functions return 0 on success and -1 if their arguments are invalid. To build a library, compile SwatchesAPI.cpp
+with Classification.cpp, RootedGraph.cpp and nauty (see the readme).
+*/
+
+#ifndef SWATCHESAPI_H
+#define SWATCHESAPI_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct swatchesContext swatchesContext;
+
+//A graph owned by the caller: the neighbors of vertex i are adjacency[offsets[i]],...,adjacency[offsets[i+1]-1], and
+//its color is colors[i] (colors may be NULL). The adjacency must be symmetric. The arrays are only read during
+//swatchesCompute.
+typedef struct swatchesGraph{
+	int numVertices;
+	const int64_t* offsets; //numVertices+1 entries
+	const int32_t* adjacency;
+	const int32_t* colors;
+	int dataPrep;
+} swatchesGraph;
+
+//The result of swatchesCompute, allocated by the library and released with swatchesFreeResult.
+typedef struct swatchesResult{
+	int numVertices;
+	int32_t* rootClasses; //id of the equivalence class of vertex i, or -1 if vertex i was not selected as a root
+	int numClasses; //all equivalence classes detected so far by the context, with ids 0,...,numClasses-1
+	int numPreps;
+	int64_t* counts; //counts[id*numPreps+p]: number of roots of preparation p in class id, over all calls
+	int64_t* classRows; //the data of class id consists of rows classRows[id],...,classRows[id+1]-1
+	int64_t* rowOffsets; //row k is data[rowOffsets[k]],...,data[rowOffsets[k+1]-1]
+	int32_t* data; //the data of the classes (eClass::data in RootedGraph.h), whose meaning depends on the type
+} swatchesResult;
+
+swatchesContext* swatchesCreate(int type, int r, int selection, int maxExamples);
+//Creates a context that classifies local environments of radius r with the given type and root selection (see
+//empiricalDistribution in Classification.h), storing at most maxExamples examples per class and preparation (-1: no
+//limit). Returns NULL if the type or radius is invalid.
+
+int swatchesCompute(swatchesContext* context, const swatchesGraph* graph, swatchesResult* result);
+//Adds the roots of graph to the distribution of the context, and fills result (if it is not NULL).
+
+int swatchesSave(swatchesContext* context, const char* filename);
+//Saves the distribution of the context to filename+".dat", in the format of empiricalDistribution::saveData_toLoad.
+
+void swatchesFreeResult(swatchesResult* result);
+void swatchesDestroy(swatchesContext* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+/*
+Regression tests. Each test prints PASS or FAIL, and the program returns the number of failed tests. Run it from the
+directory that contains the included Voronoi graphs. Type 0 is not tested, since its canonical forms depend on the
+version of nauty.
+
+To compile, use the following:
+
+ g++ Tests.cpp Classification.cpp RootedGraph.cpp nauty26r12/nauty.c nauty26r12/nautil.c nauty26r12/schreier.c nauty26r12/naurng.c nauty26r12/nausparse.c -Wno-write-strings -o swatchesTests -std=c++0x -O2 -pthread
+
+*/
+
+
+
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include "Classification.h"
+
+
+
+using namespace std;
+
+int numFailed=0;
+
+void check(bool passed, string name){
+	cout<<(passed?"PASS ":"FAIL ")<<name<<endl;
+	if (!passed){numFailed++;}
+}
+
+string readFile(string filename){
+	ifstream fs(filename);
+	stringstream ss;
+	ss<<fs.rdbuf();
+	return ss.str();
+}
+
+//Saves the distribution to filename+".dat", returns its content and deletes the file.
+string savedData(empiricalDistribution* cloth, string filename){
+	cloth->saveData_toLoad(filename);
+	string content=readFile(filename+".dat");
+	remove((filename+".dat").c_str());
+	return content;
+}
+
+//The counts of each equivalence class, which do not depend on the order in which the classes were detected.
+map<vector<vector<int> >,vector<int> > classCounts(empiricalDistribution* cloth){
+	map<vector<vector<int> >,vector<int> > counts;
+	for (pair<const int,vector<eClass*> >& elt : cloth->distr){for (int i=0;i<elt.second.size();i++){
+		counts[elt.second[i]->data]=elt.second[i]->counts;
+	}}
+	return counts;
+}
+
+//Removing and adding back edges is a no-op, so updateDistribution must leave the saved distribution unchanged, also
+//when only some vertices are roots, when sampling (tolerance>0) stops before all candidates are used, or when the
+//roots over a budget on the size of their balls are skipped.
+void testNoOpUpdate(int type, int r, int selection, vector<int> indices, double tolerance=0, int maxBallSize=0){
+	network* curGraph=new network("voronoi_uniform_10K.cfg");
+	empiricalDistribution* cloth=new empiricalDistribution(type,r,selection);
+	cloth->tolerance=tolerance;
+	cloth->maxBallSize=maxBallSize;
+	cloth->computeDistribution(curGraph,indices);
+	string before=savedData(cloth,"swatches_test_before");
+
+	for (int i=0;i<1000;i+=100){
+		int j=curGraph->vertices[i]->neighbors[0]->index;
+		curGraph->removeEdge(i,j);
+		curGraph->addEdge(i,j);
+	}
+	cloth->updateDistribution(curGraph);
+	string after=savedData(cloth,"swatches_test_after");
+	check((before.size()>0) and (before==after),"no-op update, type "+to_string(type)+", selection "+to_string(selection)+", "+to_string(indices.size())+" custom roots"+((tolerance>0)?", sampling":"")+((maxBallSize>0)?", budget":""));
+	delete cloth;
+	delete curGraph;
+}
+
+//The distribution of each radius taken from a refinement trie, whose rooted graphs grow by one shell per radius, must
+//be the same as the distribution computed directly at that radius.
+void testRefinementTrie(int type, int maxR){
+	network* curGraph=new network("voronoi_uniform_10K.cfg");
+	refinementTrie* trie=new refinementTrie(type,maxR,-1);
+	trie->computeDistribution(curGraph);
+	for (int k=1;k<=maxR;k++){
+		empiricalDistribution* direct=new empiricalDistribution(type,k,-1);
+		direct->computeDistribution(curGraph);
+		empiricalDistribution* fromTrie=trie->distribution(k);
+		string expected=savedData(direct,"swatches_test_direct");
+		check((expected.size()>0) and (expected==savedData(fromTrie,"swatches_test_trie")),"refinement trie, type "+to_string(type)+", radius "+to_string(k));
+		delete direct;
+		delete fromTrie;
+	}
+	delete trie;
+	delete curGraph;
+}
+
+//Roots over a budget on the size of their balls must not change the equivalence classes of the other roots: with
+//policies 0 (skip) and 1 (fallback), the other roots keep the classes they have without a budget, and with policy 2
+//(defer) the counts are the same as without a budget (but classes first detected at deferred roots get later ids).
+void testBudget(int type, int r, int maxBallSize, int policy){
+	network* curGraph=new network("voronoi_uniform_10K.cfg");
+	empiricalDistribution* unlimited=new empiricalDistribution(type,r,-1);
+	unlimited->computeDistribution(curGraph);
+	vector<vector<vector<int> > > expected(curGraph->vertices.size());
+	for (int i=0;i<expected.size();i++){expected[i]=curGraph->rootClasses[i]->data;}
+
+	empiricalDistribution* budgeted=new empiricalDistribution(type,r,-1);
+	budgeted->maxBallSize=maxBallSize;
+	budgeted->budgetPolicy=policy;
+	budgeted->computeDistribution(curGraph);
+	long numOver=budgeted->budgetSummaries.back().affected.size();
+	bool passed=(numOver>0); //otherwise the test is meaningless
+	if (policy==2){passed=passed and (classCounts(unlimited)==classCounts(budgeted));}
+	else {
+		long numClassified=0;
+		for (int i=0;i<expected.size();i++){if (curGraph->rootClasses[i]!=NULL){
+			numClassified++;
+			if (curGraph->rootClasses[i]->data!=expected[i]){passed=false;}
+		}}
+		passed=passed and (numClassified+numOver==expected.size());
+	}
+	check(passed,"budget, type "+to_string(type)+", policy "+to_string(policy)+", "+to_string(numOver)+" roots over the budget");
+	delete unlimited;
+	delete budgeted;
+	delete curGraph;
+}
+
+int main(int argc, char** argv) {
+	vector<int> firstRoots={};
+	for (int i=0;i<1000;i++){firstRoots.push_back(i);}
+	for (int type=1;type<=4;type++){
+		testNoOpUpdate(type,3,-1,{});
+		testNoOpUpdate(type,3,-3,firstRoots);
+		testNoOpUpdate(type,3,-1,{},0.05);
+	}
+	for (int type=1;type<=5;type++){testRefinementTrie(type,5);}
+	for (int type=1;type<=4;type++){
+		testNoOpUpdate(type,3,-1,{},0,20);
+		for (int policy=0;policy<=2;policy++){testBudget(type,4,36,policy);}
+	}
+
+	cout<<numFailed<<" tests failed."<<endl;
+	return numFailed;
+}